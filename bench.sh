@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Builds the 32- and 64-bit simulators in release mode and reports the
+# simulation speed of each on a benchmark program, as the best of $RUNS runs.
+# Usage: bench.sh [program] (default: tests/bench/memloop.bin)
+
+RUNS=5
+
+# Make sure current working directory is the directory of the build script
+cd "${0%/*}"
+
+SOURCE_ROOT=$(pwd)
+PROGRAM=${1:-$SOURCE_ROOT/tests/bench/memloop.bin}
+
+for XLEN in 32 64; do
+    BUILD_DIRECTORY=$SOURCE_ROOT/build-leros-sim-bench$XLEN
+    if [ $XLEN == 64 ]; then LEROS64=ON; else LEROS64=OFF; fi
+
+    cmake -S $SOURCE_ROOT -B $BUILD_DIRECTORY -DCMAKE_BUILD_TYPE="Release" -DLEROS64=$LEROS64 > /dev/null
+    cmake --build $BUILD_DIRECTORY > /dev/null || exit 1
+
+    echo -n "Leros$XLEN: "
+    for i in $(seq $RUNS); do
+        $BUILD_DIRECTORY/leros-sim -f $PROGRAM --stats 2>&1 >/dev/null
+    done | sort -t'(' -k2 -g -r | head -n 1
+done
@@ -0,0 +1,115 @@
+#include "cache.h"
+
+#include <algorithm>
+
+namespace {
+
+bool isPowerOfTwo(unsigned x) { return x != 0 && (x & (x - 1)) == 0; }
+
+unsigned log2(unsigned x) {
+  unsigned n = 0;
+  while (x >>= 1) {
+    n++;
+  }
+  return n;
+}
+
+} // namespace
+
+bool CacheConfig::valid() const {
+  return isPowerOfTwo(size) && isPowerOfTwo(ways) && isPowerOfTwo(lineSize) &&
+         size >= ways * lineSize && (data || instructions);
+}
+
+std::string CacheConfig::name() const {
+  std::string s = size % 1024 == 0 ? std::to_string(size / 1024) + "k"
+                                   : std::to_string(size);
+  s += ":" + std::to_string(ways) + ":" + std::to_string(lineSize);
+  switch (replacement) {
+  case CacheReplacement::LRU:
+    s += ":lru";
+    break;
+  case CacheReplacement::FIFO:
+    s += ":fifo";
+    break;
+  case CacheReplacement::Random:
+    s += ":random";
+    break;
+  }
+  s += writeBack ? ":wb" : ":wt";
+  s += data && instructions ? ":id" : instructions ? ":i" : ":d";
+  return s;
+}
+
+Cache::Cache(const CacheConfig &config)
+    : m_config(config), m_lineShift(log2(config.lineSize)),
+      m_setMask(config.size / config.lineSize / config.ways - 1),
+      m_lines(config.size / config.lineSize) {}
+
+void Cache::reset(size_t slots) {
+  std::fill(m_lines.begin(), m_lines.end(), Line());
+  m_clock = 0;
+  m_random = 1;
+  m_noAllocateMisses = 0;
+  m_stats = CacheStats();
+  m_slotAccesses.assign(slots, 0);
+  m_slotMisses.assign(slots, 0);
+}
+
+bool Cache::access(uint64_t addr, bool write, size_t slot) {
+  const uint64_t tag = addr >> m_lineShift;
+  Line *set = &m_lines[(tag & m_setMask) * m_config.ways];
+  m_clock++;
+  m_slotAccesses[slot]++;
+  (write ? m_stats.writes : m_stats.reads)++;
+  if (write && !m_config.writeBack) {
+    m_stats.writeThroughs++;
+  }
+
+  for (unsigned way = 0; way < m_config.ways; way++) {
+    Line &line = set[way];
+    if (line.valid && line.tag == tag) {
+      if (m_config.replacement == CacheReplacement::LRU) {
+        line.stamp = m_clock;
+      }
+      line.dirty |= write && m_config.writeBack;
+      return true;
+    }
+  }
+
+  m_slotMisses[slot]++;
+  (write ? m_stats.writeMisses : m_stats.readMisses)++;
+  if (write && !m_config.writeBack) {
+    m_noAllocateMisses++;
+    return false;
+  }
+  Line &line = victim(set);
+  if (line.valid && line.dirty) {
+    m_stats.writebacks++;
+  }
+  line.tag = tag;
+  line.stamp = m_clock;
+  line.valid = true;
+  line.dirty = write;
+  return false;
+}
+
+Cache::Line &Cache::victim(Line *set) {
+  Line *oldest = set;
+  for (unsigned way = 0; way < m_config.ways; way++) {
+    if (!set[way].valid) {
+      return set[way];
+    }
+    if (set[way].stamp < oldest->stamp) {
+      oldest = &set[way];
+    }
+  }
+  if (m_config.replacement == CacheReplacement::Random) {
+    // xorshift32
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return set[m_random & (m_config.ways - 1)];
+  }
+  return *oldest;
+}
@@ -0,0 +1,93 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum class CacheReplacement { LRU, FIFO, Random };
+
+// Geometry and policies of a cache model. Write-back caches allocate lines on
+// write misses; write-through caches write every store to memory and do not
+// allocate on write misses.
+struct CacheConfig {
+  unsigned size = 4096; // bytes
+  unsigned ways = 1;
+  unsigned lineSize = 16; // bytes
+  CacheReplacement replacement = CacheReplacement::LRU;
+  bool writeBack = true;
+  // Accesses seen by the cache: loads and stores, instruction fetches or both
+  bool data = true;
+  bool instructions = false;
+  // Cycles to fill a line from memory or to write a dirty line back
+  unsigned missPenalty = 10;
+
+  // Sizes are powers of two, and the cache holds at least one set
+  bool valid() const;
+  // Short description, ie. '4k:2:16:lru:wb:d'
+  std::string name() const;
+};
+
+struct CacheStats {
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  uint64_t readMisses = 0;
+  uint64_t writeMisses = 0;
+  uint64_t writebacks = 0;
+  uint64_t writeThroughs = 0;
+
+  uint64_t accesses() const { return reads + writes; }
+  uint64_t misses() const { return readMisses + writeMisses; }
+};
+
+// A set-associative cache model, which only tracks tags. Accesses are
+// attributed to the instruction slot making them, like the cycles of the
+// timing model, for per-function statistics.
+class Cache {
+public:
+  explicit Cache(const CacheConfig &config);
+
+  const CacheConfig &config() const { return m_config; }
+
+  // Invalidate all lines and clear the statistics of 'slots' instruction slots
+  void reset(size_t slots);
+
+  // Access the byte at 'addr' from instruction slot 'slot'. Returns true on a
+  // hit.
+  bool access(uint64_t addr, bool write, size_t slot);
+
+  const CacheStats &stats() const { return m_stats; }
+  const std::vector<uint64_t> &slotAccesses() const { return m_slotAccesses; }
+  const std::vector<uint64_t> &slotMisses() const { return m_slotMisses; }
+
+  // Cycles the pipeline waits for line fills and write-backs. Write-through
+  // stores are assumed to be absorbed by a write buffer.
+  uint64_t stallCycles() const {
+    return (m_stats.misses() - m_noAllocateMisses + m_stats.writebacks) *
+           m_config.missPenalty;
+  }
+
+private:
+  struct Line {
+    uint64_t tag = 0;
+    uint64_t stamp = 0; // last use for LRU, fill for FIFO
+    bool valid = false;
+    bool dirty = false;
+  };
+
+  Line &victim(Line *set);
+
+  const CacheConfig m_config;
+  unsigned m_lineShift = 0;
+  uint64_t m_setMask = 0;
+  std::vector<Line> m_lines;
+  uint64_t m_clock = 0;
+  uint32_t m_random = 1;
+  // Write misses of write-through caches, which do not fill a line
+  uint64_t m_noAllocateMisses = 0;
+  CacheStats m_stats;
+  std::vector<uint64_t> m_slotAccesses;
+  std::vector<uint64_t> m_slotMisses;
+};
+
+#endif // CACHE_H
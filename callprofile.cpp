@@ -0,0 +1,92 @@
+#include "callprofile.h"
+
+#include <algorithm>
+
+#include "elfio/elf_types.hpp"
+#include "programimage.h"
+
+void CallProfile::reset(const ProgramImage &image, uint64_t execStart,
+                        size_t slots) {
+  m_execStart = execStart;
+  m_slotFunction.assign(slots, -1);
+  m_functions.clear();
+  // Aliases of the same address keep the first name
+  for (const auto &sym : image.symbols()) {
+    const uint64_t offset = sym.value - execStart;
+    if (sym.type != STT_FUNC || offset >= slots * 2 || (offset & 1) != 0 ||
+        m_slotFunction[offset / 2] >= 0) {
+      continue;
+    }
+    m_slotFunction[offset / 2] = m_functions.size();
+    m_functions.push_back({sym.name, sym.value});
+  }
+  clear();
+}
+
+void CallProfile::clear() {
+  for (auto &f : m_functions) {
+    f.calls = 0;
+    f.instructions = 0;
+    f.cycles = 0;
+  }
+  m_active.assign(m_functions.size(), 0);
+  m_stack.clear();
+}
+
+void CallProfile::call(unsigned function, uint64_t link, uint64_t instructions,
+                       uint64_t cycles) {
+  m_functions[function].calls++;
+  if (m_stack.size() < kMaxDepth) {
+    m_active[function]++;
+    m_stack.push_back({function, link, instructions, cycles});
+  }
+}
+
+void CallProfile::ret(size_t frame, uint64_t instructions, uint64_t cycles) {
+  while (m_stack.size() > frame) {
+    const Frame &top = m_stack.back();
+    if (--m_active[top.function] == 0) {
+      Function &f = m_functions[top.function];
+      f.instructions += instructions - top.instructions;
+      f.cycles += cycles - top.cycles;
+    }
+    m_stack.pop_back();
+  }
+}
+
+void CallProfile::unwind(uint64_t target, uint64_t instructions,
+                         uint64_t cycles) {
+  for (size_t i = m_stack.size(); i-- > 0;) {
+    if (m_stack[i].link == target) {
+      ret(i, instructions, cycles);
+      return;
+    }
+  }
+}
+
+void printCallProfile(std::ostream &os, const CallProfile &profile,
+                      uint64_t instructions, unsigned n) {
+  const auto &functions = profile.functions();
+  std::vector<std::pair<uint64_t, size_t>> order;
+  uint64_t calls = 0;
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].calls != 0) {
+      order.push_back({functions[i].instructions, i});
+      calls += functions[i].calls;
+    }
+  }
+  std::sort(order.rbegin(), order.rend());
+  if (order.size() > n) {
+    order.resize(n);
+  }
+  os << "Calls: " << calls << std::endl;
+  for (const auto &o : order) {
+    const auto &f = functions[o.second];
+    os << "  " << f.name << ": " << f.calls << " calls, " << f.instructions
+       << " instructions (" << double(f.instructions) / f.calls
+       << " per call, "
+       << (instructions ? 100.0 * f.instructions / instructions : 0)
+       << "%), " << f.cycles << " cycles ("
+       << double(f.cycles) / f.calls << " per call)" << std::endl;
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef CALLPROFILE_H
+#define CALLPROFILE_H
+
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ProgramImage;
+
+// Calls of the functions of a program, as given by its function symbols, with
+// the instructions and cycles spent in them including their callees. Leros has
+// no multiply or divide instructions, so this shows the cost of the compiler
+// runtime routines such as __mulsi3 and __divsi3 to their callers.
+//
+// A call is a jal to the start of a function, and returns with the jal to the
+// address it linked. A jal to the link address of a frame further down the
+// stack, ie. from longjmp(), returns from the frames above it as well. The
+// instructions and cycles of recursive calls are counted once, by the
+// outermost call.
+class CallProfile {
+public:
+  struct Function {
+    std::string name;
+    uint64_t start;
+    uint64_t calls = 0;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+  };
+
+  // Profile the functions of 'image' within the 'slots' instruction slots of
+  // 2 bytes from 'execStart'
+  void reset(const ProgramImage &image, uint64_t execStart, size_t slots);
+  // Clear the counts and the call stack
+  void clear();
+
+  // A jal to 'target' linking 'link', at the given instruction and cycle
+  // counts including the jal
+  void jal(uint64_t target, uint64_t link, uint64_t instructions,
+           uint64_t cycles) {
+    if (!m_stack.empty() && m_stack.back().link == target) {
+      ret(m_stack.size() - 1, instructions, cycles);
+    } else if (target - m_execStart < m_slotFunction.size() * 2 &&
+               (target & 1) == 0 &&
+               m_slotFunction[(target - m_execStart) / 2] >= 0) {
+      call(m_slotFunction[(target - m_execStart) / 2], link, instructions,
+           cycles);
+    } else {
+      unwind(target, instructions, cycles);
+    }
+  }
+
+  const std::vector<Function> &functions() const { return m_functions; }
+
+private:
+  struct Frame {
+    unsigned function;
+    uint64_t link;
+    uint64_t instructions;
+    uint64_t cycles;
+  };
+
+  // Deeper frames are not tracked, but their calls are still counted
+  static constexpr size_t kMaxDepth = 4096;
+
+  void call(unsigned function, uint64_t link, uint64_t instructions,
+            uint64_t cycles);
+  // Return from the frames from 'frame' to the top of the stack
+  void ret(size_t frame, uint64_t instructions, uint64_t cycles);
+  // Return to 'target' if it is linked by a frame on the stack
+  void unwind(uint64_t target, uint64_t instructions, uint64_t cycles);
+
+  uint64_t m_execStart = 0;
+  // Function starting at each instruction slot, or -1
+  std::vector<int> m_slotFunction;
+  std::vector<Function> m_functions;
+  // Frames of each function on the stack
+  std::vector<unsigned> m_active;
+  std::vector<Frame> m_stack;
+};
+
+// Print the functions with the most instructions spent in their calls
+void printCallProfile(std::ostream &os, const CallProfile &profile,
+                      uint64_t instructions, unsigned n = 20);
+
+#endif // CALLPROFILE_H
@@ -0,0 +1,358 @@
+#include "cfg.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+bool isBranch(LerosInstr op) {
+  switch (op) {
+  case LerosInstr::br:
+  case LerosInstr::brz:
+  case LerosInstr::brnz:
+  case LerosInstr::brp:
+  case LerosInstr::brn:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Decode without asserting on invalid opcodes, which may be data within the
+// text segment
+DecodedInstr decodeStatic(uint16_t instr, MVT pc) {
+  if (LerosSim::decodeOpcode(instr >> 8) == LerosInstr::unknown) {
+    return DecodedInstr{LerosInstr::unknown, 1, 0, 0, 0, 0, 0};
+  }
+  return LerosSim::decode(instr, pc);
+}
+
+void disassemble(std::ostream &ss, uint16_t instr, MVT pc) {
+  const DecodedInstr d = decodeStatic(instr, pc);
+  const LerosInstr op = LerosSim::decodeOpcode(instr >> 8);
+  ss << instrName(op);
+  switch (op) {
+  case LerosInstr::nop:
+  case LerosInstr::sra:
+    break;
+  case LerosInstr::unknown:
+    ss << " 0x" << std::hex << instr << std::dec;
+    break;
+  case LerosInstr::add:
+  case LerosInstr::sub:
+  case LerosInstr::load:
+  case LerosInstr::And:
+  case LerosInstr::Or:
+  case LerosInstr::Xor:
+  case LerosInstr::store:
+  case LerosInstr::jal:
+  case LerosInstr::ldaddr:
+    ss << " r" << (instr & 0xFF);
+    break;
+  case LerosInstr::Andi:
+  case LerosInstr::Ori:
+  case LerosInstr::Xori:
+  case LerosInstr::out:
+  case LerosInstr::in:
+  case LerosInstr::scall:
+    ss << " " << (instr & 0xFF);
+    break;
+  default:
+    if (isBranch(op)) {
+      ss << " 0x" << std::hex << d.target << std::dec;
+    } else {
+      ss << " " << signextend<int, 8>(instr);
+    }
+    break;
+  }
+}
+
+} // namespace
+
+void ControlFlowGraph::build(const ProgramImage &image) {
+  m_code.clear();
+  m_blocks.clear();
+  m_functions.clear();
+
+  for (const auto &seg : image.segments()) {
+    if ((seg.flags & PF_X) && seg.filesz >= ILEN) {
+      m_code.push_back({static_cast<MVT>(seg.vaddr),
+                        static_cast<MVT>(seg.vaddr + (seg.filesz & ~1ULL)),
+                        seg.data});
+    }
+  }
+  std::sort(m_code.begin(), m_code.end(),
+            [](const Code &a, const Code &b) { return a.start < b.start; });
+
+  // Functions. Aliases of the same address keep the first name, and functions
+  // without a size extend to the next function or the end of their code.
+  for (const auto &sym : image.symbols()) {
+    if (sym.type == STT_FUNC && isCode(sym.value)) {
+      m_functions.push_back({sym.name, static_cast<MVT>(sym.value),
+                             static_cast<MVT>(sym.value + sym.size)});
+    }
+  }
+  std::stable_sort(
+      m_functions.begin(), m_functions.end(),
+      [](const Function &a, const Function &b) { return a.start < b.start; });
+  m_functions.erase(std::unique(m_functions.begin(), m_functions.end(),
+                                [](const Function &a, const Function &b) {
+                                  return a.start == b.start;
+                                }),
+                    m_functions.end());
+  for (size_t i = 0; i < m_functions.size(); i++) {
+    Function &f = m_functions[i];
+    MVT limit = 0;
+    for (const auto &code : m_code) {
+      if (f.start >= code.start && f.start < code.end) {
+        limit = code.end;
+      }
+    }
+    if (i + 1 < m_functions.size()) {
+      limit = std::min(limit, m_functions[i + 1].start);
+    }
+    if (f.end <= f.start || f.end > limit) {
+      f.end = limit;
+    }
+  }
+
+  // Block leaders
+  std::vector<MVT> leaders;
+  if (isCode(image.entry())) {
+    leaders.push_back(image.entry());
+  }
+  for (const auto &f : m_functions) {
+    leaders.push_back(f.start);
+  }
+  for (const auto &code : m_code) {
+    for (MVT pc = code.start; pc < code.end; pc += ILEN) {
+      const DecodedInstr d = decodeStatic(code.fetch(pc), pc);
+      if (isBranch(d.op)) {
+        if (isCode(d.target)) {
+          leaders.push_back(d.target);
+        }
+        leaders.push_back(pc + ILEN);
+      } else if (d.op == LerosInstr::jal || d.op == LerosInstr::scall) {
+        leaders.push_back(pc + ILEN);
+      }
+    }
+  }
+  std::sort(leaders.begin(), leaders.end());
+  leaders.erase(std::unique(leaders.begin(), leaders.end()), leaders.end());
+
+  // Resolved call targets are leaders as well. They are usually function
+  // symbols already; otherwise the blocks are rebuilt with them added.
+  while (true) {
+    std::vector<MVT> callTargets;
+    buildBlocks(leaders, callTargets);
+    std::sort(callTargets.begin(), callTargets.end());
+    callTargets.erase(std::unique(callTargets.begin(), callTargets.end()),
+                      callTargets.end());
+    std::vector<MVT> added;
+    std::set_difference(callTargets.begin(), callTargets.end(),
+                        leaders.begin(), leaders.end(),
+                        std::back_inserter(added));
+    if (added.empty()) {
+      break;
+    }
+    std::vector<MVT> merged;
+    std::merge(leaders.begin(), leaders.end(), added.begin(), added.end(),
+               std::back_inserter(merged));
+    leaders.swap(merged);
+  }
+
+  // Link successors and functions
+  size_t f = 0;
+  for (auto &b : m_blocks) {
+    if (b.hasTarget) {
+      b.targetBlock = blockAt(b.target);
+    }
+    if (b.fallsThrough) {
+      const int next = blockAt(b.end);
+      b.nextBlock = next >= 0 && m_blocks[next].start == b.end ? next : -1;
+    }
+    while (f < m_functions.size() && m_functions[f].end <= b.start) {
+      f++;
+    }
+    if (f < m_functions.size() && m_functions[f].start <= b.start) {
+      b.function = f;
+    }
+  }
+}
+
+void ControlFlowGraph::buildBlocks(const std::vector<MVT> &leaders,
+                                   std::vector<MVT> &callTargets) {
+  m_blocks.clear();
+  for (const auto &code : m_code) {
+    auto leader = std::lower_bound(leaders.begin(), leaders.end(), code.start);
+    Block block;
+    block.start = code.start;
+
+    // Constant value of the accumulator, if known
+    bool known = false;
+    MVT_S acc = 0;
+
+    for (MVT pc = code.start; pc < code.end; pc += ILEN) {
+      const DecodedInstr d = decodeStatic(code.fetch(pc), pc);
+
+      // clang-format off
+      switch (d.op) {
+      case LerosInstr::loadi: acc = d.imm; known = true; break;
+      case LerosInstr::loadhi:  acc = (acc & 0xff) | d.imm; break;
+      case LerosInstr::loadh2i: acc = (acc & 0xffff) | d.imm; break;
+      case LerosInstr::loadh3i: acc = (acc & 0xffffff) | d.imm; break;
+#ifdef LEROS64
+      case LerosInstr::loadh4i: acc = (acc & 0xffffffff) | d.imm; break;
+      case LerosInstr::loadh5i: acc = (acc & 0xffffffffff) | d.imm; break;
+      case LerosInstr::loadh6i: acc = (acc & 0xffffffffffff) | d.imm; break;
+      case LerosInstr::loadh7i: acc = (acc & 0xffffffffffffff) | d.imm; break;
+#endif
+      case LerosInstr::addi: acc += d.imm; break;
+      case LerosInstr::Andi: acc &= d.imm; break;
+      case LerosInstr::Ori:  acc |= d.imm; break;
+      case LerosInstr::Xori: acc ^= d.imm; break;
+      case LerosInstr::sra:  acc >>= 1; break;
+      case LerosInstr::unknown:
+      case LerosInstr::nop:
+      case LerosInstr::store:
+      case LerosInstr::ldaddr:
+      case LerosInstr::stind:
+      case LerosInstr::stindb:
+      case LerosInstr::stindh:
+      case LerosInstr::out:
+      case LerosInstr::jal:
+        break;
+      default: known = false; break;
+      }
+      // clang-format on
+
+      bool end = true;
+      if (isBranch(d.op)) {
+        block.hasTarget = isCode(d.target);
+        block.target = d.target;
+        block.fallsThrough = d.op != LerosInstr::br;
+      } else if (d.op == LerosInstr::jal) {
+        block.hasTarget = known && isCode(acc);
+        block.target = block.hasTarget ? static_cast<MVT>(acc) : 0;
+        block.fallsThrough = true;
+        if (block.hasTarget) {
+          callTargets.push_back(block.target);
+        }
+      } else if (d.op == LerosInstr::scall) {
+        block.fallsThrough = true;
+      } else {
+        while (leader != leaders.end() && *leader <= pc) {
+          leader++;
+        }
+        end = pc + ILEN == code.end ||
+              (leader != leaders.end() && *leader == pc + ILEN);
+        block.fallsThrough = true;
+      }
+
+      if (end) {
+        block.end = pc + ILEN;
+        block.terminator = d.op;
+        m_blocks.push_back(block);
+        block = Block();
+        block.start = pc + ILEN;
+        known = false;
+      }
+    }
+  }
+}
+
+bool ControlFlowGraph::isCode(MVT pc) const {
+  if (pc % ILEN != 0) {
+    return false;
+  }
+  for (const auto &code : m_code) {
+    if (pc >= code.start && pc < code.end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const ControlFlowGraph::Code &ControlFlowGraph::codeAt(MVT pc) const {
+  for (const auto &code : m_code) {
+    if (pc >= code.start && pc < code.end) {
+      return code;
+    }
+  }
+  return m_code.front();
+}
+
+int ControlFlowGraph::blockAt(MVT pc) const {
+  auto it = std::upper_bound(
+      m_blocks.begin(), m_blocks.end(), pc,
+      [](MVT pc, const Block &b) { return pc < b.start; });
+  if (it == m_blocks.begin()) {
+    return -1;
+  }
+  --it;
+  return pc < it->end ? static_cast<int>(it - m_blocks.begin()) : -1;
+}
+
+int ControlFlowGraph::functionAt(MVT pc) const {
+  auto it = std::upper_bound(
+      m_functions.begin(), m_functions.end(), pc,
+      [](MVT pc, const Function &f) { return pc < f.start; });
+  if (it == m_functions.begin()) {
+    return -1;
+  }
+  --it;
+  return pc < it->end ? static_cast<int>(it - m_functions.begin()) : -1;
+}
+
+void ControlFlowGraph::disassemble(std::ostream &os, MVT pc) const {
+  ::disassemble(os, fetch(pc), pc);
+}
+
+void ControlFlowGraph::dumpDot(std::ostream &os) const {
+  os << "digraph cfg {\n";
+  os << "  node [shape=box fontname=\"monospace\"];\n";
+
+  int function = -2;
+  for (size_t i = 0; i < m_blocks.size(); i++) {
+    const Block &b = m_blocks[i];
+    if (b.function != function) {
+      if (function >= 0) {
+        os << "  }\n";
+      }
+      function = b.function;
+      if (function >= 0) {
+        os << "  subgraph cluster_" << function << " {\n";
+        os << "  label=\"" << m_functions[function].name << "\";\n";
+      }
+    }
+
+    const Code &code = codeAt(b.start);
+    os << "  b" << i << " [label=\"0x" << std::hex << b.start << std::dec
+       << ":\\l";
+    for (MVT pc = b.start; pc < b.end; pc += ILEN) {
+      os << "  ";
+      ::disassemble(os, code.fetch(pc), pc);
+      os << "\\l";
+    }
+    os << "\"];\n";
+  }
+  if (function >= 0) {
+    os << "  }\n";
+  }
+
+  for (size_t i = 0; i < m_blocks.size(); i++) {
+    const Block &b = m_blocks[i];
+    const bool call = b.terminator == LerosInstr::jal;
+    const bool conditional = b.hasTarget && b.fallsThrough && !call;
+    if (b.targetBlock >= 0) {
+      os << "  b" << i << " -> b" << b.targetBlock
+         << (call ? " [style=dashed]" : conditional ? " [label=\"T\"]" : "")
+         << ";\n";
+    }
+    if (b.nextBlock >= 0) {
+      os << "  b" << i << " -> b" << b.nextBlock
+         << (conditional ? " [label=\"F\"]" : "") << ";\n";
+    }
+  }
+  os << "}\n";
+}
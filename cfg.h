@@ -0,0 +1,88 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "leros-sim.h"
+
+// Static control flow graph of the executable segments of a program.
+//
+// Basic blocks are split at branch targets, at function symbols and after
+// every branch, jal and scall. jal targets are resolved where the accumulator
+// holds a constant built by loadi/loadh*i (and ALU immediates) within the
+// block, which covers direct calls; other jal's (ie. returns) have no known
+// target.
+class ControlFlowGraph {
+public:
+  struct Block {
+    MVT start;
+    MVT end; // exclusive
+    // Last instruction of the block
+    LerosInstr terminator;
+    // Branch target or resolved jal target, if hasTarget is set
+    bool hasTarget = false;
+    MVT target = 0;
+    // Whether execution may continue at 'end'. For jal, this is the return
+    // site.
+    bool fallsThrough = false;
+    // Indices of the successor blocks, or -1 if not within the program
+    int targetBlock = -1;
+    int nextBlock = -1;
+    // Index of the enclosing function, or -1
+    int function = -1;
+
+    unsigned numInstrs() const { return (end - start) / ILEN; }
+  };
+
+  struct Function {
+    std::string name;
+    MVT start;
+    MVT end; // exclusive
+  };
+
+  // Build the graph from the file contents of the executable segments
+  void build(const ProgramImage &image);
+
+  // Blocks, ordered by address
+  const std::vector<Block> &blocks() const { return m_blocks; }
+  // Functions from the STT_FUNC symbols, ordered by address
+  const std::vector<Function> &functions() const { return m_functions; }
+
+  // Returns the index of the block containing 'pc', or -1
+  int blockAt(MVT pc) const;
+  // Returns the index of the function containing 'pc', or -1
+  int functionAt(MVT pc) const;
+  // Instruction word at 'pc', which must be within a block
+  uint16_t fetch(MVT pc) const { return codeAt(pc).fetch(pc); }
+
+  // Write the instruction at 'pc', which must be within a block, in assembly
+  // syntax
+  void disassemble(std::ostream &os, MVT pc) const;
+
+  // Write the graph in Graphviz DOT format, with functions as clusters
+  void dumpDot(std::ostream &os) const;
+
+private:
+  // An executable address range and its file contents
+  struct Code {
+    MVT start;
+    MVT end;
+    const uint8_t *data;
+    uint16_t fetch(MVT pc) const {
+      return data[pc - start] | (data[pc - start + 1] << 8);
+    }
+  };
+
+  bool isCode(MVT pc) const;
+  const Code &codeAt(MVT pc) const;
+  void buildBlocks(const std::vector<MVT> &leaders,
+                   std::vector<MVT> &callTargets);
+
+  std::vector<Code> m_code;
+  std::vector<Block> m_blocks;
+  std::vector<Function> m_functions;
+};
+
+#endif // CFG_H
@@ -0,0 +1,216 @@
+#include "coverage.h"
+
+#include <fstream>
+#include <set>
+
+#include "cfg.h"
+
+namespace {
+
+bool isConditionalBranch(LerosInstr op) {
+  switch (op) {
+  case LerosInstr::brz:
+  case LerosInstr::brnz:
+  case LerosInstr::brp:
+  case LerosInstr::brn:
+    return true;
+  default:
+    return false;
+  }
+}
+
+LerosInstr opcodeAt(const ControlFlowGraph &cfg, MVT pc) {
+  return LerosSim::decodeOpcode(cfg.fetch(pc) >> 8);
+}
+
+size_t slotOf(MVT pc, uint64_t execStart) { return (pc - execStart) / ILEN; }
+
+// Disassembly of a program with instruction slot N on line N + 1
+void writeListing(std::ostream &os, const ControlFlowGraph &cfg,
+                  uint64_t execStart, size_t slots) {
+  const auto &functions = cfg.functions();
+  for (size_t slot = 0; slot < slots; slot++) {
+    const MVT pc = execStart + slot * ILEN;
+    if (cfg.blockAt(pc) >= 0) {
+      os << "0x" << std::hex << pc << std::dec << ":  ";
+      cfg.disassemble(os, pc);
+      const int f = cfg.functionAt(pc);
+      if (f >= 0 && functions[f].start == pc) {
+        os << "  # " << functions[f].name;
+      }
+    }
+    os << "\n";
+  }
+}
+
+void writeLcov(std::ostream &os, const Coverage &coverage,
+               const ControlFlowGraph &cfg, uint64_t execStart,
+               const std::string &listing) {
+  const auto lineOf = [&](MVT pc) { return slotOf(pc, execStart) + 1; };
+  os << "TN:\n";
+  os << "SF:" << listing << "\n";
+
+  CoverageTotals totals;
+  countCoverage(coverage, cfg, execStart, totals);
+  for (const auto &f : cfg.functions()) {
+    os << "FN:" << lineOf(f.start) << "," << f.name << "\n";
+  }
+  for (const auto &f : cfg.functions()) {
+    bool hit = false;
+    for (MVT pc = f.start; pc < f.end && !hit; pc += ILEN) {
+      hit = coverage.executed(slotOf(pc, execStart));
+    }
+    os << "FNDA:" << hit << "," << f.name << "\n";
+  }
+  os << "FNF:" << totals.functions << "\n";
+  os << "FNH:" << totals.functionsHit << "\n";
+
+  // Branches not reached are reported as '-', like lcov does
+  for (const auto &b : cfg.blocks()) {
+    for (MVT pc = b.start; pc < b.end; pc += ILEN) {
+      if (!isConditionalBranch(opcodeAt(cfg, pc))) {
+        continue;
+      }
+      const size_t slot = slotOf(pc, execStart);
+      const bool reached = coverage.executed(slot);
+      for (unsigned taken = 0; taken < 2; taken++) {
+        os << "BRDA:" << lineOf(pc) << ",0," << taken << ",";
+        if (reached) {
+          os << (taken ? coverage.taken(slot) : coverage.notTaken(slot));
+        } else {
+          os << "-";
+        }
+        os << "\n";
+      }
+    }
+  }
+  os << "BRF:" << totals.branches << "\n";
+  os << "BRH:" << totals.branchesHit << "\n";
+
+  for (const auto &b : cfg.blocks()) {
+    for (MVT pc = b.start; pc < b.end; pc += ILEN) {
+      os << "DA:" << lineOf(pc) << ","
+         << coverage.executed(slotOf(pc, execStart)) << "\n";
+    }
+  }
+  os << "LF:" << totals.lines << "\n";
+  os << "LH:" << totals.linesHit << "\n";
+  os << "end_of_record\n";
+}
+
+} // namespace
+
+void Coverage::reset(size_t slots) {
+  m_slots = slots;
+  m_slotBits = (slots + 63) / 64 * 64;
+  m_words.assign((kFixedBits + 3 * m_slotBits) / 64, 0);
+}
+
+void Coverage::merge(const Coverage &other) {
+  const size_t n =
+      other.m_slots == m_slots ? m_words.size() : kFixedBits / 64;
+  for (size_t i = 0; i < n; i++) {
+    if (other.m_words[i] != 0) {
+      __atomic_fetch_or(&m_words[i], other.m_words[i], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+bool Coverage::mergeNew(const Coverage &other) {
+  const size_t n =
+      other.m_slots == m_slots ? m_words.size() : kFixedBits / 64;
+  bool changed = false;
+  for (size_t i = 0; i < n; i++) {
+    const uint64_t merged = m_words[i] | other.m_words[i];
+    changed |= merged != m_words[i];
+    m_words[i] = merged;
+  }
+  return changed;
+}
+
+void countCoverage(const Coverage &coverage, const ControlFlowGraph &cfg,
+                   uint64_t execStart, CoverageTotals &totals) {
+  for (const auto &b : cfg.blocks()) {
+    for (MVT pc = b.start; pc < b.end; pc += ILEN) {
+      const size_t slot = slotOf(pc, execStart);
+      totals.lines++;
+      totals.linesHit += coverage.executed(slot);
+      if (isConditionalBranch(opcodeAt(cfg, pc))) {
+        totals.branches += 2;
+        totals.branchesHit += coverage.taken(slot) + coverage.notTaken(slot);
+      }
+    }
+  }
+  for (const auto &f : cfg.functions()) {
+    totals.functions++;
+    for (MVT pc = f.start; pc < f.end; pc += ILEN) {
+      if (coverage.executed(slotOf(pc, execStart))) {
+        totals.functionsHit++;
+        break;
+      }
+    }
+  }
+}
+
+bool writeLcovFile(const std::string &path,
+                   const std::vector<CoverageRecord> &records) {
+  std::ofstream out(path);
+  std::set<std::string> listings;
+  for (size_t i = 0; i < records.size(); i++) {
+    const CoverageRecord &r = records[i];
+    const size_t slash = r.path.find_last_of('/');
+    std::string listing =
+        path + "." + r.path.substr(slash == std::string::npos ? 0 : slash + 1);
+    // Programs of the same name are told apart by their index
+    if (!listings.insert(listing).second) {
+      listing += "." + std::to_string(i);
+      listings.insert(listing);
+    }
+    listing += ".lst";
+    std::ofstream list(listing);
+    writeListing(list, *r.cfg, r.execStart, r.coverage->slots());
+    writeLcov(out, *r.coverage, *r.cfg, r.execStart, listing);
+    if (!list) {
+      return false;
+    }
+  }
+  return static_cast<bool>(out);
+}
+
+void printCoverageSummary(std::ostream &os, const Coverage &coverage,
+                          const CoverageTotals &totals) {
+  const auto percent = [](size_t hit, size_t total) {
+    return total ? 100.0 * hit / total : 100.0;
+  };
+  std::string executed;
+  std::string missing;
+  unsigned numExecuted = 0;
+  for (unsigned op = 0; op < NUM_BASE_INSTRS; op++) {
+    const auto instr = static_cast<LerosInstr>(op);
+    if (instr == LerosInstr::unknown) {
+      continue;
+    }
+    std::string &list = coverage.opcode(op) ? executed : missing;
+    list += std::string(list.empty() ? "" : " ") + instrName(instr);
+    numExecuted += coverage.opcode(op);
+  }
+  std::string scalls;
+  for (unsigned n = 0; n < Coverage::kScalls; n++) {
+    if (coverage.scall(n)) {
+      scalls += (scalls.empty() ? "" : " ") + std::to_string(n);
+    }
+  }
+
+  os << "Opcodes executed: " << numExecuted << " (" << executed << ")\n";
+  os << "Opcodes not executed: " << (missing.empty() ? "none" : missing)
+     << "\n";
+  os << "scall numbers executed: " << (scalls.empty() ? "none" : scalls)
+     << "\n";
+  os << "Lines: " << totals.linesHit << " of " << totals.lines << " ("
+     << percent(totals.linesHit, totals.lines) << "%)\n";
+  os << "Branch directions: " << totals.branchesHit << " of "
+     << totals.branches << " ("
+     << percent(totals.branchesHit, totals.branches) << "%)\n";
+  os << "Functions: " << totals.functionsHit << " of " << totals.functions
+     << " (" << percent(totals.functionsHit, totals.functions) << "%)\n";
+}
@@ -0,0 +1,98 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ControlFlowGraph;
+
+// Coverage of the execution of a program: the opcodes and scall numbers
+// executed, and for each instruction slot of the executable segments whether
+// it was executed and, for branches, taken and not taken. A simulator records
+// into coverage of its own without synchronization; the coverage of several
+// simulators running the same program, ie. the workers of a sweep, is then
+// combined with merge().
+class Coverage {
+public:
+  static constexpr unsigned kOpcodes = 64;
+  static constexpr unsigned kScalls = 256;
+
+  explicit Coverage(size_t slots = 0) { reset(slots); }
+
+  // Clear the coverage, for a program of 'slots' instruction slots
+  void reset(size_t slots);
+  size_t slots() const { return m_slots; }
+
+  void setOpcode(unsigned op) { set(op); }
+  void setScall(unsigned n) { set(kOpcodes + n); }
+  void setExecuted(size_t slot) { set(kFixedBits + slot); }
+  void setTaken(size_t slot) { set(kFixedBits + m_slotBits + slot); }
+  void setNotTaken(size_t slot) { set(kFixedBits + 2 * m_slotBits + slot); }
+
+  bool opcode(unsigned op) const { return test(op); }
+  bool scall(unsigned n) const { return test(kOpcodes + n); }
+  bool executed(size_t slot) const { return test(kFixedBits + slot); }
+  bool taken(size_t slot) const { return test(kFixedBits + m_slotBits + slot); }
+  bool notTaken(size_t slot) const {
+    return test(kFixedBits + 2 * m_slotBits + slot);
+  }
+
+  // OR 'other' into this coverage with atomic operations, so that any number
+  // of threads may merge into the same coverage at once. The instruction
+  // slots are only merged if both have the same number of them.
+  void merge(const Coverage &other);
+  // Like merge(), without synchronization, and returns whether 'other' covers
+  // anything this coverage does not
+  bool mergeNew(const Coverage &other);
+
+private:
+  static constexpr size_t kFixedBits = kOpcodes + kScalls;
+
+  void set(size_t bit) { m_words[bit / 64] |= uint64_t(1) << (bit % 64); }
+  bool test(size_t bit) const { return (m_words[bit / 64] >> (bit % 64)) & 1; }
+
+  size_t m_slots = 0;
+  // Bits per slot bitmap, rounded up to whole words
+  size_t m_slotBits = 0;
+  std::vector<uint64_t> m_words;
+};
+
+// Lines (instruction slots), directions of conditional branches and
+// functions of programs, and how many of them were covered
+struct CoverageTotals {
+  size_t lines = 0;
+  size_t linesHit = 0;
+  size_t branches = 0;
+  size_t branchesHit = 0;
+  size_t functions = 0;
+  size_t functionsHit = 0;
+};
+
+// Add the counts of the program in 'cfg', whose instruction slots start at
+// 'execStart', to 'totals'
+void countCoverage(const Coverage &coverage, const ControlFlowGraph &cfg,
+                   uint64_t execStart, CoverageTotals &totals);
+
+// A program and its coverage, for writing an lcov tracefile
+struct CoverageRecord {
+  std::string path;
+  const Coverage *coverage;
+  const ControlFlowGraph *cfg;
+  uint64_t execStart;
+};
+
+// Write an lcov tracefile to 'path' with a record per program. As programs
+// have no line information, the source file of each record is a listing of
+// the disassembly of the program written next to the tracefile, with
+// instruction slot N on line N + 1. Returns false if a file could not be
+// written.
+bool writeLcovFile(const std::string &path,
+                   const std::vector<CoverageRecord> &records);
+
+// Print the opcodes and scall numbers covered by 'coverage', and the totals
+void printCoverageSummary(std::ostream &os, const Coverage &coverage,
+                          const CoverageTotals &totals);
+
+#endif // COVERAGE_H
@@ -0,0 +1,112 @@
+#include "features.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+bool isLoadImmediate(LerosInstr op) {
+  switch (op) {
+  case LerosInstr::loadi:
+  case LerosInstr::loadhi:
+  case LerosInstr::loadh2i:
+  case LerosInstr::loadh3i:
+#ifdef LEROS64
+  case LerosInstr::loadh4i:
+  case LerosInstr::loadh5i:
+  case LerosInstr::loadh6i:
+  case LerosInstr::loadh7i:
+#endif
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::string opFeature(LerosInstr op) {
+  return std::string("op:") + instrName(op);
+}
+
+std::string pairFeature(LerosInstr first, LerosInstr second) {
+  return std::string("pair:") + instrName(first) + "," + instrName(second);
+}
+
+} // namespace
+
+std::set<std::string> staticFeatures(const ControlFlowGraph &cfg) {
+  std::set<std::string> features;
+
+  // Pairs are taken within straight-line code, ie. across the blocks of
+  // falling through branches but not across gaps between segments
+  LerosInstr prev = LerosInstr::unknown;
+  MVT prevEnd = 0;
+  for (const auto &b : cfg.blocks()) {
+    if (b.start != prevEnd) {
+      prev = LerosInstr::unknown;
+    }
+    for (MVT pc = b.start; pc < b.end; pc += ILEN) {
+      const LerosInstr op = LerosSim::decodeOpcode(cfg.fetch(pc) >> 8);
+      if (op != LerosInstr::unknown) {
+        features.insert(opFeature(op));
+        if (prev != LerosInstr::unknown) {
+          features.insert(pairFeature(prev, op));
+        }
+      }
+      prev = op;
+    }
+    prevEnd = b.end;
+  }
+
+  for (const auto &f : cfg.functions()) {
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (MVT pc = f.start; pc < f.end; pc += ILEN) {
+      uint16_t instr = cfg.fetch(pc);
+      if (isLoadImmediate(LerosSim::decodeOpcode(instr >> 8))) {
+        instr &= 0xff00;
+      }
+      for (unsigned byte : {instr & 0xffu, unsigned(instr >> 8)}) {
+        hash = (hash ^ byte) * 0x100000001b3ULL;
+      }
+    }
+    std::ostringstream ss;
+    ss << "fn:" << f.name << "#" << std::hex << std::setw(16)
+       << std::setfill('0') << hash;
+    features.insert(ss.str());
+  }
+  return features;
+}
+
+std::set<std::string> executedFeatures(const LerosSim &sim,
+                                       const ControlFlowGraph &cfg,
+                                       const std::vector<bool> &executed) {
+  std::set<std::string> features;
+  const auto &pairs = sim.pairCounts();
+  for (unsigned i = 0; i < pairs.size(); i++) {
+    const auto first = static_cast<LerosInstr>(i / NUM_BASE_INSTRS);
+    const auto second = static_cast<LerosInstr>(i % NUM_BASE_INSTRS);
+    if (pairs[i] != 0 && first != LerosInstr::unknown &&
+        second != LerosInstr::unknown) {
+      features.insert(pairFeature(first, second));
+    }
+  }
+
+  const auto &functions = cfg.functions();
+  for (size_t slot = 0; slot < executed.size(); slot++) {
+    if (!executed[slot]) {
+      continue;
+    }
+    const MVT pc = sim.execStart() + slot * ILEN;
+    if (cfg.blockAt(pc) >= 0) {
+      const LerosInstr op = LerosSim::decodeOpcode(cfg.fetch(pc) >> 8);
+      if (op != LerosInstr::unknown) {
+        features.insert(opFeature(op));
+      }
+    }
+    const int f = cfg.functionAt(pc);
+    if (f >= 0) {
+      features.insert("fn:" + functions[f].name);
+    }
+  }
+  return features;
+}
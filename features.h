@@ -0,0 +1,30 @@
+#ifndef FEATURES_H
+#define FEATURES_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cfg.h"
+
+// Features of a program, by which the driver selects the tests exercising a
+// change of the compiler first (see simdriver.py): opcodes ("op:add"), pairs
+// of consecutive opcodes as emitted by instruction selection
+// ("pair:load,add") and functions, including those of the runtime library
+// ("fn:__mulsi3").
+
+// Features of the code of a program. Functions carry a hash of their code
+// ("fn:__mulsi3#5bd1e995..."), so a changed function yields a different
+// feature. The immediates of loadi and loadh*i are not hashed, as they mostly
+// hold addresses which move with any change of the code before them.
+std::set<std::string> staticFeatures(const ControlFlowGraph &cfg);
+
+// Features of the runs of 'sim', which must have been created with the
+// profilePairs option: the pairs it executed, and the opcodes and functions
+// of the instruction slots set in 'executed' (indexed like
+// LerosSim::slotInstructions())
+std::set<std::string> executedFeatures(const LerosSim &sim,
+                                       const ControlFlowGraph &cfg,
+                                       const std::vector<bool> &executed);
+
+#endif // FEATURES_H
@@ -0,0 +1,249 @@
+#include "fuzzer.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Values which commonly hit the edge cases of arithmetic and comparisons
+const int32_t kInterestingValues[] = {
+    0, 1, -1, 2, 4, 7, 8, 15, 16, 31, 32, 33, 63, 64, 127, 128, -128, -129,
+    255, 256, 32767, 32768, -32768, 65535, 65536, -65536, 1 << 24, INT32_MAX,
+    INT32_MIN, INT32_MAX - 1, INT32_MIN + 1};
+
+// Whether 'a' is a simpler argument than 'b': closer to zero, or positive
+bool simpler(int64_t a, int64_t b) {
+  const uint64_t absA = a < 0 ? -static_cast<uint64_t>(a) : a;
+  const uint64_t absB = b < 0 ? -static_cast<uint64_t>(b) : b;
+  return absA < absB || (absA == absB && a > b);
+}
+
+} // namespace
+
+bool HostHarness::start() {
+  int toHarness[2];
+  int fromHarness[2];
+  if (pipe(toHarness) != 0) {
+    return false;
+  }
+  if (pipe(fromHarness) != 0) {
+    close(toHarness[0]);
+    close(toHarness[1]);
+    return false;
+  }
+  // A harness exiting while being written to must not terminate the simulator
+  signal(SIGPIPE, SIG_IGN);
+  m_pid = fork();
+  if (m_pid == 0) {
+    dup2(toHarness[0], 0);
+    dup2(fromHarness[1], 1);
+    close(toHarness[0]);
+    close(toHarness[1]);
+    close(fromHarness[0]);
+    close(fromHarness[1]);
+    execl(m_path.c_str(), m_path.c_str(), static_cast<char *>(nullptr));
+    _exit(127);
+  }
+  close(toHarness[0]);
+  close(fromHarness[1]);
+  if (m_pid < 0) {
+    close(toHarness[1]);
+    close(fromHarness[0]);
+    return false;
+  }
+  m_in = fdopen(toHarness[1], "w");
+  m_out = fdopen(fromHarness[0], "r");
+  return m_in && m_out;
+}
+
+void HostHarness::stop() {
+  if (m_in) {
+    fclose(m_in);
+    m_in = nullptr;
+  }
+  if (m_out) {
+    fclose(m_out);
+    m_out = nullptr;
+  }
+  if (m_pid > 0) {
+    kill(m_pid, SIGKILL);
+    waitpid(m_pid, nullptr, 0);
+    m_pid = -1;
+  }
+}
+
+bool HostHarness::run(const std::vector<int64_t> &argv, int64_t &result) {
+  if (m_pid <= 0 && !start()) {
+    stop();
+    return false;
+  }
+  for (size_t i = 0; i < argv.size(); i++) {
+    fprintf(m_in, i == 0 ? "%lld" : " %lld", static_cast<long long>(argv[i]));
+  }
+  fputc('\n', m_in);
+  char line[64];
+  if (fflush(m_in) != 0 || !fgets(line, sizeof(line), m_out)) {
+    stop();
+    return false;
+  }
+  char *end;
+  result = strtoll(line, &end, 10);
+  return end != line && (*end == '\n' || *end == 0);
+}
+
+Fuzzer::Fuzzer(LerosSim &sim, HostHarness &host, const FuzzOptions &options)
+    : m_sim(sim), m_host(host), m_options(options),
+      m_coverage(sim.execSlots()), m_random(options.seed ? options.seed : 1) {
+  m_sim.snapshot(m_initial);
+}
+
+void Fuzzer::addInput(const std::vector<int64_t> &argv) {
+  m_inputs.push_back(argv);
+}
+
+uint64_t Fuzzer::random() {
+  // xorshift64
+  m_random ^= m_random << 13;
+  m_random ^= m_random >> 7;
+  m_random ^= m_random << 17;
+  return m_random;
+}
+
+Fuzzer::Outcome Fuzzer::execute(const std::vector<int64_t> &argv,
+                                FuzzFailure &failure) {
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (m_options.timeout > 0) {
+    deadline = std::chrono::steady_clock::now() +
+               std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::duration<double>(m_options.timeout));
+  }
+  m_sim.restore(m_initial);
+  m_sim.clearCoverage();
+  m_sim.setArguments(std::vector<MVT>(argv.begin(), argv.end()));
+  m_sim.reset();
+  failure.stop = m_sim.run(m_options.maxInstructions, deadline);
+  m_runs++;
+  if (failure.stop == SimRetval::INSTRUCTION_LIMIT ||
+      failure.stop == SimRetval::TIMEOUT) {
+    m_overBudget++;
+    return Outcome::OverBudget;
+  }
+  if (m_coverage.mergeNew(m_sim.coverage())) {
+    m_corpus.push_back(argv);
+  }
+
+  failure.actual = static_cast<MVT_S>(m_sim.readRegister(4));
+  if (!m_host.run(argv, failure.expected)) {
+    m_hostErrors++;
+    return Outcome::HostError;
+  }
+  const bool stopped = failure.stop == SimRetval::SCALL ||
+                       failure.stop == SimRetval::JAL_RA_EXIT;
+  return stopped && failure.actual == failure.expected ? Outcome::Pass
+                                                       : Outcome::Fail;
+}
+
+void Fuzzer::check(const std::vector<int64_t> &argv) {
+  FuzzFailure failure;
+  if (execute(argv, failure) != Outcome::Fail) {
+    return;
+  }
+  failure.original = argv;
+  failure.argv = minimize(argv, failure);
+  for (const auto &f : m_failures) {
+    if (f.argv == failure.argv) {
+      return;
+    }
+  }
+  m_failures.push_back(failure);
+}
+
+void Fuzzer::run() {
+  for (const auto &argv : m_inputs) {
+    check(argv);
+  }
+  m_inputs.clear();
+  if (m_corpus.empty()) {
+    m_corpus.emplace_back();
+  }
+  while (m_runs < m_options.runs &&
+         m_failures.size() < m_options.maxFailures) {
+    check(mutate(m_corpus[random() % m_corpus.size()]));
+  }
+}
+
+// The arguments are passed to the host build as int, so mutations stay within
+// its range
+std::vector<int64_t> Fuzzer::mutate(const std::vector<int64_t> &argv) {
+  std::vector<int64_t> child = argv;
+  if (child.empty()) {
+    return child;
+  }
+  const unsigned n = 1 + random() % 4;
+  for (unsigned i = 0; i < n; i++) {
+    int64_t &arg = child[random() % child.size()];
+    int32_t value = static_cast<int32_t>(arg);
+    switch (random() % 6) {
+    case 0:
+      value ^= int32_t(1u << (random() % 32));
+      break;
+    case 1: {
+      const int32_t delta = 1 + random() % 35;
+      value = static_cast<int32_t>(random() % 2 ? uint32_t(value) + delta
+                                                : uint32_t(value) - delta);
+      break;
+    }
+    case 2:
+      value = kInterestingValues[random() % (sizeof(kInterestingValues) /
+                                             sizeof(kInterestingValues[0]))];
+      break;
+    case 3:
+      value = static_cast<int32_t>(child[random() % child.size()]);
+      break;
+    case 4:
+      value = static_cast<int32_t>(-uint32_t(value));
+      break;
+    default:
+      value = static_cast<int32_t>(random());
+      break;
+    }
+    arg = value;
+  }
+  return child;
+}
+
+// Greedily replace each argument by simpler values for which the input still
+// fails, within a budget of runs. 'failure' is updated to the last failing
+// run.
+std::vector<int64_t> Fuzzer::minimize(std::vector<int64_t> argv,
+                                      FuzzFailure &failure) {
+  unsigned budget = 1000;
+  FuzzFailure candidate;
+  bool progress = true;
+  while (progress && budget > 0) {
+    progress = false;
+    for (size_t i = 0; i < argv.size() && budget > 0; i++) {
+      const int64_t value = argv[i];
+      for (int64_t simplerValue :
+           {int64_t(0), int64_t(1), int64_t(-1), value / 2,
+            value - (value > 0) + (value < 0)}) {
+        if (!simpler(simplerValue, value) || budget == 0) {
+          continue;
+        }
+        budget--;
+        argv[i] = simplerValue;
+        if (execute(argv, candidate) == Outcome::Fail) {
+          failure.stop = candidate.stop;
+          failure.expected = candidate.expected;
+          failure.actual = candidate.actual;
+          progress = true;
+          break;
+        }
+        argv[i] = value;
+      }
+    }
+  }
+  return argv;
+}
@@ -0,0 +1,109 @@
+#ifndef FUZZER_H
+#define FUZZER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "leros-sim.h"
+
+// A host build of a test program kept running across inputs, which reads the
+// input arguments of each run as a line of integers from stdin and answers
+// with a line holding the result of the test (see tests/c/harness.cpp). A
+// harness which exits, ie. because the test crashed, is a host error on the
+// input, which the fuzzer does not compare, and is started again for the next
+// one.
+class HostHarness {
+public:
+  explicit HostHarness(const std::string &path) : m_path(path) {}
+  ~HostHarness() { stop(); }
+
+  // Returns false on a host error: the harness crashed or exited, or answered
+  // "error" because the test returned without a result
+  bool run(const std::vector<int64_t> &argv, int64_t &result);
+
+private:
+  bool start();
+  void stop();
+
+  std::string m_path;
+  pid_t m_pid = -1;
+  FILE *m_in = nullptr;  // stdin of the harness
+  FILE *m_out = nullptr; // stdout of the harness
+};
+
+struct FuzzOptions {
+  uint64_t runs = 100000;
+  uint64_t seed = 1;
+  // Budget of each run, as for LerosSim::run(). Runs exceeding it are counted
+  // but not compared, as they mostly stem from inputs making the test loop
+  // for long.
+  uint64_t maxInstructions = 10000000;
+  double timeout = 0;
+  // Stop after this many distinct failures
+  unsigned maxFailures = 10;
+};
+
+// An input on which the simulated program disagrees with the host build
+struct FuzzFailure {
+  std::vector<int64_t> argv;     // minimized
+  std::vector<int64_t> original; // as found
+  int stop;
+  int64_t expected;
+  int64_t actual;
+};
+
+// Coverage-guided fuzzing of the input arguments of a program against a host
+// reference. Inputs are mutated from a corpus, which keeps those covering
+// instructions or branch directions no earlier input covered, and each run
+// starts from a snapshot of the loaded program. Failing inputs are minimized
+// towards small values. The simulator must be created with the coverage
+// option.
+class Fuzzer {
+public:
+  Fuzzer(LerosSim &sim, HostHarness &host, const FuzzOptions &options);
+
+  // Add an input to the initial corpus. All inputs must have the same number
+  // of arguments.
+  void addInput(const std::vector<int64_t> &argv);
+
+  // Run the added inputs, then fuzz for options.runs runs in total or until
+  // options.maxFailures failures have been found
+  void run();
+
+  const std::vector<FuzzFailure> &failures() const { return m_failures; }
+  const std::vector<std::vector<int64_t>> &corpus() const { return m_corpus; }
+  const Coverage &coverage() const { return m_coverage; }
+  uint64_t runs() const { return m_runs; }
+  // Runs exceeding the budget, and runs on which the host build crashed
+  uint64_t overBudget() const { return m_overBudget; }
+  uint64_t hostErrors() const { return m_hostErrors; }
+
+private:
+  enum class Outcome { Pass, Fail, OverBudget, HostError };
+
+  Outcome execute(const std::vector<int64_t> &argv, FuzzFailure &failure);
+  // Execute 'argv' and record it if it fails
+  void check(const std::vector<int64_t> &argv);
+  std::vector<int64_t> mutate(const std::vector<int64_t> &argv);
+  std::vector<int64_t> minimize(std::vector<int64_t> argv,
+                                FuzzFailure &failure);
+  uint64_t random();
+
+  LerosSim &m_sim;
+  HostHarness &m_host;
+  const FuzzOptions m_options;
+  LerosSim::Snapshot m_initial;
+  Coverage m_coverage;
+  std::vector<std::vector<int64_t>> m_inputs;
+  std::vector<std::vector<int64_t>> m_corpus;
+  std::vector<FuzzFailure> m_failures;
+  uint64_t m_runs = 0;
+  uint64_t m_overBudget = 0;
+  uint64_t m_hostErrors = 0;
+  uint64_t m_random;
+};
+
+#endif // FUZZER_H
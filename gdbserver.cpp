@@ -0,0 +1,477 @@
+#include "gdbserver.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+// Number of instructions executed between checks for a debugger interrupt
+constexpr unsigned kInterruptPollInterval = 4096;
+
+// Largest packet the debugger may send, as advertised in qSupported; memory
+// reads and writes are limited to what fits in one packet as hex
+constexpr size_t kPacketSize = 0x4000;
+constexpr size_t kMaxMemoryLength = kPacketSize / 2;
+
+const char *hexDigits = "0123456789abcdef";
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+MVT parseHex(const std::string &s) {
+  MVT v = 0;
+  for (char c : s) {
+    const int d = hexValue(c);
+    if (d < 0)
+      break;
+    v = (v << 4) | d;
+  }
+  return v;
+}
+
+std::string toHex(MVT v) {
+  std::stringstream ss;
+  ss << std::hex << v;
+  return ss.str();
+}
+
+void appendHexByte(std::string &out, uint8_t b) {
+  out += hexDigits[b >> 4];
+  out += hexDigits[b & 0xF];
+}
+
+// Little endian, XLen bit register value
+void appendHexReg(std::string &out, MVT v) {
+  for (unsigned i = 0; i < XLen / 8; i++) {
+    appendHexByte(out, v & 0xFF);
+    v >>= 8;
+  }
+}
+
+std::string targetXml() {
+  std::stringstream ss;
+  ss << "<?xml version=\"1.0\"?>\n"
+     << "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+     << "<target version=\"1.0\">\n"
+     << "<feature name=\"org.leros.core\">\n";
+  for (unsigned i = 0; i < 256; i++) {
+    ss << "<reg name=\"r" << i << "\" bitsize=\"" << XLen
+       << "\" type=\"int\" regnum=\"" << i << "\"/>\n";
+  }
+  ss << "<reg name=\"acc\" bitsize=\"" << XLen << "\" type=\"int\" regnum=\""
+     << REG_ACC << "\"/>\n";
+  ss << "<reg name=\"addr\" bitsize=\"" << XLen
+     << "\" type=\"data_ptr\" regnum=\"" << REG_ADDR << "\"/>\n";
+  ss << "<reg name=\"pc\" bitsize=\"" << XLen
+     << "\" type=\"code_ptr\" regnum=\"" << REG_PC << "\"/>\n";
+  ss << "</feature>\n</target>\n";
+  return ss.str();
+}
+
+} // namespace
+
+GdbServer::~GdbServer() {
+  if (m_fd >= 0)
+    close(m_fd);
+  if (m_listenFd >= 0)
+    close(m_listenFd);
+  if (!m_socketPath.empty())
+    unlink(m_socketPath.c_str());
+}
+
+bool GdbServer::listen(const std::string &spec) {
+  const bool isPort =
+      !spec.empty() && spec.find_first_not_of("0123456789") == std::string::npos;
+
+  if (isPort) {
+    m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listenFd < 0) {
+      perror("socket");
+      return false;
+    }
+    int one = 1;
+    setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(std::stoi(spec));
+    if (bind(m_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+        0) {
+      perror("bind");
+      return false;
+    }
+  } else {
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listenFd < 0) {
+      perror("socket");
+      return false;
+    }
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (spec.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Socket path too long: " << spec << std::endl;
+      return false;
+    }
+    strncpy(addr.sun_path, spec.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(spec.c_str());
+    if (bind(m_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+        0) {
+      perror("bind");
+      return false;
+    }
+    m_socketPath = spec;
+  }
+
+  if (::listen(m_listenFd, 1) < 0) {
+    perror("listen");
+    return false;
+  }
+
+  std::cerr << "Waiting for GDB connection on " << spec << std::endl;
+  m_fd = accept(m_listenFd, nullptr, nullptr);
+  if (m_fd < 0) {
+    perror("accept");
+    return false;
+  }
+
+  if (isPort) {
+    int one = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return true;
+}
+
+bool GdbServer::serve() {
+  std::string packet;
+  while (readPacket(packet)) {
+    if (!handlePacket(packet))
+      break;
+  }
+  return m_detached && !m_exited;
+}
+
+bool GdbServer::readPacket(std::string &packet) {
+  packet.clear();
+  char c;
+
+  // Skip acknowledgements and stray interrupts until the start of a packet
+  do {
+    if (recv(m_fd, &c, 1, 0) <= 0)
+      return false;
+  } while (c != '$');
+
+  while (true) {
+    if (recv(m_fd, &c, 1, 0) <= 0)
+      return false;
+    if (c == '#')
+      break;
+    packet += c;
+  }
+
+  char checksum[2];
+  for (char &cs : checksum) {
+    if (recv(m_fd, &cs, 1, 0) <= 0)
+      return false;
+  }
+
+  uint8_t sum = 0;
+  for (char pc : packet)
+    sum += static_cast<uint8_t>(pc);
+  const bool valid = hexValue(checksum[0]) * 16 + hexValue(checksum[1]) == sum;
+  const char ack = valid ? '+' : '-';
+  send(m_fd, &ack, 1, 0);
+  return valid ? true : readPacket(packet);
+}
+
+void GdbServer::sendPacket(const std::string &payload) {
+  uint8_t sum = 0;
+  for (char c : payload)
+    sum += static_cast<uint8_t>(c);
+
+  std::string out = "$" + payload + "#";
+  appendHexByte(out, sum);
+
+  // Retransmit until the debugger acknowledges the packet
+  char ack = '-';
+  while (ack != '+') {
+    if (send(m_fd, out.data(), out.size(), 0) < 0)
+      return;
+    if (recv(m_fd, &ack, 1, 0) <= 0)
+      return;
+  }
+}
+
+bool GdbServer::interruptRequested() {
+  pollfd pfd = {m_fd, POLLIN, 0};
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+    return false;
+
+  char c;
+  if (recv(m_fd, &c, 1, MSG_PEEK) == 1 && c == '\x03') {
+    recv(m_fd, &c, 1, 0);
+    return true;
+  }
+  return false;
+}
+
+bool GdbServer::handlePacket(const std::string &packet) {
+  const char cmd = packet.empty() ? 0 : packet[0];
+  const std::string args = packet.size() > 1 ? packet.substr(1) : "";
+
+  switch (cmd) {
+  case '?':
+    sendPacket(m_exited ? "W00" : "S05");
+    break;
+  case 'g':
+    sendPacket(readRegisters());
+    break;
+  case 'G':
+    sendPacket(writeRegisters(args) ? "OK" : "E01");
+    break;
+  case 'p': {
+    const unsigned idx = parseHex(args);
+    std::string out;
+    if (idx < NUM_DEBUG_REGS) {
+      appendHexReg(out, m_sim.readRegister(idx));
+      sendPacket(out);
+    } else {
+      sendPacket("E01");
+    }
+    break;
+  }
+  case 'P': {
+    const size_t eq = args.find('=');
+    const unsigned idx = parseHex(args.substr(0, eq));
+    if (eq == std::string::npos || idx >= NUM_DEBUG_REGS) {
+      sendPacket("E01");
+      break;
+    }
+    MVT value = 0;
+    const std::string hex = args.substr(eq + 1);
+    for (unsigned i = 0; i < XLen / 8 && 2 * i + 1 < hex.size(); i++) {
+      value |= static_cast<MVT>(parseHex(hex.substr(2 * i, 2))) << (8 * i);
+    }
+    m_sim.writeRegister(idx, value);
+    sendPacket("OK");
+    break;
+  }
+  case 'm':
+    sendPacket(readMemory(args));
+    break;
+  case 'M':
+    sendPacket(writeMemory(args) ? "OK" : "E01");
+    break;
+  case 'c':
+  case 's':
+    if (!args.empty())
+      m_sim.writeRegister(REG_PC, parseHex(args));
+    sendPacket(resume(cmd == 's'));
+    break;
+  case 'Z':
+  case 'z':
+    sendPacket(breakpoint(args, cmd == 'Z'));
+    break;
+  case 'H':
+    sendPacket("OK");
+    break;
+  case 'q':
+    sendPacket(query(packet));
+    break;
+  case 'D':
+    sendPacket("OK");
+    m_detached = true;
+    return false;
+  case 'k':
+    return false;
+  default:
+    // Unsupported packets are answered with an empty response
+    sendPacket("");
+    break;
+  }
+  return true;
+}
+
+std::string GdbServer::resume(bool singleStep) {
+  if (m_exited)
+    return "W00";
+
+  // The first instruction is executed without a breakpoint check, such that
+  // resuming from a breakpoint makes progress.
+  int retval = m_sim.step();
+  if (singleStep || retval != ALL_OK)
+    return stopReply(retval);
+
+  while (true) {
+    for (unsigned i = 0; i < kInterruptPollInterval; i++) {
+      retval = m_sim.clock();
+      if (retval != ALL_OK)
+        return stopReply(retval);
+    }
+    if (interruptRequested())
+      return "S02"; // SIGINT
+  }
+}
+
+std::string GdbServer::stopReply(int retval) {
+  switch (retval) {
+  case ALL_OK:
+  case BREAKPOINT:
+    return "S05"; // SIGTRAP
+  case WATCHPOINT: {
+    const char *kind = "watch";
+    if (m_sim.watchHitKind() == WatchKind::Read)
+      kind = "rwatch";
+    else if (m_sim.watchHitKind() == WatchKind::Access)
+      kind = "awatch";
+    return std::string("T05") + kind + ":" + toHex(m_sim.watchHitAddress()) +
+           ";";
+  }
+  default: {
+    // The program terminated; report the low byte of the return value register
+    // as the exit code.
+    m_exited = true;
+    std::string out = "W";
+    appendHexByte(out, m_sim.readRegister(4) & 0xFF);
+    return out;
+  }
+  }
+}
+
+std::string GdbServer::readRegisters() {
+  std::string out;
+  out.reserve(NUM_DEBUG_REGS * XLen / 4);
+  for (unsigned i = 0; i < NUM_DEBUG_REGS; i++)
+    appendHexReg(out, m_sim.readRegister(i));
+  return out;
+}
+
+bool GdbServer::writeRegisters(const std::string &hex) {
+  const unsigned regChars = XLen / 4;
+  if (hex.size() < NUM_DEBUG_REGS * regChars)
+    return false;
+
+  for (unsigned i = 0; i < NUM_DEBUG_REGS; i++) {
+    MVT value = 0;
+    for (unsigned b = 0; b < XLen / 8; b++) {
+      value |= static_cast<MVT>(parseHex(hex.substr(i * regChars + 2 * b, 2)))
+               << (8 * b);
+    }
+    m_sim.writeRegister(i, value);
+  }
+  return true;
+}
+
+std::string GdbServer::readMemory(const std::string &args) {
+  const size_t comma = args.find(',');
+  if (comma == std::string::npos)
+    return "E01";
+
+  const MVT addr = parseHex(args.substr(0, comma));
+  const size_t len = parseHex(args.substr(comma + 1));
+  if (len > kMaxMemoryLength)
+    return "E01";
+  std::string out;
+  out.reserve(len * 2);
+  for (size_t i = 0; i < len; i++)
+    appendHexByte(out, m_sim.readByte(addr + i));
+  return out;
+}
+
+bool GdbServer::writeMemory(const std::string &args) {
+  const size_t comma = args.find(',');
+  const size_t colon = args.find(':');
+  if (comma == std::string::npos || colon == std::string::npos)
+    return false;
+
+  const MVT addr = parseHex(args.substr(0, comma));
+  const size_t len = parseHex(args.substr(comma + 1, colon - comma - 1));
+  const std::string data = args.substr(colon + 1);
+  if (len > kMaxMemoryLength || data.size() < len * 2)
+    return false;
+
+  for (size_t i = 0; i < len; i++)
+    m_sim.writeByte(addr + i, parseHex(data.substr(2 * i, 2)));
+  return true;
+}
+
+std::string GdbServer::breakpoint(const std::string &args, bool insert) {
+  // Format: type,addr,kind
+  std::vector<std::string> fields;
+  std::string field;
+  std::istringstream f(args);
+  while (std::getline(f, field, ','))
+    fields.push_back(field);
+  if (fields.size() < 3)
+    return "E01";
+
+  const unsigned type = parseHex(fields[0]);
+  const MVT addr = parseHex(fields[1]);
+  const MVT len = parseHex(fields[2]);
+
+  switch (type) {
+  case 0: // software breakpoint
+  case 1: // hardware breakpoint
+    if (insert)
+      return m_sim.insertBreakpoint(addr) ? "OK" : "E01";
+    return m_sim.removeBreakpoint(addr) ? "OK" : "E01";
+  case 2:
+  case 3:
+  case 4: {
+    const WatchKind kind = static_cast<WatchKind>(type);
+    if (insert) {
+      m_sim.insertWatchpoint(addr, len, kind);
+      return "OK";
+    }
+    return m_sim.removeWatchpoint(addr, len, kind) ? "OK" : "E01";
+  }
+  default:
+    return "";
+  }
+}
+
+std::string GdbServer::query(const std::string &packet) {
+  if (packet.compare(0, 10, "qSupported") == 0)
+    return "PacketSize=" + toHex(kPacketSize) + ";qXfer:features:read+";
+  if (packet == "qAttached")
+    return "1";
+  if (packet == "qC")
+    return "QC1";
+  if (packet == "qfThreadInfo")
+    return "m1";
+  if (packet == "qsThreadInfo")
+    return "l";
+
+  const std::string xferPrefix = "qXfer:features:read:target.xml:";
+  if (packet.compare(0, xferPrefix.size(), xferPrefix) == 0) {
+    const std::string range = packet.substr(xferPrefix.size());
+    const size_t comma = range.find(',');
+    const size_t offset = parseHex(range.substr(0, comma));
+    const size_t length = parseHex(range.substr(comma + 1));
+    const std::string xml = targetXml();
+    if (offset >= xml.size())
+      return "l";
+    const std::string chunk = xml.substr(offset, length);
+    return (offset + chunk.size() < xml.size() ? "m" : "l") + chunk;
+  }
+
+  return "";
+}
@@ -0,0 +1,55 @@
+#ifndef GDBSERVER_H
+#define GDBSERVER_H
+
+#include <string>
+
+#include "leros-sim.h"
+
+// Minimal GDB remote serial protocol stub. A single debugger connection is
+// accepted on either a TCP port or a Unix domain socket, after which the
+// simulator is driven exclusively through the debugger.
+//
+// Registers are exposed as r0-r255 followed by ACC, ADDR and PC (see
+// DebugReg), each XLen bits wide and transferred in target (little endian)
+// byte order.
+class GdbServer {
+public:
+  // Superinstructions are disabled on the simulator, such that stepping and
+  // breakpoints see every instruction
+  GdbServer(LerosSim &sim) : m_sim(sim) { m_sim.setFusion(false); }
+  ~GdbServer();
+
+  // Listen on 'spec', which is either a TCP port number or a Unix socket path,
+  // and block until a debugger connects. Returns false on failure.
+  bool listen(const std::string &spec);
+
+  // Serve debugger requests until the debugger detaches or kills the target.
+  // Returns true if the debugger detached from a still running program, which
+  // should then continue executing without the debugger.
+  bool serve();
+
+private:
+  bool readPacket(std::string &packet);
+  void sendPacket(const std::string &payload);
+  bool handlePacket(const std::string &packet);
+  bool interruptRequested();
+
+  std::string resume(bool singleStep);
+  std::string stopReply(int retval);
+
+  std::string readRegisters();
+  bool writeRegisters(const std::string &hex);
+  std::string readMemory(const std::string &args);
+  bool writeMemory(const std::string &args);
+  std::string breakpoint(const std::string &args, bool insert);
+  std::string query(const std::string &packet);
+
+  LerosSim &m_sim;
+  int m_listenFd = -1;
+  int m_fd = -1;
+  std::string m_socketPath;
+  bool m_exited = false;
+  bool m_detached = false;
+};
+
+#endif // GDBSERVER_H
@@ -0,0 +1,127 @@
+#include "iobus.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool IOBus::attach(unsigned base, unsigned ports,
+                   std::shared_ptr<IODevice> device) {
+  if (base >= kPorts || ports > kPorts - base) {
+    return false;
+  }
+  for (unsigned p = base; p < base + ports; p++) {
+    if (m_ports[p].device) {
+      return false;
+    }
+  }
+  for (unsigned p = base; p < base + ports; p++) {
+    m_ports[p] = {device.get(), p - base};
+  }
+  m_devices.push_back(std::move(device));
+  return true;
+}
+
+void IOBus::reset() {
+  for (auto &device : m_devices) {
+    device->reset();
+  }
+}
+
+uint64_t UartDevice::in(unsigned reg) {
+  switch (reg) {
+  case DATA: {
+    const int c = m_input.get();
+    return c == std::istream::traits_type::eof() ? ~uint64_t(0) : uint64_t(c);
+  }
+  case STATUS: {
+    const bool ready = m_input.peek() != std::istream::traits_type::eof();
+    return (ready ? RX_READY : 0) | TX_READY;
+  }
+  default:
+    return 0;
+  }
+}
+
+void UartDevice::out(unsigned reg, uint64_t value) {
+  if (reg == DATA) {
+    m_output.put(static_cast<char>(value));
+  }
+}
+
+uint64_t TimerDevice::in(unsigned reg) {
+  const uint64_t time =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - m_start)
+          .count();
+  return reg == TIME_HI ? time >> 32 : time;
+}
+
+FileDevice::~FileDevice() {
+  if (m_data) {
+    munmap(const_cast<uint8_t *>(m_data), m_size);
+  }
+}
+
+bool FileDevice::open(const std::string &filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size != 0) {
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    // The file is mostly read front to back
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const uint8_t *>(map);
+    m_size = st.st_size;
+  }
+  close(fd);
+  return true;
+}
+
+uint64_t FileDevice::in(unsigned reg) {
+  switch (reg) {
+  case DATA:
+    return m_pos < m_size ? m_data[m_pos++] : ~uint64_t(0);
+  case SIZE:
+    return m_size;
+  case POS:
+    return m_pos;
+  case DMA_ADDR:
+    return m_dmaAddr;
+  case DMA_LEN:
+    return m_dmaCopied;
+  default:
+    return 0;
+  }
+}
+
+void FileDevice::out(unsigned reg, uint64_t value) {
+  switch (reg) {
+  case POS:
+    m_pos = std::min<uint64_t>(value, m_size);
+    break;
+  case DMA_ADDR:
+    m_dmaAddr = value;
+    break;
+  case DMA_LEN:
+    m_dmaCopied = std::min<uint64_t>(value, m_size - m_pos);
+    if (m_dmaCopied != 0) {
+      m_copyOut(m_dmaAddr, m_data + m_pos, m_dmaCopied);
+    }
+    m_pos += m_dmaCopied;
+    break;
+  default:
+    break;
+  }
+}
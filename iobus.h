@@ -0,0 +1,166 @@
+#ifndef IOBUS_H
+#define IOBUS_H
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A device on the I/O bus, accessed by the 'in' and 'out' instructions through
+// a range of consecutive ports. Values are truncated to the width of the
+// accumulator.
+class IODevice {
+public:
+  virtual ~IODevice() {}
+  // Read or write register 'reg' of the device, relative to its first port
+  virtual uint64_t in(unsigned reg) = 0;
+  virtual void out(unsigned reg, uint64_t value) = 0;
+  // Called when the simulator is reset
+  virtual void reset() {}
+};
+
+// Ports of the devices attached by LerosSim
+enum IOPort : unsigned {
+  UART_PORT = 0x00,
+  TIMER_PORT = 0x10,
+  CYCLE_PORT = 0x18,
+  // File devices, FILE_PORTS ports each
+  FILE_PORT = 0x20,
+  FILE_PORTS = 8
+};
+
+// Maps the 256 I/O ports to devices. Each port holds its device and the
+// register of the device it accesses, so dispatch is a table lookup and a
+// virtual call. 'in' from ports without a device returns 0, and 'out' to
+// them is ignored.
+class IOBus {
+public:
+  static constexpr unsigned kPorts = 256;
+
+  // Attach 'device' at ports [base, base + ports). Returns false if the range
+  // is outside of the port space or overlaps another device.
+  bool attach(unsigned base, unsigned ports, std::shared_ptr<IODevice> device);
+
+  uint64_t in(unsigned port) {
+    const Port &p = m_ports[port];
+    return p.device ? p.device->in(p.reg) : 0;
+  }
+  void out(unsigned port, uint64_t value) {
+    const Port &p = m_ports[port];
+    if (p.device) {
+      p.device->out(p.reg, value);
+    }
+  }
+
+  void reset();
+
+private:
+  struct Port {
+    IODevice *device = nullptr;
+    unsigned reg = 0;
+  };
+  std::array<Port, kPorts> m_ports;
+  std::vector<std::shared_ptr<IODevice>> m_devices;
+};
+
+// Serial port. Bytes written to DATA are sent to the output stream, and reads
+// of DATA return the next byte of the input stream, or -1 at its end. STATUS
+// has RX_READY set while input is available (waiting for input if there is
+// none yet) and TX_READY always set. Output is buffered until the output
+// stream is flushed.
+class UartDevice : public IODevice {
+public:
+  enum Reg { DATA, STATUS, NUM_REGS };
+  enum Status { RX_READY = 1 << 0, TX_READY = 1 << 1 };
+
+  UartDevice(std::istream &input, std::ostream &output)
+      : m_input(input), m_output(output) {}
+
+  uint64_t in(unsigned reg) override;
+  void out(unsigned reg, uint64_t value) override;
+
+private:
+  std::istream &m_input;
+  std::ostream &m_output;
+};
+
+// Host time in microseconds since the simulator was reset, as a 64 bit value
+// in TIME (read as its low word on 32 bit Leros) and its upper 32 bits in
+// TIME_HI
+class TimerDevice : public IODevice {
+public:
+  enum Reg { TIME, TIME_HI, NUM_REGS };
+
+  TimerDevice() { reset(); }
+
+  uint64_t in(unsigned reg) override;
+  void out(unsigned, uint64_t) override {}
+  void reset() override { m_start = std::chrono::steady_clock::now(); }
+
+private:
+  std::chrono::steady_clock::time_point m_start;
+};
+
+// Number of instructions executed, with registers like TimerDevice
+class CycleCounterDevice : public IODevice {
+public:
+  enum Reg { COUNT, COUNT_HI, NUM_REGS };
+
+  explicit CycleCounterDevice(std::function<uint64_t()> count)
+      : m_count(std::move(count)) {}
+
+  uint64_t in(unsigned reg) override {
+    const uint64_t count = m_count();
+    return reg == COUNT_HI ? count >> 32 : count;
+  }
+  void out(unsigned, uint64_t) override {}
+
+private:
+  std::function<uint64_t()> m_count;
+};
+
+// Streams a host file, mapped read-only into host memory, into the program.
+// Reads of DATA return the next byte of the file, or -1 at its end. SIZE is
+// the size of the file and POS the position of the next byte, which may be
+// set by writing it. For bulk input, writing a length to DMA_LEN copies up to
+// that many bytes from the position to guest memory at DMA_ADDR and advances
+// the position; reading DMA_LEN returns the number of bytes copied.
+class FileDevice : public IODevice {
+public:
+  enum Reg { DATA, SIZE, POS, DMA_ADDR, DMA_LEN, NUM_REGS };
+
+  // Copies a block of host memory to guest memory
+  typedef std::function<void(uint64_t address, const uint8_t *data,
+                             size_t len)>
+      CopyOut;
+
+  explicit FileDevice(CopyOut copyOut) : m_copyOut(std::move(copyOut)) {}
+  FileDevice(const FileDevice &) = delete;
+  FileDevice &operator=(const FileDevice &) = delete;
+  ~FileDevice();
+
+  // Returns false if the file could not be opened or mapped
+  bool open(const std::string &filename);
+
+  uint64_t in(unsigned reg) override;
+  void out(unsigned reg, uint64_t value) override;
+  void reset() override {
+    m_pos = 0;
+    m_dmaAddr = 0;
+    m_dmaCopied = 0;
+  }
+
+private:
+  const uint8_t *m_data = nullptr;
+  size_t m_size = 0;
+  size_t m_pos = 0;
+  uint64_t m_dmaAddr = 0;
+  uint64_t m_dmaCopied = 0;
+  CopyOut m_copyOut;
+};
+
+#endif // IOBUS_H
@@ -0,0 +1,291 @@
+// Differential testing of the execution engines on random programs (see
+// progen.h). Every program is run with several sets of input arguments on each
+// engine, and the state at the end of each run is compared with that of the
+// switch engine, which decodes every instruction and serves as the reference.
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "cxxopts/cxxopts.hpp"
+#include "leros-sim.h"
+#include "lockstep.h"
+#include "progen.h"
+
+namespace {
+
+// Every run ends well within this, unless an engine fails to take a loop exit
+constexpr uint64_t kMaxInstructions = 10000000;
+constexpr unsigned kArgumentSets = LockstepSim::kLanes;
+
+struct Engine {
+  const char *name;
+  LerosEngine engine;
+  bool fuse;
+};
+
+const Engine kEngines[] = {{"switch", LerosEngine::Switch, false},
+                           {"predecoded", LerosEngine::Predecoded, true},
+                           {"predecoded --no-fuse", LerosEngine::Predecoded,
+                            false},
+                           {"block", LerosEngine::Block, true},
+                           {"block --no-fuse", LerosEngine::Block, false}};
+
+// Architectural state at the end of a run
+struct State {
+  int status;
+  uint64_t instructions;
+  MVT reg[NUM_DEBUG_REGS];
+  std::string data;
+};
+
+struct DiffOptions {
+  uint64_t programs;
+  uint64_t seed;
+  std::string out;
+  ProgramGenOptions generator;
+};
+
+// Random arguments, which are mostly small, such that the branches on them go
+// both ways
+std::vector<std::vector<MVT>> argumentSets(uint64_t seed) {
+  uint64_t random = seed * 0x2545f4914f6cdd1dull + 1;
+  std::vector<std::vector<MVT>> sets(kArgumentSets);
+  for (unsigned i = 1; i < kArgumentSets; i++) {
+    for (unsigned j = 0; j < kGenArguments; j++) {
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+      const MVT_S value = random % 4 ? MVT_S(random >> 40) % 64 - 32
+                                     : static_cast<MVT_S>(random);
+      sets[i].push_back(value);
+    }
+  }
+  sets[0].assign(kGenArguments, 0);
+  return sets;
+}
+
+std::string describe(const std::vector<MVT> &args) {
+  std::string s;
+  for (MVT arg : args) {
+    s += (s.empty() ? "" : " ") + std::to_string(static_cast<MVT_S>(arg));
+  }
+  return s;
+}
+
+// The first difference between 'expected' and 'actual', or an empty string
+std::string compare(const State &expected, const State &actual) {
+  std::ostringstream os;
+  if (expected.status != actual.status) {
+    os << "status " << expected.status << " vs " << actual.status;
+  } else if (expected.instructions != actual.instructions) {
+    os << "instructions executed " << expected.instructions << " vs "
+       << actual.instructions;
+  } else {
+    for (unsigned r = 0; r < NUM_DEBUG_REGS; r++) {
+      if (expected.reg[r] != actual.reg[r]) {
+        const char *names[] = {"acc", "addr", "pc"};
+        os << (r < REG_ACC ? "r" + std::to_string(r) : names[r - REG_ACC])
+           << " 0x" << std::hex << expected.reg[r] << " vs 0x"
+           << actual.reg[r];
+        return os.str();
+      }
+    }
+    for (size_t i = 0; i < expected.data.size(); i++) {
+      if (expected.data[i] != actual.data[i]) {
+        os << "byte at 0x" << std::hex << kGenDataStart + i << " 0x"
+           << (expected.data[i] & 0xff) << " vs 0x" << (actual.data[i] & 0xff);
+        break;
+      }
+    }
+  }
+  return os.str();
+}
+
+void runEngine(const std::string &path, const Engine &engine,
+               const std::vector<std::vector<MVT>> &sets,
+               std::vector<State> &states) {
+  LerosOptions opt;
+  opt.filename = path;
+  opt.onlyShowModifiedRegs = false;
+  opt.printState = false;
+  opt.dumpAccu = false;
+  opt.engine = engine.engine;
+  opt.fuse = engine.fuse;
+  LerosSim sim(opt);
+  LerosSim::Snapshot initial;
+  sim.snapshot(initial);
+  states.resize(sets.size());
+  for (size_t i = 0; i < sets.size(); i++) {
+    sim.restore(initial);
+    sim.setArguments(sets[i]);
+    sim.reset();
+    State &state = states[i];
+    state.status = sim.run(kMaxInstructions);
+    state.instructions = sim.instructionsExecuted();
+    for (unsigned r = 0; r < NUM_DEBUG_REGS; r++) {
+      state.reg[r] = sim.readRegister(r);
+    }
+    state.data.resize(kGenDataSize);
+    for (size_t b = 0; b < kGenDataSize; b++) {
+      state.data[b] = sim.readByte(kGenDataStart + b);
+    }
+  }
+}
+
+void runLockstep(const std::string &path,
+                 const std::vector<std::vector<MVT>> &sets,
+                 std::vector<State> &states) {
+  LockstepSim sim;
+  states.assign(sets.size(), State());
+  if (!sim.load(path)) {
+    for (State &state : states) {
+      state.status = SimRetval::ERROR;
+    }
+    return;
+  }
+  for (unsigned lane = 0; lane < sets.size(); lane++) {
+    sim.reset(lane, sets[lane]);
+  }
+  sim.run(kMaxInstructions);
+  for (unsigned lane = 0; lane < sets.size(); lane++) {
+    State &state = states[lane];
+    state.status = sim.status(lane);
+    state.instructions = sim.instructionsExecuted(lane);
+    for (unsigned r = 0; r < NUM_DEBUG_REGS; r++) {
+      state.reg[r] = sim.readRegister(lane, r);
+    }
+    state.data.resize(kGenDataSize);
+    for (size_t b = 0; b < kGenDataSize; b++) {
+      state.data[b] = sim.readByte(lane, kGenDataStart + b);
+    }
+  }
+}
+
+// Returns the differences of program 'seed' written to 'path', one per line
+std::string testProgram(const std::string &path, uint64_t seed) {
+  const auto sets = argumentSets(seed);
+  std::vector<State> reference;
+  runEngine(path, kEngines[0], sets, reference);
+  std::string report;
+  const auto check = [&](const std::string &name,
+                         const std::vector<State> &states) {
+    for (size_t i = 0; i < sets.size(); i++) {
+      const std::string diff = compare(reference[i], states[i]);
+      if (!diff.empty()) {
+        report += "seed " + std::to_string(seed) + " (ARG: " +
+                  describe(sets[i]) + "): " + name + " differs from switch: " +
+                  diff + "\n";
+        return;
+      }
+    }
+  };
+  for (size_t i = 0; i < sets.size(); i++) {
+    if (reference[i].status != SimRetval::SCALL) {
+      report += "seed " + std::to_string(seed) + " (ARG: " +
+                describe(sets[i]) + "): switch stopped with status " +
+                std::to_string(reference[i].status) + "\n";
+      return report;
+    }
+  }
+  for (size_t e = 1; e < sizeof(kEngines) / sizeof(kEngines[0]); e++) {
+    std::vector<State> states;
+    runEngine(path, kEngines[e], sets, states);
+    check(kEngines[e].name, states);
+  }
+  std::vector<State> states;
+  runLockstep(path, sets, states);
+  check("lockstep", states);
+  return report;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options options(
+      "leros-difftest",
+      "Differential testing of the Leros simulator engines on random programs");
+  // clang-format off
+  options.add_options()
+          ("programs", "Number of programs to generate", cxxopts::value<uint64_t>()->default_value("1000"))
+          ("seed", "Seed of the first program; the following ones use the next seeds", cxxopts::value<uint64_t>()->default_value("1"))
+          ("length", "Approximate number of instructions of each program", cxxopts::value<unsigned>()->default_value("300"))
+          ("loop-iterations", "Maximum number of iterations of each loop", cxxopts::value<unsigned>()->default_value("8"))
+          ("loop-depth", "Maximum nesting of loops, up to 3", cxxopts::value<unsigned>()->default_value("3"))
+          ("threads", "Number of threads, or 0 for one per hardware thread", cxxopts::value<unsigned>()->default_value("0"))
+          ("out", "Directory to which the programs on which the engines differ are written", cxxopts::value<std::string>()->default_value("."))
+          ("h,help", "Print usage")
+          ;
+  // clang-format on
+
+  DiffOptions opt;
+  unsigned threads;
+  try {
+    auto result = options.parse(argc, argv);
+    if (result.count("help")) {
+      std::cout << options.help();
+      return 0;
+    }
+    opt.programs = result["programs"].as<uint64_t>();
+    opt.seed = result["seed"].as<uint64_t>();
+    opt.out = result["out"].as<std::string>();
+    opt.generator.length = result["length"].as<unsigned>();
+    opt.generator.maxLoopIterations = result["loop-iterations"].as<unsigned>();
+    opt.generator.maxLoopDepth = result["loop-depth"].as<unsigned>();
+    threads = result["threads"].as<unsigned>();
+  } catch (const cxxopts::OptionException &e) {
+    std::cout << "Error parsing options: " << e.what() << std::endl;
+    return 1;
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  std::atomic<uint64_t> next(0);
+  std::atomic<uint64_t> failing(0);
+  std::mutex outputMutex;
+  const auto worker = [&](unsigned id) {
+    const std::string path = opt.out + "/.leros-difftest-" +
+                             std::to_string(getpid()) + "-" +
+                             std::to_string(id) + ".elf";
+    for (uint64_t i = next++; i < opt.programs; i = next++) {
+      const uint64_t seed = opt.seed + i;
+      if (!writeRandomProgram(path, seed, opt.generator)) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "Could not write " << path << std::endl;
+        failing++;
+        break;
+      }
+      const std::string report = testProgram(path, seed);
+      if (!report.empty()) {
+        const std::string saved =
+            opt.out + "/difftest-" + std::to_string(seed) + ".elf";
+        writeRandomProgram(saved, seed, opt.generator);
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << report << "  program written to " << saved << std::endl;
+        failing++;
+      }
+    }
+    unlink(path.c_str());
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads; t++) {
+    pool.emplace_back(worker, t);
+  }
+  for (auto &t : pool) {
+    t.join();
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << "Tested " << opt.programs << " programs with " << kArgumentSets
+            << " inputs each on "
+            << sizeof(kEngines) / sizeof(kEngines[0]) + 1 << " engines in "
+            << seconds << " s: " << failing << " failing" << std::endl;
+  return failing ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+#include "leros-sim-c.h"
+
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string.h>
+
+#include "coverage.h"
+#include "features.h"
+#include "leros-sim.h"
+#include "lockstep.h"
+#include "multisim.h"
+
+static_assert(int(LEROS_STOP_EXIT) == JAL_RA_EXIT &&
+                  int(LEROS_STOP_SCALL) == SCALL &&
+                  int(LEROS_STOP_ERROR) == ERROR &&
+                  int(LEROS_STOP_BREAKPOINT) == BREAKPOINT &&
+                  int(LEROS_STOP_WATCHPOINT) == WATCHPOINT &&
+                  int(LEROS_STOP_INSTRUCTION_LIMIT) == INSTRUCTION_LIMIT &&
+                  int(LEROS_STOP_TIMEOUT) == TIMEOUT,
+              "leros_stop must match SimRetval");
+static_assert(int(LEROS_REG_ACC) == REG_ACC && int(LEROS_REG_ADDR) == REG_ADDR &&
+                  int(LEROS_REG_PC) == REG_PC,
+              "leros_reg must match DebugReg");
+
+struct leros_sim {
+  LerosOptions options;
+  std::unique_ptr<LerosSim> sim;
+  // State directly after loading, restored by leros_sim_reset()
+  LerosSim::Snapshot initial;
+  // Incremented by every load, to match snapshots to the loaded program
+  uint64_t generation = 0;
+  // Instruction slots executed by the runs since loading, if features are
+  // recorded
+  std::vector<bool> executed;
+};
+
+struct leros_snapshot {
+  uint64_t generation;
+  LerosSim::Snapshot state;
+};
+
+unsigned leros_sim_xlen(void) { return XLen; }
+
+leros_sim *leros_sim_create(const char *engine) {
+  leros_sim *sim = new (std::nothrow) leros_sim();
+  if (!sim) {
+    return nullptr;
+  }
+  sim->options.onlyShowModifiedRegs = false;
+  sim->options.printState = false;
+  sim->options.dumpAccu = false;
+  if (engine) {
+    const std::string name = engine;
+    if (name == "switch") {
+      sim->options.engine = LerosEngine::Switch;
+    } else if (name == "predecoded") {
+      sim->options.engine = LerosEngine::Predecoded;
+    } else if (name != "block") {
+      delete sim;
+      return nullptr;
+    }
+  }
+  return sim;
+}
+
+void leros_sim_destroy(leros_sim *sim) { delete sim; }
+
+int leros_sim_load(leros_sim *sim, const char *path) {
+  sim->generation++;
+  sim->options.filename = path;
+  sim->sim.reset(new LerosSim(sim->options));
+  if (!sim->sim->loaded()) {
+    sim->sim.reset();
+    return -1;
+  }
+  sim->sim->snapshot(sim->initial);
+  sim->executed.assign(sim->sim->slotInstructions().size(), false);
+  return 0;
+}
+
+int leros_sim_reset(leros_sim *sim, const int64_t *argv, size_t argc) {
+  if (!sim->sim) {
+    return -1;
+  }
+  sim->sim->restore(sim->initial);
+  sim->sim->setArguments(std::vector<MVT>(argv, argv + argc));
+  sim->sim->reset();
+  return 0;
+}
+
+static std::chrono::steady_clock::time_point deadlineAfter(double seconds) {
+  if (seconds <= 0) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return std::chrono::steady_clock::now() +
+         std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::duration<double>(seconds));
+}
+
+int leros_sim_run(leros_sim *sim, uint64_t max_instructions,
+                  double timeout_seconds) {
+  if (!sim->sim) {
+    return -1;
+  }
+  const int stop =
+      sim->sim->run(max_instructions, deadlineAfter(timeout_seconds));
+  const auto &counts = sim->sim->slotInstructions();
+  for (size_t slot = 0; slot < sim->executed.size(); slot++) {
+    if (counts[slot] != 0) {
+      sim->executed[slot] = true;
+    }
+  }
+  return stop;
+}
+
+uint64_t leros_sim_instructions(const leros_sim *sim) {
+  return sim->sim->instructionsExecuted();
+}
+
+int64_t leros_sim_read_reg(const leros_sim *sim, unsigned reg) {
+  if (reg >= NUM_DEBUG_REGS) {
+    return 0;
+  }
+  return static_cast<MVT_S>(sim->sim->readRegister(reg));
+}
+
+void leros_sim_write_reg(leros_sim *sim, unsigned reg, int64_t value) {
+  if (reg < NUM_DEBUG_REGS) {
+    sim->sim->writeRegister(reg, static_cast<MVT>(value));
+  }
+}
+
+void leros_sim_read_mem(leros_sim *sim, uint64_t addr, void *buf, size_t len) {
+  uint8_t *out = static_cast<uint8_t *>(buf);
+  for (size_t i = 0; i < len; i++) {
+    out[i] = sim->sim->readByte(static_cast<MVT>(addr + i));
+  }
+}
+
+void leros_sim_write_mem(leros_sim *sim, uint64_t addr, const void *buf,
+                         size_t len) {
+  const uint8_t *in = static_cast<const uint8_t *>(buf);
+  for (size_t i = 0; i < len; i++) {
+    sim->sim->writeByte(static_cast<MVT>(addr + i), in[i]);
+  }
+}
+
+leros_snapshot *leros_sim_snapshot(leros_sim *sim) {
+  if (!sim->sim) {
+    return nullptr;
+  }
+  leros_snapshot *snapshot = new (std::nothrow) leros_snapshot();
+  if (snapshot) {
+    snapshot->generation = sim->generation;
+    sim->sim->snapshot(snapshot->state);
+  }
+  return snapshot;
+}
+
+int leros_sim_restore(leros_sim *sim, const leros_snapshot *snapshot) {
+  if (!sim->sim || snapshot->generation != sim->generation) {
+    return -1;
+  }
+  sim->sim->restore(snapshot->state);
+  return 0;
+}
+
+void leros_snapshot_destroy(leros_snapshot *snapshot) { delete snapshot; }
+
+// Pairs are recorded by the switch engine, and executed instructions through
+// the instruction counts of the timing model
+void leros_sim_record_features(leros_sim *sim, int enable) {
+  sim->options.profilePairs = enable;
+  sim->options.timing = enable;
+}
+
+static size_t copyText(const std::string &text, char *buf, size_t size) {
+  if (size != 0) {
+    const size_t n = std::min(text.size(), size - 1);
+    memcpy(buf, text.data(), n);
+    buf[n] = 0;
+  }
+  return text.size();
+}
+
+size_t leros_sim_features(const leros_sim *sim, int executed, char *buf,
+                          size_t size) {
+  ControlFlowGraph cfg;
+  cfg.build(sim->sim->image());
+  std::string text;
+  const std::set<std::string> features =
+      executed ? executedFeatures(*sim->sim, cfg, sim->executed)
+               : staticFeatures(cfg);
+  for (const auto &feature : features) {
+    text += feature + "\n";
+  }
+  return copyText(text, buf, size);
+}
+
+void leros_sim_record_coverage(leros_sim *sim, int enable) {
+  sim->options.coverage = enable;
+}
+
+struct leros_coverage {
+  std::string path;
+  uint64_t execStart;
+  Coverage coverage;
+  // The graph refers to the code of the image, which outlives the simulators
+  ProgramImage image;
+  ControlFlowGraph cfg;
+};
+
+leros_coverage *leros_coverage_create(const leros_sim *sim) {
+  if (!sim->sim) {
+    return nullptr;
+  }
+  leros_coverage *cov = new (std::nothrow) leros_coverage();
+  if (!cov) {
+    return nullptr;
+  }
+  cov->path = sim->options.filename;
+  cov->execStart = sim->sim->execStart();
+  cov->coverage.reset(sim->sim->execSlots());
+  if (!cov->image.load(cov->path)) {
+    delete cov;
+    return nullptr;
+  }
+  cov->cfg.build(cov->image);
+  return cov;
+}
+
+void leros_coverage_destroy(leros_coverage *cov) { delete cov; }
+
+int leros_coverage_merge(leros_coverage *cov, const leros_sim *sim) {
+  if (!sim->sim || !sim->options.coverage ||
+      sim->sim->execStart() != cov->execStart ||
+      sim->sim->coverage().slots() != cov->coverage.slots()) {
+    return -1;
+  }
+  cov->coverage.merge(sim->sim->coverage());
+  return 0;
+}
+
+int leros_coverage_write_lcov(const leros_coverage *const *covs, size_t n,
+                              const char *path) {
+  std::vector<CoverageRecord> records;
+  for (size_t i = 0; i < n; i++) {
+    records.push_back(
+        {covs[i]->path, &covs[i]->coverage, &covs[i]->cfg, covs[i]->execStart});
+  }
+  return writeLcovFile(path, records) ? 0 : -1;
+}
+
+// The opcodes and scall numbers are those of all programs together
+size_t leros_coverage_summary(const leros_coverage *const *covs, size_t n,
+                              char *buf, size_t size) {
+  Coverage all;
+  CoverageTotals totals;
+  for (size_t i = 0; i < n; i++) {
+    all.merge(covs[i]->coverage);
+    countCoverage(covs[i]->coverage, covs[i]->cfg, covs[i]->execStart, totals);
+  }
+  std::ostringstream os;
+  printCoverageSummary(os, all, totals);
+  return copyText(os.str(), buf, size);
+}
+
+struct leros_lockstep {
+  LockstepSim sim;
+};
+
+unsigned leros_lockstep_lanes(void) { return LockstepSim::kLanes; }
+
+const char *leros_lockstep_isa(void) { return LockstepSim::isa(); }
+
+leros_lockstep *leros_lockstep_create(const char *path) {
+  leros_lockstep *ls = new (std::nothrow) leros_lockstep();
+  if (ls && !ls->sim.load(path)) {
+    delete ls;
+    return nullptr;
+  }
+  return ls;
+}
+
+void leros_lockstep_destroy(leros_lockstep *ls) { delete ls; }
+
+void leros_lockstep_reset(leros_lockstep *ls, unsigned lane,
+                          const int64_t *argv, size_t argc) {
+  ls->sim.reset(lane, std::vector<MVT>(argv, argv + argc));
+}
+
+void leros_lockstep_run(leros_lockstep *ls, uint64_t max_instructions,
+                        double timeout_seconds) {
+  ls->sim.run(max_instructions, deadlineAfter(timeout_seconds));
+}
+
+int leros_lockstep_stop(const leros_lockstep *ls, unsigned lane) {
+  return ls->sim.status(lane);
+}
+
+uint64_t leros_lockstep_instructions(const leros_lockstep *ls, unsigned lane) {
+  return ls->sim.instructionsExecuted(lane);
+}
+
+int64_t leros_lockstep_read_reg(const leros_lockstep *ls, unsigned lane,
+                                unsigned reg) {
+  return static_cast<MVT_S>(ls->sim.readRegister(lane, reg));
+}
+
+struct leros_multisim {
+  explicit leros_multisim(size_t instances) : sim(instances) {}
+  MultiSim sim;
+};
+
+leros_multisim *leros_multisim_create(const char *path, size_t instances) {
+  leros_multisim *ms = new (std::nothrow) leros_multisim(instances);
+  if (ms && !ms->sim.load(path)) {
+    delete ms;
+    return nullptr;
+  }
+  return ms;
+}
+
+void leros_multisim_destroy(leros_multisim *ms) { delete ms; }
+
+void leros_multisim_reset(leros_multisim *ms, size_t instance,
+                          const int64_t *argv, size_t argc) {
+  ms->sim.reset(instance, std::vector<MVT>(argv, argv + argc));
+}
+
+void leros_multisim_run(leros_multisim *ms, unsigned threads,
+                        uint64_t max_instructions, double timeout_seconds) {
+  auto timeout = std::chrono::nanoseconds::max();
+  if (timeout_seconds > 0) {
+    timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double>(timeout_seconds));
+  }
+  ms->sim.run(threads, max_instructions, timeout);
+}
+
+int leros_multisim_stop(const leros_multisim *ms, size_t instance) {
+  return ms->sim.status(instance);
+}
+
+uint64_t leros_multisim_instructions(const leros_multisim *ms,
+                                     size_t instance) {
+  return ms->sim.instructionsExecuted(instance);
+}
+
+int64_t leros_multisim_read_reg(const leros_multisim *ms, size_t instance,
+                                unsigned reg) {
+  return static_cast<MVT_S>(ms->sim.readRegister(instance, reg));
+}
@@ -0,0 +1,176 @@
+#ifndef LEROS_SIM_C_H
+#define LEROS_SIM_C_H
+
+// C interface of libleros-sim, for embedding the simulator in host programs
+// and for foreign function interfaces such as Python's ctypes. All functions
+// taking a simulator require it to be loaded, except where noted. Registers
+// and addresses are passed as 64-bit values regardless of the XLen of the
+// library (see leros_sim_xlen()).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEROS_SIM_API_VERSION 6
+
+typedef struct leros_sim leros_sim;
+typedef struct leros_snapshot leros_snapshot;
+typedef struct leros_lockstep leros_lockstep;
+typedef struct leros_multisim leros_multisim;
+typedef struct leros_coverage leros_coverage;
+
+// Reasons for leros_sim_run() to return
+enum leros_stop {
+  LEROS_STOP_EXIT = 1,              // the PC left the executable segments
+  LEROS_STOP_SCALL = 2,             // the program called scall 0
+  LEROS_STOP_ERROR = 3,
+  LEROS_STOP_BREAKPOINT = 4,
+  LEROS_STOP_WATCHPOINT = 5,
+  LEROS_STOP_INSTRUCTION_LIMIT = 6, // max_instructions were executed
+  LEROS_STOP_TIMEOUT = 7            // timeout_seconds passed
+};
+
+// Register numbers following r0-r255
+enum leros_reg { LEROS_REG_ACC = 256, LEROS_REG_ADDR, LEROS_REG_PC };
+
+// Width of the simulated registers in bits, 32 or 64. Does not require a
+// simulator.
+unsigned leros_sim_xlen(void);
+
+// 'engine' is "block", "predecoded", "switch", or NULL for the default.
+// Returns NULL for unknown engines or on allocation failure.
+leros_sim *leros_sim_create(const char *engine);
+void leros_sim_destroy(leros_sim *sim);
+
+// Load a program (ELF or flat binary), replacing any previously loaded one,
+// and reset the simulator with no input arguments. Returns 0 on success.
+int leros_sim_load(leros_sim *sim, const char *path);
+
+// Restore the state directly after loading, with the given input arguments
+// for main(argc, argv). Returns 0 on success.
+int leros_sim_reset(leros_sim *sim, const int64_t *argv, size_t argc);
+
+// Run until the program stops, 'max_instructions' instructions have been
+// executed (0 for no limit) or 'timeout_seconds' have passed (0 for no
+// limit). Returns a leros_stop value, or -1 if no program is loaded.
+int leros_sim_run(leros_sim *sim, uint64_t max_instructions,
+                  double timeout_seconds);
+
+// Number of instructions executed since the last load or reset
+uint64_t leros_sim_instructions(const leros_sim *sim);
+
+// Registers r0-r255 and the leros_reg values. Register values are sign
+// extended from XLen bits. Other register numbers read as 0, and writes to
+// them are ignored.
+int64_t leros_sim_read_reg(const leros_sim *sim, unsigned reg);
+void leros_sim_write_reg(leros_sim *sim, unsigned reg, int64_t value);
+
+// Copy 'len' bytes of guest memory starting at 'addr' into 'buf'. Unmapped
+// memory reads as zero.
+void leros_sim_read_mem(leros_sim *sim, uint64_t addr, void *buf, size_t len);
+void leros_sim_write_mem(leros_sim *sim, uint64_t addr, const void *buf,
+                         size_t len);
+
+// Capture the complete simulator state, and restore it later on the same
+// simulator. Returns NULL if no program is loaded.
+leros_snapshot *leros_sim_snapshot(leros_sim *sim);
+int leros_sim_restore(leros_sim *sim, const leros_snapshot *snapshot);
+void leros_snapshot_destroy(leros_snapshot *snapshot);
+
+// Record the features the runs of each program exercise, for selecting the
+// tests affected by a change of the compiler (see features.h), at the cost of
+// simulating with the switch engine. Takes effect with the next
+// leros_sim_load(), and does not require a program.
+void leros_sim_record_features(leros_sim *sim, int enable);
+
+// Write the features of the loaded program to 'buf' as lines of text, and
+// return the length of the complete list like snprintf(): at most 'size'
+// bytes are written, including the terminating zero. With 'executed', the
+// features exercised by the runs since loading are written, which requires
+// leros_sim_record_features(); otherwise those of the code of the program.
+size_t leros_sim_features(const leros_sim *sim, int executed, char *buf,
+                          size_t size);
+
+// Record the coverage of the runs of each program (see coverage.h), at the
+// cost of the instrumentation of the timing model. Takes effect with the next
+// leros_sim_load(), and does not require a program.
+void leros_sim_record_coverage(leros_sim *sim, int enable);
+
+// Coverage of a program accumulated from any number of simulators, ie. the
+// workers of a sweep. leros_coverage_create() returns an empty accumulator
+// for the program loaded by 'sim', or NULL if no program is loaded.
+leros_coverage *leros_coverage_create(const leros_sim *sim);
+void leros_coverage_destroy(leros_coverage *cov);
+
+// Add the coverage of the runs of 'sim' since loading, which must have loaded
+// the same program with leros_sim_record_coverage(). Any number of threads
+// may merge into the same accumulator at once. Returns 0 on success.
+int leros_coverage_merge(leros_coverage *cov, const leros_sim *sim);
+
+// Write the coverage of 'n' programs as an lcov tracefile (see
+// writeLcovFile() in coverage.h). Returns 0 on success.
+int leros_coverage_write_lcov(const leros_coverage *const *covs, size_t n,
+                              const char *path);
+
+// Write a summary of the coverage of 'n' programs to 'buf', like
+// leros_sim_features()
+size_t leros_coverage_summary(const leros_coverage *const *covs, size_t n,
+                              char *buf, size_t size);
+
+// Lockstep execution of up to leros_lockstep_lanes() instances of a program
+// with different input arguments, using SIMD instructions (see lockstep.h).
+// leros_lockstep_isa() names the instruction set used on this host.
+unsigned leros_lockstep_lanes(void);
+const char *leros_lockstep_isa(void);
+
+// Returns NULL if the program could not be loaded
+leros_lockstep *leros_lockstep_create(const char *path);
+void leros_lockstep_destroy(leros_lockstep *ls);
+
+// Start 'lane' from the beginning of the program with the given input
+// arguments. leros_lockstep_run() runs all lanes started since the last run
+// until they stop, with budgets per lane like leros_sim_run().
+void leros_lockstep_reset(leros_lockstep *ls, unsigned lane,
+                          const int64_t *argv, size_t argc);
+void leros_lockstep_run(leros_lockstep *ls, uint64_t max_instructions,
+                        double timeout_seconds);
+
+// Results of 'lane': the leros_stop value, the number of instructions
+// executed and registers like leros_sim_read_reg()
+int leros_lockstep_stop(const leros_lockstep *ls, unsigned lane);
+uint64_t leros_lockstep_instructions(const leros_lockstep *ls, unsigned lane);
+int64_t leros_lockstep_read_reg(const leros_lockstep *ls, unsigned lane,
+                                unsigned reg);
+
+// Lockstep execution of any number of instances of a program, in groups of
+// leros_lockstep_lanes() instances on a pool of threads (see multisim.h)
+
+// Returns NULL if the program could not be loaded
+leros_multisim *leros_multisim_create(const char *path, size_t instances);
+void leros_multisim_destroy(leros_multisim *ms);
+
+// Start 'instance' from the beginning of the program with the given input
+// arguments. leros_multisim_run() runs all instances started since the last
+// run until they stop, on 'threads' threads (0 for one per CPU), with budgets
+// per instance like leros_sim_run(). The timeout applies to each group of
+// instances from when it starts running.
+void leros_multisim_reset(leros_multisim *ms, size_t instance,
+                          const int64_t *argv, size_t argc);
+void leros_multisim_run(leros_multisim *ms, unsigned threads,
+                        uint64_t max_instructions, double timeout_seconds);
+
+// Results of 'instance', like leros_lockstep_stop() and so on
+int leros_multisim_stop(const leros_multisim *ms, size_t instance);
+uint64_t leros_multisim_instructions(const leros_multisim *ms,
+                                     size_t instance);
+int64_t leros_multisim_read_reg(const leros_multisim *ms, size_t instance,
+                                unsigned reg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LEROS_SIM_C_H
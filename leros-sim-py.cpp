@@ -0,0 +1,821 @@
+// Python extension module 'lerossim', built on the C API of libleros-sim.
+//
+//   sim = lerossim.Sim()             # or Sim("switch"), Sim("predecoded")
+//   sim.load("program.elf")
+//   regs = sim.run([1, 2])           # r0-r255, acc, addr and pc
+//   values, stops, instrs = sim.sweep([[1, 2], [3, 4]], registers=[4])
+//
+//   results = lerossim.sweep_many([("a.elf", argvs), ("b.elf", argvs)])
+//   covered = lerossim.features("a.elf", argvs)
+//
+// Results are array.array objects of 64-bit integers, which numpy.asarray()
+// wraps without copying. Sweeps release the GIL and distribute the runs over
+// a pool of threads with work stealing (see workstealing.h), each thread with
+// its own copy of the loaded programs, optionally running them in lockstep
+// (see lockstep.h).
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "leros-sim-c.h"
+#include "workstealing.h"
+
+namespace {
+
+constexpr unsigned kNumRegs = LEROS_REG_PC + 1;
+
+struct SimObject {
+  PyObject_HEAD leros_sim *sim;
+  // Program and engine, for loading the program into the sweep workers
+  std::string *path;
+  std::string *engine;
+  int stop;
+  // Set while the GIL is released, so the simulator is not used concurrently
+  bool busy;
+};
+
+PyObject *makeArray(char typecode, const void *data, size_t bytes) {
+  PyObject *module = PyImport_ImportModule("array");
+  if (!module) {
+    return nullptr;
+  }
+  const char code[2] = {typecode, 0};
+  // A null pointer would be passed as None
+  PyObject *array = PyObject_CallMethod(
+      module, "array", "sy#", code,
+      bytes ? static_cast<const char *>(data) : "",
+      static_cast<Py_ssize_t>(bytes));
+  Py_DECREF(module);
+  return array;
+}
+
+// Convert a sequence of integers, or raise TypeError with the message 'what'
+bool parseInts(PyObject *obj, std::vector<int64_t> &argv, const char *what) {
+  PyObject *seq = PySequence_Fast(obj, what);
+  if (!seq) {
+    return false;
+  }
+  const Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+  argv.resize(n);
+  for (Py_ssize_t i = 0; i < n; i++) {
+    argv[i] = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, i));
+    if (argv[i] == -1 && PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return false;
+    }
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+// The simulator is busy while run() or sweep() execute with the GIL released
+bool checkIdle(SimObject *self) {
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "simulator is in use by a run or a sweep");
+    return false;
+  }
+  return true;
+}
+
+bool checkReady(SimObject *self) {
+  if (!checkIdle(self)) {
+    return false;
+  }
+  if (self->path->empty()) {
+    PyErr_SetString(PyExc_RuntimeError, "no program loaded");
+    return false;
+  }
+  return true;
+}
+
+PyObject *Sim_new(PyTypeObject *type, PyObject *, PyObject *) {
+  SimObject *self = reinterpret_cast<SimObject *>(type->tp_alloc(type, 0));
+  if (self) {
+    self->path = new std::string();
+    self->engine = new std::string();
+  }
+  return reinterpret_cast<PyObject *>(self);
+}
+
+int Sim_init(SimObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {"engine", nullptr};
+  const char *engine = nullptr;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z",
+                                   const_cast<char **>(kwlist), &engine)) {
+    return -1;
+  }
+  if (!checkIdle(self)) {
+    return -1;
+  }
+  leros_sim_destroy(self->sim);
+  self->sim = leros_sim_create(engine);
+  if (!self->sim) {
+    PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engine);
+    return -1;
+  }
+  *self->engine = engine ? engine : "";
+  self->path->clear();
+  self->stop = 0;
+  return 0;
+}
+
+void Sim_dealloc(SimObject *self) {
+  leros_sim_destroy(self->sim);
+  delete self->path;
+  delete self->engine;
+  Py_TYPE(self)->tp_free(reinterpret_cast<PyObject *>(self));
+}
+
+PyObject *Sim_load(SimObject *self, PyObject *args) {
+  PyObject *pathObj;
+  if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &pathObj)) {
+    return nullptr;
+  }
+  const std::string path = PyBytes_AS_STRING(pathObj);
+  Py_DECREF(pathObj);
+  if (!checkIdle(self)) {
+    return nullptr;
+  }
+  if (leros_sim_load(self->sim, path.c_str()) != 0) {
+    self->path->clear();
+    PyErr_Format(PyExc_OSError, "could not load '%s'", path.c_str());
+    return nullptr;
+  }
+  *self->path = path;
+  Py_RETURN_NONE;
+}
+
+PyObject *Sim_run(SimObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {"argv", "max_instructions", "timeout",
+                                 nullptr};
+  PyObject *argvObj = nullptr;
+  unsigned long long maxInstructions = 0;
+  double timeout = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OKd",
+                                   const_cast<char **>(kwlist), &argvObj,
+                                   &maxInstructions, &timeout)) {
+    return nullptr;
+  }
+  std::vector<int64_t> argv;
+  if ((argvObj &&
+       !parseInts(argvObj, argv, "argv must be a sequence of integers")) ||
+      !checkReady(self)) {
+    return nullptr;
+  }
+
+  self->busy = true;
+  int64_t regs[kNumRegs];
+  Py_BEGIN_ALLOW_THREADS;
+  leros_sim_reset(self->sim, argv.data(), argv.size());
+  self->stop = leros_sim_run(self->sim, maxInstructions, timeout);
+  for (unsigned i = 0; i < kNumRegs; i++) {
+    regs[i] = leros_sim_read_reg(self->sim, i);
+  }
+  Py_END_ALLOW_THREADS;
+  self->busy = false;
+  return makeArray('q', regs, sizeof(regs));
+}
+
+struct CoverageDeleter {
+  void operator()(leros_coverage *cov) const { leros_coverage_destroy(cov); }
+};
+
+// The runs of one program within a sweep
+struct SweepJob {
+  std::string path;
+  std::vector<std::vector<int64_t>> argvs;
+  // Expected instructions per run, or 0 if unknown
+  double cost = 0;
+  // Results, with 'values' holding the selected registers of each run
+  std::vector<int64_t> values;
+  std::vector<int64_t> stops;
+  std::vector<int64_t> instructions;
+  // Coverage of all runs, with SweepOptions::coverage
+  std::unique_ptr<leros_coverage, CoverageDeleter> coverage;
+};
+
+struct SweepOptions {
+  std::string engine;
+  std::vector<int64_t> regs = {4};
+  unsigned threads = 0;
+  bool lockstep = false;
+  // Record coverage, which is not supported in lockstep mode
+  bool coverage = false;
+  uint64_t maxInstructions = 0;
+  double timeout = 0;
+};
+
+bool parseArgvs(PyObject *obj, std::vector<std::vector<int64_t>> &argvs) {
+  PyObject *seq = PySequence_Fast(obj, "argvs must be a sequence");
+  if (!seq) {
+    return false;
+  }
+  argvs.resize(PySequence_Fast_GET_SIZE(seq));
+  for (size_t i = 0; i < argvs.size(); i++) {
+    if (!parseInts(PySequence_Fast_GET_ITEM(seq, i), argvs[i],
+                   "argvs must contain sequences of integers")) {
+      Py_DECREF(seq);
+      return false;
+    }
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+bool parseRegisters(PyObject *obj, std::vector<int64_t> &regs) {
+  if (obj &&
+      !parseInts(obj, regs, "registers must be a sequence of integers")) {
+    return false;
+  }
+  for (int64_t reg : regs) {
+    if (reg < 0 || reg >= static_cast<int64_t>(kNumRegs)) {
+      PyErr_Format(PyExc_ValueError, "invalid register %lld",
+                   static_cast<long long>(reg));
+      return false;
+    }
+  }
+  return true;
+}
+
+// Run all jobs on a pool of threads, scheduled by WorkStealingScheduler with
+// the GIL released. Returns the index of a job whose program could not be
+// loaded, or -1.
+ptrdiff_t runSweep(std::vector<SweepJob> &jobs, const SweepOptions &options) {
+  const char *engine =
+      options.engine.empty() ? nullptr : options.engine.c_str();
+  const size_t numRegs = options.regs.size();
+  // In lockstep mode, runs are handed out in multiples of the lanes of a group
+  const size_t lanes = options.lockstep ? leros_lockstep_lanes() : 1;
+
+  size_t runs = 0;
+  std::vector<size_t> jobRuns;
+  std::vector<double> costs;
+  for (auto &job : jobs) {
+    const size_t n = job.argvs.size();
+    job.values.assign(n * numRegs, 0);
+    job.stops.assign(n, 0);
+    job.instructions.assign(n, 0);
+    jobRuns.push_back(n);
+    costs.push_back(job.cost);
+    runs += n;
+  }
+
+  unsigned threads = options.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<size_t>(
+      1, std::min<size_t>(threads, (runs + lanes - 1) / lanes));
+
+  // Simulators of each worker, loaded for a job when the worker first runs it
+  struct Sims {
+    std::vector<leros_sim *> sims;
+    std::vector<leros_lockstep *> groups;
+    ~Sims() {
+      for (auto sim : sims) {
+        leros_sim_destroy(sim);
+      }
+      for (auto group : groups) {
+        leros_lockstep_destroy(group);
+      }
+    }
+  };
+  std::vector<Sims> sims(threads);
+  for (auto &own : sims) {
+    own.sims.assign(jobs.size(), nullptr);
+    own.groups.assign(jobs.size(), nullptr);
+  }
+  const auto loadSim = [&](Sims &own, size_t j) {
+    if (!own.sims[j]) {
+      own.sims[j] = leros_sim_create(engine);
+      if (own.sims[j]) {
+        leros_sim_record_coverage(own.sims[j], options.coverage);
+      }
+      if (own.sims[j] &&
+          leros_sim_load(own.sims[j], jobs[j].path.c_str()) != 0) {
+        leros_sim_destroy(own.sims[j]);
+        own.sims[j] = nullptr;
+      }
+    }
+    return own.sims[j];
+  };
+  const auto loadGroup = [&](Sims &own, size_t j) {
+    if (!own.groups[j]) {
+      own.groups[j] = leros_lockstep_create(jobs[j].path.c_str());
+    }
+    return own.groups[j];
+  };
+
+  // The programs are loaded by the calling thread first, which reports
+  // programs which cannot be loaded
+  for (size_t j = 0; j < jobs.size(); j++) {
+    if (options.lockstep ? !loadGroup(sims[0], j) : !loadSim(sims[0], j)) {
+      return j;
+    }
+    if (options.coverage && !jobs[j].coverage) {
+      jobs[j].coverage.reset(leros_coverage_create(sims[0].sims[j]));
+    }
+  }
+
+  WorkStealingScheduler scheduler(threads, jobRuns, costs, lanes);
+  const auto work = [&](unsigned w) {
+    Sims &own = sims[w];
+    WorkStealingScheduler::Range chunk;
+    while (scheduler.next(w, chunk)) {
+      SweepJob &job = jobs[chunk.job];
+      uint64_t executed = 0;
+      if (options.lockstep) {
+        leros_lockstep *ls = loadGroup(own, chunk.job);
+        for (size_t first = chunk.begin; first < chunk.end; first += lanes) {
+          const size_t count = std::min(lanes, chunk.end - first);
+          for (size_t l = 0; ls && l < count; l++) {
+            const auto &argv = job.argvs[first + l];
+            leros_lockstep_reset(ls, l, argv.data(), argv.size());
+          }
+          if (ls) {
+            leros_lockstep_run(ls, options.maxInstructions, options.timeout);
+          }
+          for (size_t l = 0; l < count; l++) {
+            const size_t i = first + l;
+            if (!ls) {
+              job.stops[i] = LEROS_STOP_ERROR;
+              continue;
+            }
+            job.stops[i] = leros_lockstep_stop(ls, l);
+            job.instructions[i] = leros_lockstep_instructions(ls, l);
+            executed += job.instructions[i];
+            for (size_t r = 0; r < numRegs; r++) {
+              job.values[i * numRegs + r] =
+                  leros_lockstep_read_reg(ls, l, options.regs[r]);
+            }
+          }
+        }
+      } else {
+        leros_sim *sim = loadSim(own, chunk.job);
+        for (size_t i = chunk.begin; i < chunk.end; i++) {
+          if (!sim) {
+            job.stops[i] = LEROS_STOP_ERROR;
+            continue;
+          }
+          leros_sim_reset(sim, job.argvs[i].data(), job.argvs[i].size());
+          job.stops[i] =
+              leros_sim_run(sim, options.maxInstructions, options.timeout);
+          job.instructions[i] = leros_sim_instructions(sim);
+          executed += job.instructions[i];
+          for (size_t r = 0; r < numRegs; r++) {
+            job.values[i * numRegs + r] =
+                leros_sim_read_reg(sim, options.regs[r]);
+          }
+        }
+      }
+      scheduler.completed(chunk, executed);
+    }
+    // Each worker adds the coverage of its simulators once it is done
+    for (size_t j = 0; options.coverage && j < jobs.size(); j++) {
+      if (own.sims[j] && jobs[j].coverage) {
+        leros_coverage_merge(jobs[j].coverage.get(), own.sims[j]);
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; t++) {
+    pool.emplace_back(work, t);
+  }
+  work(0);
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  return -1;
+}
+
+// (values, stops, instructions) of a job
+PyObject *makeResults(const SweepJob &job) {
+  PyObject *valuesObj = makeArray('q', job.values.data(),
+                                  job.values.size() * sizeof(int64_t));
+  PyObject *stopsObj =
+      makeArray('q', job.stops.data(), job.stops.size() * sizeof(int64_t));
+  PyObject *instructionsObj =
+      makeArray('q', job.instructions.data(),
+                job.instructions.size() * sizeof(int64_t));
+  if (!valuesObj || !stopsObj || !instructionsObj) {
+    Py_XDECREF(valuesObj);
+    Py_XDECREF(stopsObj);
+    Py_XDECREF(instructionsObj);
+    return nullptr;
+  }
+  return Py_BuildValue("(NNN)", valuesObj, stopsObj, instructionsObj);
+}
+
+PyObject *Sim_sweep(SimObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {"argvs",   "registers",        "threads",
+                                 "lockstep", "max_instructions", "timeout",
+                                 nullptr};
+  PyObject *argvsObj;
+  PyObject *regsObj = nullptr;
+  int lockstep = 0;
+  unsigned long long maxInstructions = 0;
+  SweepOptions options;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OIpKd",
+                                   const_cast<char **>(kwlist), &argvsObj,
+                                   &regsObj, &options.threads, &lockstep,
+                                   &maxInstructions, &options.timeout)) {
+    return nullptr;
+  }
+  options.lockstep = lockstep;
+  options.maxInstructions = maxInstructions;
+  options.engine = *self->engine;
+
+  std::vector<SweepJob> jobs(1);
+  if (!parseArgvs(argvsObj, jobs[0].argvs) ||
+      !parseRegisters(regsObj, options.regs) || !checkReady(self)) {
+    return nullptr;
+  }
+  jobs[0].path = *self->path;
+
+  self->busy = true;
+  ptrdiff_t failed;
+  Py_BEGIN_ALLOW_THREADS;
+  failed = runSweep(jobs, options);
+  Py_END_ALLOW_THREADS;
+  self->busy = false;
+  if (failed >= 0) {
+    PyErr_Format(PyExc_OSError, "could not load '%s'", self->path->c_str());
+    return nullptr;
+  }
+  return makeResults(jobs[0]);
+}
+
+PyObject *Sim_readMem(SimObject *self, PyObject *args) {
+  unsigned long long addr;
+  Py_ssize_t len;
+  if (!PyArg_ParseTuple(args, "Kn", &addr, &len) || !checkReady(self)) {
+    return nullptr;
+  }
+  PyObject *bytes =
+      PyBytes_FromStringAndSize(nullptr, std::max<Py_ssize_t>(len, 0));
+  if (bytes) {
+    leros_sim_read_mem(self->sim, addr, PyBytes_AS_STRING(bytes),
+                       PyBytes_GET_SIZE(bytes));
+  }
+  return bytes;
+}
+
+PyObject *Sim_getStop(SimObject *self, void *) {
+  return PyLong_FromLong(self->stop);
+}
+
+PyObject *Sim_getInstructions(SimObject *self, void *) {
+  if (!checkIdle(self)) {
+    return nullptr;
+  }
+  if (self->path->empty()) {
+    return PyLong_FromLong(0);
+  }
+  return PyLong_FromUnsignedLongLong(leros_sim_instructions(self->sim));
+}
+
+PyMethodDef Sim_methods[] = {
+    {"load", reinterpret_cast<PyCFunction>(Sim_load), METH_VARARGS,
+     "load(path)\n\nLoad a program (ELF or flat binary)."},
+    {"run", reinterpret_cast<PyCFunction>(Sim_run),
+     METH_VARARGS | METH_KEYWORDS,
+     "run(argv=[], max_instructions=0, timeout=0.0)\n\n"
+     "Reset the program with the given input arguments and run it. Returns "
+     "the registers r0-r255, acc, addr and pc as an array; the reason for "
+     "stopping is available as 'stop'."},
+    {"sweep", reinterpret_cast<PyCFunction>(Sim_sweep),
+     METH_VARARGS | METH_KEYWORDS,
+     "sweep(argvs, registers=[4], threads=0, lockstep=False, "
+     "max_instructions=0, timeout=0.0)\n\n"
+     "Run the program once per input argument list in 'argvs', on 'threads' "
+     "threads (0 for one per CPU). Returns the arrays (values, stops, "
+     "instructions), where values holds the given registers of each run, "
+     "row by row. With 'lockstep', the runs are executed in groups in SIMD "
+     "lanes, and the timeout applies to each group. Runs are distributed as "
+     "by sweep_many()."},
+    {"read_mem", reinterpret_cast<PyCFunction>(Sim_readMem), METH_VARARGS,
+     "read_mem(addr, len)\n\nRead guest memory as bytes."},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef Sim_getset[] = {
+    {"stop", reinterpret_cast<getter>(Sim_getStop), nullptr,
+     "Reason the last run() stopped (one of the STOP_* constants)", nullptr},
+    {"instructions", reinterpret_cast<getter>(Sim_getInstructions), nullptr,
+     "Number of instructions executed by the last run()", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+// Jobs given as a sequence of (path, argvs)
+bool parseJobs(PyObject *obj, std::vector<SweepJob> &jobs) {
+  PyObject *seq = PySequence_Fast(obj, "jobs must be a sequence");
+  if (!seq) {
+    return false;
+  }
+  jobs = std::vector<SweepJob>(PySequence_Fast_GET_SIZE(seq));
+  for (size_t j = 0; j < jobs.size(); j++) {
+    PyObject *pathObj;
+    PyObject *argvsObj;
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, j), "O&O",
+                          PyUnicode_FSConverter, &pathObj, &argvsObj)) {
+      Py_DECREF(seq);
+      return false;
+    }
+    jobs[j].path = PyBytes_AS_STRING(pathObj);
+    Py_DECREF(pathObj);
+    if (!parseArgvs(argvsObj, jobs[j].argvs)) {
+      Py_DECREF(seq);
+      return false;
+    }
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+PyObject *sweepMany(PyObject *, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {
+      "jobs",    "registers", "threads", "lockstep", "max_instructions",
+      "timeout", "engine",    "costs",   nullptr};
+  PyObject *jobsObj;
+  PyObject *regsObj = nullptr;
+  PyObject *costsObj = nullptr;
+  const char *engine = nullptr;
+  int lockstep = 0;
+  unsigned long long maxInstructions = 0;
+  SweepOptions options;
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "O|OIpKdzO", const_cast<char **>(kwlist), &jobsObj,
+          &regsObj, &options.threads, &lockstep, &maxInstructions,
+          &options.timeout, &engine, &costsObj)) {
+    return nullptr;
+  }
+  options.lockstep = lockstep;
+  options.maxInstructions = maxInstructions;
+  options.engine = engine ? engine : "";
+  if (!parseRegisters(regsObj, options.regs)) {
+    return nullptr;
+  }
+  leros_sim *probe = leros_sim_create(engine);
+  if (!probe) {
+    PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engine);
+    return nullptr;
+  }
+  leros_sim_destroy(probe);
+
+  std::vector<SweepJob> jobs;
+  if (!parseJobs(jobsObj, jobs)) {
+    return nullptr;
+  }
+
+  if (costsObj && costsObj != Py_None) {
+    PyObject *costs = PySequence_Fast(costsObj, "costs must be a sequence");
+    if (!costs) {
+      return nullptr;
+    }
+    const size_t n = std::min<size_t>(PySequence_Fast_GET_SIZE(costs),
+                                      jobs.size());
+    for (size_t j = 0; j < n; j++) {
+      jobs[j].cost = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(costs, j));
+      if (jobs[j].cost == -1 && PyErr_Occurred()) {
+        Py_DECREF(costs);
+        return nullptr;
+      }
+    }
+    Py_DECREF(costs);
+  }
+
+  ptrdiff_t failed;
+  Py_BEGIN_ALLOW_THREADS;
+  failed = runSweep(jobs, options);
+  Py_END_ALLOW_THREADS;
+  if (failed >= 0) {
+    PyErr_Format(PyExc_OSError, "could not load '%s'",
+                 jobs[failed].path.c_str());
+    return nullptr;
+  }
+
+  PyObject *results = PyList_New(jobs.size());
+  for (size_t j = 0; results && j < jobs.size(); j++) {
+    PyObject *result = makeResults(jobs[j]);
+    if (!result) {
+      Py_DECREF(results);
+      return nullptr;
+    }
+    PyList_SET_ITEM(results, j, result);
+  }
+  return results;
+}
+
+PyObject *features(PyObject *, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {"path", "argvs", "max_instructions",
+                                 "timeout", nullptr};
+  PyObject *pathObj;
+  PyObject *argvsObj = Py_None;
+  unsigned long long maxInstructions = 0;
+  double timeout = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|OKd",
+                                   const_cast<char **>(kwlist),
+                                   PyUnicode_FSConverter, &pathObj, &argvsObj,
+                                   &maxInstructions, &timeout)) {
+    return nullptr;
+  }
+  const std::string path = PyBytes_AS_STRING(pathObj);
+  Py_DECREF(pathObj);
+  std::vector<std::vector<int64_t>> argvs;
+  if (argvsObj != Py_None && !parseArgvs(argvsObj, argvs)) {
+    return nullptr;
+  }
+
+  leros_sim *sim = leros_sim_create("switch");
+  if (!sim) {
+    return PyErr_NoMemory();
+  }
+  std::string text;
+  int loaded;
+  Py_BEGIN_ALLOW_THREADS;
+  leros_sim_record_features(sim, argvsObj != Py_None);
+  loaded = leros_sim_load(sim, path.c_str()) == 0;
+  if (loaded) {
+    for (const auto &argv : argvs) {
+      leros_sim_reset(sim, argv.data(), argv.size());
+      leros_sim_run(sim, maxInstructions, timeout);
+    }
+    const int executed = argvsObj != Py_None;
+    text.resize(leros_sim_features(sim, executed, nullptr, 0) + 1);
+    text.resize(leros_sim_features(sim, executed, &text[0], text.size()));
+  }
+  Py_END_ALLOW_THREADS;
+  leros_sim_destroy(sim);
+  if (!loaded) {
+    PyErr_Format(PyExc_OSError, "could not load '%s'", path.c_str());
+    return nullptr;
+  }
+
+  PyObject *result = PySet_New(nullptr);
+  for (size_t pos = 0; result && pos < text.size();) {
+    const size_t end = text.find('\n', pos);
+    PyObject *feature =
+        PyUnicode_FromStringAndSize(text.data() + pos, end - pos);
+    if (!feature || PySet_Add(result, feature) < 0) {
+      Py_XDECREF(feature);
+      Py_DECREF(result);
+      return nullptr;
+    }
+    Py_DECREF(feature);
+    pos = end + 1;
+  }
+  return result;
+}
+
+PyObject *coverage(PyObject *, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = {
+      "jobs", "lcov", "threads", "max_instructions", "timeout", "engine",
+      nullptr};
+  PyObject *jobsObj;
+  PyObject *lcovObj = nullptr;
+  const char *engine = nullptr;
+  unsigned long long maxInstructions = 0;
+  SweepOptions options;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O&IKdz",
+                                   const_cast<char **>(kwlist), &jobsObj,
+                                   PyUnicode_FSConverter, &lcovObj,
+                                   &options.threads, &maxInstructions,
+                                   &options.timeout, &engine)) {
+    return nullptr;
+  }
+  std::string lcov;
+  if (lcovObj) {
+    lcov = PyBytes_AS_STRING(lcovObj);
+    Py_DECREF(lcovObj);
+  }
+  options.coverage = true;
+  options.maxInstructions = maxInstructions;
+  options.engine = engine ? engine : "";
+  leros_sim *probe = leros_sim_create(engine);
+  if (!probe) {
+    PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engine);
+    return nullptr;
+  }
+  leros_sim_destroy(probe);
+  std::vector<SweepJob> jobs;
+  if (!parseJobs(jobsObj, jobs)) {
+    return nullptr;
+  }
+
+  ptrdiff_t failed;
+  int written = 0;
+  std::string summary;
+  Py_BEGIN_ALLOW_THREADS;
+  failed = runSweep(jobs, options);
+  if (failed < 0) {
+    std::vector<const leros_coverage *> covs;
+    for (const auto &job : jobs) {
+      covs.push_back(job.coverage.get());
+    }
+    if (!lcov.empty()) {
+      written =
+          leros_coverage_write_lcov(covs.data(), covs.size(), lcov.c_str());
+    }
+    summary.resize(
+        leros_coverage_summary(covs.data(), covs.size(), nullptr, 0) + 1);
+    summary.resize(leros_coverage_summary(covs.data(), covs.size(),
+                                          &summary[0], summary.size()));
+  }
+  Py_END_ALLOW_THREADS;
+  if (failed >= 0) {
+    PyErr_Format(PyExc_OSError, "could not load '%s'",
+                 jobs[failed].path.c_str());
+    return nullptr;
+  }
+  if (written != 0) {
+    PyErr_Format(PyExc_OSError, "could not write '%s'", lcov.c_str());
+    return nullptr;
+  }
+  return PyUnicode_FromStringAndSize(summary.data(), summary.size());
+}
+
+PyMethodDef lerossim_methods[] = {
+    {"sweep_many", reinterpret_cast<PyCFunction>(sweepMany),
+     METH_VARARGS | METH_KEYWORDS,
+     "sweep_many(jobs, registers=[4], threads=0, lockstep=False, "
+     "max_instructions=0, timeout=0.0, engine=None, costs=None)\n\n"
+     "Like Sim.sweep(), for the runs of several programs at once. 'jobs' is "
+     "a sequence of (path, argvs), and a list of (values, stops, "
+     "instructions) is returned with one entry per job. The runs of all "
+     "jobs are distributed over the threads by work stealing, in chunks "
+     "sized by the instruction counts of the runs completed so far. 'costs' "
+     "optionally gives the expected instructions per run of each job, ie. "
+     "as observed by an earlier sweep."},
+    {"features", reinterpret_cast<PyCFunction>(features),
+     METH_VARARGS | METH_KEYWORDS,
+     "features(path, argvs=None, max_instructions=0, timeout=0.0)\n\n"
+     "Features of a program for test selection, as a set of strings like "
+     "'op:add', 'pair:load,add' and 'fn:__mulsi3' (see features.h). Without "
+     "'argvs', returns the features of its code, where functions carry a "
+     "hash of their code; otherwise runs the program once per argument list "
+     "with the switch engine and returns the features the runs exercised."},
+    {"coverage", reinterpret_cast<PyCFunction>(coverage),
+     METH_VARARGS | METH_KEYWORDS,
+     "coverage(jobs, lcov=None, threads=0, max_instructions=0, timeout=0.0, "
+     "engine=None)\n\n"
+     "Run 'jobs' like sweep_many() while recording coverage, and return a "
+     "summary of the opcodes, scall numbers, instructions, branch directions "
+     "and functions covered as text. With 'lcov', also writes an lcov "
+     "tracefile with a disassembly listing per program next to it."},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyTypeObject SimType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+PyModuleDef lerossimModule = {PyModuleDef_HEAD_INIT, "lerossim",
+                              "Leros instruction set simulator", -1,
+                              lerossim_methods};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_lerossim(void) {
+  SimType.tp_name = "lerossim.Sim";
+  SimType.tp_basicsize = sizeof(SimObject);
+  SimType.tp_flags = Py_TPFLAGS_DEFAULT;
+  SimType.tp_doc = "Sim(engine=None)\n\nA Leros simulator. 'engine' is "
+                   "\"block\", \"predecoded\", \"switch\" or None for the "
+                   "default.";
+  SimType.tp_new = Sim_new;
+  SimType.tp_init = reinterpret_cast<initproc>(Sim_init);
+  SimType.tp_dealloc = reinterpret_cast<destructor>(Sim_dealloc);
+  SimType.tp_methods = Sim_methods;
+  SimType.tp_getset = Sim_getset;
+  if (PyType_Ready(&SimType) < 0) {
+    return nullptr;
+  }
+
+  PyObject *module = PyModule_Create(&lerossimModule);
+  if (!module) {
+    return nullptr;
+  }
+  Py_INCREF(&SimType);
+  if (PyModule_AddObject(module, "Sim",
+                         reinterpret_cast<PyObject *>(&SimType)) < 0) {
+    Py_DECREF(&SimType);
+    Py_DECREF(module);
+    return nullptr;
+  }
+  PyModule_AddIntConstant(module, "XLEN", leros_sim_xlen());
+  PyModule_AddIntConstant(module, "ACC", LEROS_REG_ACC);
+  PyModule_AddIntConstant(module, "ADDR", LEROS_REG_ADDR);
+  PyModule_AddIntConstant(module, "PC", LEROS_REG_PC);
+  PyModule_AddIntConstant(module, "STOP_EXIT", LEROS_STOP_EXIT);
+  PyModule_AddIntConstant(module, "STOP_SCALL", LEROS_STOP_SCALL);
+  PyModule_AddIntConstant(module, "STOP_ERROR", LEROS_STOP_ERROR);
+  PyModule_AddIntConstant(module, "STOP_BREAKPOINT", LEROS_STOP_BREAKPOINT);
+  PyModule_AddIntConstant(module, "STOP_WATCHPOINT", LEROS_STOP_WATCHPOINT);
+  PyModule_AddIntConstant(module, "STOP_INSTRUCTION_LIMIT",
+                          LEROS_STOP_INSTRUCTION_LIMIT);
+  PyModule_AddIntConstant(module, "STOP_TIMEOUT", LEROS_STOP_TIMEOUT);
+  return module;
+}
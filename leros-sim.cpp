@@ -1,462 +1,429 @@
-#include <array>
-#include <assert.h>
-#include <fstream>
+#include <chrono>
 #include <iostream>
 #include <map>
-#include <set>
-#include <stdint.h>
+#include <sstream>
+#include <unistd.h>
 
+#include "cfg.h"
 #include "cxxopts/cxxopts.hpp"
-#include "elfio/elfio.hpp"
-#include "ripes/mainmemory.h"
-
-#ifdef LEROS64
-#define MVT uint64_t
-#define MVT_S int64_t
-#define XLen 64
-#else
-#define MVT uint32_t
-#define MVT_S int32_t
-#define XLen 32
-#endif
-
-#define ILEN 2 // instruction length in bytes
-
-// Position in memory where we place input arguments, used for running main()
-// programs with integer arguments
-#define ARGV_START 0x8ffffff0
-
-enum class LerosInstr {
-  nop,
-  add,
-  addi,
-  sub,
-  subi,
-  sra,
-  load,
-  loadi,
-  And,
-  Andi,
-  Or,
-  Ori,
-  Xor,
-  Xori,
-  loadhi,
-  loadh2i,
-  loadh3i,
-#ifdef LEROS64
-  loadh4i,
-  loadh5i,
-  loadh6i,
-  loadh7i,
-#endif
-  store,
-  out,
-  in,
-  jal,
-  br,
-  brz,
-  brnz,
-  brp,
-  brn,
-  ldaddr,
-  ldind,
-  ldindb,
-  ldindh,
-  stind,
-  stindb,
-  stindh,
-  scall,
-  unknown
-};
-
-enum SimRetval { ALL_OK, JAL_RA_EXIT, SCALL, ERROR };
-
-template <typename T, unsigned B> inline T signextend(const T x) {
-  struct {
-    T x : B;
-  } s;
-  return s.x = x;
+#include "fuzzer.h"
+#include "gdbserver.h"
+#include "leros-sim.h"
+#include "multicore.h"
+
+void setupOptions(cxxopts::Options &options) {
+  // clang-format off
+  options.add_options()
+          ("f,file", "File name - Required", cxxopts::value<std::string>())
+          ("ps", "Print simulator state after simulation", cxxopts::value<bool>()->default_value("false"))
+          ("d", "Dump accumulator after each instruction", cxxopts::value<bool>()->default_value("false"))
+          ("osmr", "Only show modified registers in printout (implicitely enables --ps)", cxxopts::value<bool>()->default_value("false"))
+          ("rs", "Initial register staet, commaseparated list of format '0:2,4:10,...", cxxopts::value<std::string>()->default_value(""))
+          ("argv", "Input argument(s) for C programs with a main(argc, argv) function, specified as a string \"1 2 foo bar\"", cxxopts::value<std::string>()->default_value(""))
+          ("watch", "Comma separated list of memory ranges to watch, as 'start-end' or a section name, optionally suffixed with ':r', ':w' (default) or ':rw', ie. '.text,0x100-0x200:rw'", cxxopts::value<std::string>()->default_value(""))
+          ("watch-log", "Log up to N accesses to watched ranges in a ring buffer instead of stopping, and print them on exit", cxxopts::value<unsigned>()->default_value("0"))
+          ("sanitize", "Report reads of uninitialized memory and accesses outside of mapped sections, the argument area and the stack", cxxopts::value<bool>()->default_value("false"))
+          ("stats", "Print the number of executed instructions and the simulation speed on exit", cxxopts::value<bool>()->default_value("false"))
+          ("engine", "Execution engine, 'switch' (decode every instruction), 'predecoded' (cache decoded instructions) or 'block' (execute cached basic blocks)", cxxopts::value<std::string>()->default_value("block"))
+          ("no-fuse", "Do not combine common instruction sequences into superinstructions in the predecoded and block engines", cxxopts::value<bool>()->default_value("false"))
+          ("profile-pairs", "Count executed pairs of consecutive instructions and print the most frequent ones on exit", cxxopts::value<bool>()->default_value("false"))
+          ("timing", "Count cycles with a model of the Leros pipeline, and print the cycles and IPC per function on exit", cxxopts::value<bool>()->default_value("false"))
+          ("pipeline-stages", "Number of pipeline stages of the timing model", cxxopts::value<unsigned>()->default_value("3"))
+          ("branch-penalty", "Cycles lost by a taken branch or jal in the timing model", cxxopts::value<unsigned>()->default_value("2"))
+          ("load-wait", "Wait states of loads from the on-chip memory in the timing model", cxxopts::value<unsigned>()->default_value("0"))
+          ("store-wait", "Wait states of stores to the on-chip memory in the timing model", cxxopts::value<unsigned>()->default_value("0"))
+          ("cache", "Semicolon separated list of cache models to evaluate side by side, each given as 'size:ways:line' optionally followed by ':lru' (default), ':fifo' or ':random', ':wb' (default) or ':wt', and ':d' (default, loads and stores), ':i' (instruction fetches) or ':id', ie. '4k:1:16;8k:2:32:fifo:wt'", cxxopts::value<std::string>()->default_value(""))
+          ("cache-miss-penalty", "Cycles to fill a cache line or write one back, for the cycle estimates of the cache models", cxxopts::value<unsigned>()->default_value("10"))
+          ("call-stats", "Count the calls of each function symbol through jal, ie. of runtime routines such as __mulsi3, and print the instructions and cycles spent per call on exit", cxxopts::value<bool>()->default_value("false"))
+          ("coverage", "Write an lcov tracefile of the instructions and branch directions executed to the given file, and print the opcodes and scall numbers executed on exit", cxxopts::value<std::string>()->default_value(""))
+          ("fuzz", "Fuzz the input arguments against the host build of the program, given as a persistent harness (see tests/c/harness.cpp), guided by coverage, and print the minimized inputs on which the results differ. --max-instr and --timeout apply to each run, with a default of 10000000 instructions", cxxopts::value<std::string>()->default_value(""))
+          ("fuzz-runs", "Number of runs when fuzzing", cxxopts::value<uint64_t>()->default_value("100000"))
+          ("fuzz-inputs", "Semicolon separated list of initial inputs when fuzzing, each given like --argv (default: --argv)", cxxopts::value<std::string>()->default_value(""))
+          ("fuzz-seed", "Seed of the random mutations when fuzzing", cxxopts::value<uint64_t>()->default_value("1"))
+          ("max-instr", "Stop after executing N instructions, with exit status 125", cxxopts::value<uint64_t>()->default_value("0"))
+          ("timeout", "Stop after N seconds of simulation, with exit status 124", cxxopts::value<double>()->default_value("0"))
+          ("dump-cfg", "Write the control flow graph of the program to the given file in Graphviz DOT format, and exit", cxxopts::value<std::string>()->default_value(""))
+          ("gdb", "Wait for a GDB remote connection on the given TCP port or Unix socket path", cxxopts::value<std::string>()->default_value(""))
+          ("uart-in", "File read by the UART instead of stdin", cxxopts::value<std::string>()->default_value(""))
+          ("io-file", "Comma separated list of files streamed to the program by file devices, the first at port 0x20 and each following one 8 ports after the previous", cxxopts::value<std::string>()->default_value(""))
+          ("cores", "Simulate a system of N cores running the program in a shared memory, each on its own thread", cxxopts::value<unsigned>()->default_value("1"))
+          ("quantum", "Number of instructions the cores of a multi-core system execute between synchronizations", cxxopts::value<uint64_t>()->default_value("1000"))
+          ;
+  // clang-format on
 }
 
-inline void itoa(unsigned v, char *buf) {
-  switch (v) {
-  case 0: {
-    *buf = '0';
-    return;
-  }
-  case 1: {
-    *buf = '1';
-    return;
+std::map<unsigned, MVT_S> parseInitRegState(const std::string &string) {
+  if (string.empty())
+    return std::map<unsigned, MVT_S>();
+
+  std::map<unsigned, MVT_S> state;
+  std::vector<std::string> pairs;
+  std::string tmp;
+  std::istringstream f(string);
+  while (std::getline(f, tmp, ',')) {
+    pairs.push_back(tmp);
   }
-  default: { assert("unknown value"); }
+
+  // parse pairs
+  for (auto &p : pairs) {
+    size_t pos = p.find(':');
+    unsigned reg = std::stoul(p.substr(0, pos));
+    p.erase(0, pos + 1);
+    MVT_S value = std::stoll(p);
+    state[reg] = value;
   }
-  return;
+  return state;
 }
 
-struct LerosOptions {
-  std::map<unsigned, MVT_S> initRegState;
-  std::string argv;
-  std::string filename;
-  bool onlyShowModifiedRegs;
-  bool printState;
-  bool dumpAccu;
-};
-
-class LerosSim {
-public:
-  LerosSim(const LerosOptions &opt) : m_options(opt) {
-    // PC entry position. Will be 0 for flat binary files, and set accordingly
-    // for ELF files, where relocations have been specified relative to the
-    // entry point
-    unsigned long entryPoint;
-
-    if (m_reader.load(opt.filename)) {
-      // Load ELF file
-      m_isELF = true;
-
-      entryPoint = m_reader.get_entry();
-
-      for (const ELFIO::section *section : m_reader.sections) {
-        const auto sectionStart = section->get_address();
-        const auto sectionEnd = sectionStart + section->get_size();
-        if (sectionStart != 0 || section->get_name() == ".text") {
-          if (section->get_name() == ".text") {
-            m_textSize = section->get_size();
-          }
-
-          const char *p = section->get_data();
-          if (p) {
-            for (int i = sectionStart; i < sectionEnd; i++) {
-              m_mem.write(i, *p, 1);
-              p++;
-            }
-          }
-        }
-      }
-    } else {
-      // Loading binary file
-      entryPoint = 0; // We always start at PC=0x0 for flat binary files
-      std::ifstream is(opt.filename, std::ifstream::binary);
-      assert(is.is_open() && "Could not open input file");
-
-      is.seekg(0, is.end);
-      m_textSize = is.tellg();
-      assert(m_textSize % 2 == 0 && "File must be 16-bit aligned");
-      is.seekg(0, is.beg);
-      char *buffer = new char[m_textSize];
-      is.read(buffer, m_textSize);
-      for (int i = 0; i < m_textSize; i++) {
-        m_mem.write(i, buffer[i], 1);
+std::vector<WatchRange> parseWatchRanges(const std::string &string) {
+  std::vector<WatchRange> ranges;
+  std::string item;
+  std::istringstream f(string);
+  while (std::getline(f, item, ',')) {
+    if (item.empty())
+      continue;
+
+    WatchRange range;
+    range.kind = WatchKind::Write;
+    const size_t colon = item.find(':');
+    if (colon != std::string::npos) {
+      const std::string kind = item.substr(colon + 1);
+      if (kind == "r") {
+        range.kind = WatchKind::Read;
+      } else if (kind == "rw") {
+        range.kind = WatchKind::Access;
+      } else if (kind != "w") {
+        throw cxxopts::OptionException("Invalid watch kind '" + kind + "'");
       }
-      delete[] buffer;
+      item.erase(colon);
     }
 
-    m_entryPoint = entryPoint;
-
-    reset();
-
-    // Load register state
-    for (const auto &p : opt.initRegState) {
-      m_reg[p.first] = p.second;
+    const size_t dash = item.find('-');
+    if (item[0] == '.') {
+      range.section = item;
+      range.start = range.len = 0;
+    } else if (dash != std::string::npos) {
+      range.start = std::stoull(item.substr(0, dash), nullptr, 0);
+      range.len = std::stoull(item.substr(dash + 1), nullptr, 0) - range.start;
+    } else {
+      throw cxxopts::OptionException("Invalid watch range '" + item + "'");
     }
+    ranges.push_back(range);
   }
+  return ranges;
+}
 
-  bool isModified(unsigned reg) {
-    return m_modifiedRegs.find(reg) != m_modifiedRegs.end();
-  }
-
-  void setModified(unsigned reg) { m_modifiedRegs.insert(reg); }
+std::vector<CacheConfig> parseCacheConfigs(const std::string &string,
+                                           unsigned missPenalty) {
+  std::vector<CacheConfig> configs;
+  std::string item;
+  std::istringstream f(string);
+  while (std::getline(f, item, ';')) {
+    if (item.empty())
+      continue;
+
+    std::vector<std::string> fields;
+    std::istringstream g(item);
+    for (std::string field; std::getline(g, field, ':');) {
+      fields.push_back(field);
+    }
+    if (fields.size() < 3) {
+      throw cxxopts::OptionException("Invalid cache '" + item + "'");
+    }
 
-  // Print registers
-  void printState() {
-    // Always display R4 state
-    setModified(4);
-    for (unsigned i = 0; i < 256; i++) {
-      if (m_options.onlyShowModifiedRegs) {
-        if (!isModified(i))
-          continue;
+    CacheConfig config;
+    try {
+      size_t pos;
+      config.size = std::stoul(fields[0], &pos, 0);
+      if (fields[0].substr(pos) == "k") {
+        config.size *= 1024;
+      } else if (pos != fields[0].size()) {
+        throw std::invalid_argument(fields[0]);
       }
-      std::cout << i << ":" << m_reg[i] << " ";
+      config.ways = std::stoul(fields[1], nullptr, 0);
+      config.lineSize = std::stoul(fields[2], nullptr, 0);
+    } catch (const std::logic_error &) {
+      throw cxxopts::OptionException("Invalid cache '" + item + "'");
     }
-    std::cout << std::endl;
-    std::cout << "ACC: " << m_acc << std::endl;
-    std::cout << "ADDR: " << m_addr << std::endl;
-    std::cout << "PC: " << m_pc << std::endl;
-    std::cout << "INSTRUCTIONS EXECUTED: " << m_instructionsExecuted
-              << std::endl;
-  }
-
-  // Print accu
-  void printAccu() {
-    printf("%08x\n", m_acc);
+    for (size_t i = 3; i < fields.size(); i++) {
+      const std::string &field = fields[i];
+      if (field == "lru") {
+        config.replacement = CacheReplacement::LRU;
+      } else if (field == "fifo") {
+        config.replacement = CacheReplacement::FIFO;
+      } else if (field == "random") {
+        config.replacement = CacheReplacement::Random;
+      } else if (field == "wb" || field == "wt") {
+        config.writeBack = field == "wb";
+      } else if (field == "d" || field == "i" || field == "id") {
+        config.data = field != "i";
+        config.instructions = field != "d";
+      } else {
+        throw cxxopts::OptionException("Invalid cache option '" + field +
+                                       "'");
+      }
+    }
+    config.missPenalty = missPenalty;
+    if (!config.valid()) {
+      throw cxxopts::OptionException(
+          "Invalid cache '" + item +
+          "', sizes must be powers of two holding at least one set");
+    }
+    configs.push_back(config);
   }
+  return configs;
+}
 
-  void reset() {
-    for (auto &r : m_reg) {
-      r = 0;
-    }
-    m_acc = 0;
-    m_addr = 0;
-    m_pc = m_entryPoint;
-
-    if (m_isELF) {
-      // Insert the input arguments into memory
-      std::istringstream f(m_options.argv);
-      std::string buf;
-      int i = 0;
-      while (getline(f, buf, ' ')) {
-        auto argValue = static_cast<uint32_t>(atoi(buf.c_str()));
-        m_mem.write(ARGV_START + i * sizeof(int), argValue, 4);
-        i++;
+// Print the statistics of the cache models, with the functions missing most
+// in each. The cycle estimates add the stalls of each cache on its own to the
+// cycles of the timing model.
+void printCacheProfile(const LerosSim &sim, std::ostream &os,
+                       unsigned n = 10) {
+  ControlFlowGraph cfg;
+  cfg.build(sim.image());
+  const auto &functions = cfg.functions();
+  for (const Cache &cache : sim.caches()) {
+    const CacheStats &stats = cache.stats();
+    const uint64_t cycles = sim.cycles() + cache.stallCycles();
+    os << "Cache " << cache.config().name() << ": " << stats.accesses()
+       << " accesses, " << stats.misses() << " misses ("
+       << (stats.accesses() ? 100.0 * stats.misses() / stats.accesses() : 0)
+       << "%), " << stats.readMisses << " read misses, " << stats.writebacks
+       << " write-backs, " << stats.writeThroughs << " write-throughs, "
+       << cycles << " cycles (IPC "
+       << double(sim.instructionsExecuted()) / cycles << ")" << std::endl;
+
+    // Code outside of any function is counted last
+    std::vector<uint64_t> accesses(functions.size() + 1);
+    std::vector<uint64_t> misses(functions.size() + 1);
+    for (size_t slot = 0; slot < cache.slotAccesses().size(); slot++) {
+      if (cache.slotAccesses()[slot] == 0) {
+        continue;
       }
+      const int f = cfg.functionAt(sim.execStart() + slot * ILEN);
+      const size_t i = f >= 0 ? f : functions.size();
+      accesses[i] += cache.slotAccesses()[slot];
+      misses[i] += cache.slotMisses()[slot];
+    }
 
-      // Set argc/argv
-      m_reg[4] = i;
-      m_reg[5] = ARGV_START;
+    std::vector<std::pair<uint64_t, size_t>> order;
+    for (size_t i = 0; i < misses.size(); i++) {
+      if (misses[i] != 0) {
+        order.push_back({misses[i], i});
+      }
+    }
+    std::sort(order.rbegin(), order.rend());
+    if (order.size() > n) {
+      order.resize(n);
     }
+    for (const auto &o : order) {
+      const size_t i = o.second;
+      os << "  "
+         << (i < functions.size() ? functions[i].name : "(no function)")
+         << ": " << misses[i] << " misses of " << accesses[i]
+         << " accesses (" << 100.0 * misses[i] / accesses[i] << "%)"
+         << std::endl;
+    }
+  }
+}
 
-    // Set the stack pointer to a default value
-    m_reg[1] = 0x7FFFFFF0;
+// Write the coverage of the program, merged from the given simulators, as an
+// lcov tracefile and print its summary
+bool reportCoverage(const std::vector<const LerosSim *> &sims,
+                    const std::string &program, const std::string &path,
+                    std::ostream &os) {
+  const LerosSim &sim = *sims.front();
+  Coverage coverage(sim.execSlots());
+  for (const LerosSim *s : sims) {
+    coverage.merge(s->coverage());
+  }
+  ControlFlowGraph cfg;
+  cfg.build(sim.image());
+  CoverageTotals totals;
+  countCoverage(coverage, cfg, sim.execStart(), totals);
+  printCoverageSummary(os, coverage, totals);
+  if (!writeLcovFile(path, {{program, &coverage, &cfg, sim.execStart()}})) {
+    std::cerr << "Could not write '" << path << "'" << std::endl;
+    return false;
   }
+  return true;
+}
 
-  int clock() {
-    m_instructionsExecuted++;
-    uint16_t instr = m_mem.read(m_pc) & 0xFFFF;
+// Print the cycles counted by the timing model, in total and per function
+void printTimingProfile(const LerosSim &sim, std::ostream &os,
+                        unsigned n = 20) {
+  ControlFlowGraph cfg;
+  cfg.build(sim.image());
+  const auto &functions = cfg.functions();
+  // Code outside of any function is counted last
+  std::vector<uint64_t> cycles(functions.size() + 1);
+  std::vector<uint64_t> instrs(functions.size() + 1);
+  for (size_t slot = 0; slot < sim.slotCycles().size(); slot++) {
+    if (sim.slotInstructions()[slot] == 0) {
+      continue;
+    }
+    const int f = cfg.functionAt(sim.execStart() + slot * ILEN);
+    const size_t i = f >= 0 ? f : functions.size();
+    cycles[i] += sim.slotCycles()[slot];
+    instrs[i] += sim.slotInstructions()[slot];
+  }
 
-    // Constrain simulator to only run instructions in the .text segment
-    if (m_pc >= m_entryPoint && m_pc <= m_entryPoint + m_textSize) {
-      m_trace.insert(m_trace.begin(), m_pc);
-      if (m_trace.size() > m_traceSize)
-        m_trace.pop_back();
-      return execInstr(instr);
-    } else {
-      return 1;
+  std::vector<std::pair<uint64_t, size_t>> order;
+  for (size_t i = 0; i < cycles.size(); i++) {
+    if (instrs[i] != 0) {
+      order.push_back({cycles[i], i});
     }
   }
+  std::sort(order.rbegin(), order.rend());
+  if (order.size() > n) {
+    order.resize(n);
+  }
+  os << "Cycles: " << sim.cycles() << " (IPC "
+     << double(sim.instructionsExecuted()) / sim.cycles() << ")" << std::endl;
+  for (const auto &o : order) {
+    const size_t i = o.second;
+    os << "  " << (i < functions.size() ? functions[i].name : "(no function)")
+       << ": " << cycles[i] << " cycles, " << instrs[i]
+       << " instructions, IPC " << double(instrs[i]) / cycles[i] << " ("
+       << 100.0 * cycles[i] / sim.cycles() << "%)" << std::endl;
+  }
+}
 
-private:
-  LerosInstr decodeInstr(uint8_t opcode) {
-    const uint8_t bOpcode = opcode >> 4;
+// Run the program on a multi-core system, and return the exit status like
+// main()
+int runMultiCore(const LerosOptions &opt, unsigned cores, uint64_t quantum,
+                 uint64_t maxInstructions, double timeout,
+                 const std::string &coveragePath) {
+  MultiCoreSim system(opt, cores);
+  if (!system.loaded()) {
+    std::cerr << "Could not open input file '" << opt.filename << "'"
+              << std::endl;
+    return 1;
+  }
 
-    // clang-format off
-    switch (bOpcode) {
-    default: break;
-    case 0b1000: return LerosInstr::br;
-    case 0b1001: return LerosInstr::brz;
-    case 0b1010: return LerosInstr::brnz;
-    case 0b1011: return LerosInstr::brp;
-    case 0b1100: return LerosInstr::brn;
-    }
+  const auto start = std::chrono::steady_clock::now();
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (timeout > 0) {
+    deadline = start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::duration<double>(timeout));
+  }
+  system.run(quantum, maxInstructions, deadline);
+
+  if (opt.stats) {
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Executed " << system.instructionsExecuted()
+              << " instructions on " << cores << " cores in "
+              << elapsed.count() << " s ("
+              << system.instructionsExecuted() / elapsed.count() / 1e6
+              << " MIPS)" << std::endl;
+  }
 
-    switch(opcode){
-    default: assert(false && "Could not match opcode");
-    case 0x0: return LerosInstr::nop;
-    case 0x08: return LerosInstr::add;
-    case 0x09: return LerosInstr::addi;
-    case 0x0c: return LerosInstr::sub;
-    case 0x0d: return LerosInstr::subi;
-    case 0x10: return LerosInstr::sra;
-    case 0x20: return LerosInstr::load;
-    case 0x21: return LerosInstr::loadi;
-    case 0x22: return LerosInstr::And;
-    case 0x23: return LerosInstr::Andi;
-    case 0x24: return LerosInstr::Or;
-    case 0x25: return LerosInstr::Ori;
-    case 0x26: return LerosInstr::Xor;
-    case 0x27: return LerosInstr::Xori;
-    case 0x29: return LerosInstr::loadhi;
-    case 0x2a: return LerosInstr::loadh2i;
-    case 0x2b: return LerosInstr::loadh3i;
-    case 0x30: return LerosInstr::store;
-    case 0x39: return LerosInstr::out;
-    case 0x05: return LerosInstr::in;
-    case 0x40: return LerosInstr::jal;
-    case 0x50: return LerosInstr::ldaddr;
-    case 0x60: return LerosInstr::ldind;
-    case 0x61: return LerosInstr::ldindb;
-    case 0x62: return LerosInstr::ldindh;
-    case 0x70: return LerosInstr::stind;
-    case 0x71: return LerosInstr::stindb;
-    case 0x72: return LerosInstr::stindh;
-    case 0xff: return LerosInstr::scall;
+  int status = 0;
+  for (unsigned i = 0; i < system.numCores(); i++) {
+    LerosSim &core = system.core(i);
+    if (system.status(i) == SimRetval::INSTRUCTION_LIMIT) {
+      std::cerr << "Core " << i << " stopped at instruction limit of "
+                << maxInstructions << " (PC 0x" << std::hex << core.getPC()
+                << std::dec << ")" << std::endl;
+      status = 125;
+    } else if (system.status(i) == SimRetval::TIMEOUT) {
+      std::cerr << "Core " << i << " stopped at timeout of " << timeout
+                << " s after " << core.instructionsExecuted()
+                << " instructions (PC 0x" << std::hex << core.getPC()
+                << std::dec << ")" << std::endl;
+      status = status != 0 ? status : 124;
     }
-    // clang-format on
-
-    return LerosInstr::unknown;
-  }
-
-  int execInstr(uint16_t instr) {
-    const uint8_t uimm8 = instr & 0xFF;
-    const int simm8 = signextend<int, 8>(instr);
-    const int simm13lsb0 = signextend<int, 13>(instr << 1);
-    const LerosInstr inst = decodeInstr((instr >> 8) & 0xFF);
-
-    // clang-format off
-    switch (inst) {
-    default:
-    case LerosInstr::unknown: assert("Unknown instruction"); break;
-    case LerosInstr::nop: break;
-    case LerosInstr::addi: m_acc += simm8; break;
-    case LerosInstr::add:  m_acc += m_reg[uimm8]; break;
-    case LerosInstr::subi: m_acc -= simm8; break;
-    case LerosInstr::sub:  m_acc -= m_reg[uimm8]; break;
-    case LerosInstr::sra: {
-      m_acc >>= 1;
-      break;
+    if (opt.timing) {
+      std::cerr << "Core " << i << " ";
+      printTimingProfile(core, std::cerr);
     }
-    case LerosInstr::loadi:  m_acc = simm8; break;
-    case LerosInstr::load:   m_acc = m_reg[uimm8]; break;
-    case LerosInstr::Andi:   m_acc &= uimm8; break;
-    case LerosInstr::And:    m_acc &= m_reg[uimm8]; break;
-    case LerosInstr::Ori:    m_acc |= uimm8; break;
-    case LerosInstr::Or:     m_acc |= m_reg[uimm8]; break;
-    case LerosInstr::Xori:   m_acc ^= uimm8; break;
-    case LerosInstr::Xor:    m_acc ^= m_reg[uimm8]; break;
-    case LerosInstr::loadhi:  m_acc = (m_acc & 0xff) | simm8 << 8;  break;
-    case LerosInstr::loadh2i: m_acc = (m_acc & 0xffff) | simm8 << 16; break;
-    case LerosInstr::loadh3i: m_acc = (m_acc & 0xffffff) | simm8 << 24; break;
-#ifdef LEROS64
-    case LerosInstr::loadh4i: m_acc = (m_acc & 0xffffffff) | imm << 32; break;
-    case LerosInstr::loadh5i: m_acc = (m_acc & 0xffffffffff) | imm << 40; break;
-    case LerosInstr::loadh6i: m_acc = (m_acc & 0xffffffffffff) | imm << 48; break;
-    case LerosInstr::loadh7i: m_acc = (m_acc & 0xffffffffffffff) | imm << 56; break;
-#endif
-    case LerosInstr::store: {
-        m_reg[uimm8] = m_acc;
-        setModified(uimm8);
-      break;
+    if (!opt.caches.empty()) {
+      std::cerr << "Core " << i << ":" << std::endl;
+      printCacheProfile(core, std::cerr);
     }
-    case LerosInstr::out: assert("Unimplemented"); break;
-    case LerosInstr::in: assert("Unimplemented"); break;
-    case LerosInstr::jal: {
-      if (m_acc > m_entryPoint + m_textSize) {
-        assert("Executing code outside of .text segment");
-      }
-      m_reg[uimm8] = m_pc + ILEN; // Store PC + 2 bytes
-      setModified(uimm8);
-      m_pc = static_cast<uint32_t>(m_acc);
-      return ALL_OK;
-    }
-    case LerosInstr::br: m_pc += simm13lsb0; return ALL_OK;
-    case LerosInstr::brz: {
-      if (m_acc == 0) {
-        m_pc += simm13lsb0;
-        return ALL_OK;
-      }
-      break;
-    }
-    case LerosInstr::brnz: {
-      if (m_acc != 0) {
-        m_pc += simm13lsb0;
-        return ALL_OK;
-      }
-      break;
+    if (opt.callStats) {
+      std::cerr << "Core " << i << " ";
+      printCallProfile(std::cerr, core.calls(), core.instructionsExecuted());
     }
-    case LerosInstr::brp: {
-      if (m_acc >= 0) {
-        m_pc += simm13lsb0;
-        return ALL_OK;
-      }
-      break;
-    }
-    case LerosInstr::brn: {
-      if (m_acc < 0) {
-        m_pc += simm13lsb0;
-        return ALL_OK;
-      }
-      break;
+    if (opt.printState) {
+      std::cout << "CORE " << i << ":" << std::endl;
+      core.printState();
     }
-    case LerosInstr::ldaddr: m_addr = m_reg[uimm8]; break;
-    case LerosInstr::ldind: {
-      const auto addr = (m_addr + (simm8 << 2));
-      const auto value = static_cast<MVT_S>(m_mem.read(addr));
-      m_acc = value;
-      break;
-    }
-    case LerosInstr::ldindb: m_acc = signextend<int,8>(m_mem.read(m_addr + simm8)); break;
-    case LerosInstr::ldindh: m_acc = signextend<int,16>(m_mem.read(m_addr + (simm8 << 1))); break;
+  }
 
-    case LerosInstr::stind:{
-        const auto addr = (m_addr + (simm8 << 2));
-        m_mem.write(addr, m_acc, 4);
-        break;
-    }
-    case LerosInstr::stindb: m_mem.write((m_addr + simm8), m_acc & 0xFF, 1); break;
-    case LerosInstr::stindh: m_mem.write((m_addr + (simm8 << 1)), m_acc & 0xFFFF, 2); break;
-    case LerosInstr::scall: {
-      switch (uimm8) {
-      default:
-      case 0:
-        return SCALL;
-      case 1:
-        m_reg[4] = m_instructionsExecuted;
-        break;
-      case 2:
-        std::cout << static_cast<char>(m_acc);
-        std::cout.flush();
-        break;
-      }
+  // The cores run the same program, so their coverage is merged
+  if (opt.coverage) {
+    std::vector<const LerosSim *> sims;
+    for (unsigned i = 0; i < system.numCores(); i++) {
+      sims.push_back(&system.core(i));
     }
+    if (!reportCoverage(sims, opt.filename, coveragePath, std::cerr)) {
+      status = status != 0 ? status : 1;
     }
-    // clang-format on
-
-    m_pc += ILEN;
-    return ALL_OK;
-  }
-
-  std::set<unsigned> m_modifiedRegs;
-  MainMemoryTemplate<uint32_t, uint32_t> m_mem;
-  std::array<MVT_S, 256> m_reg;
-  std::vector<uint32_t> m_trace;
-  const int m_traceSize =
-      100; // record the 100 most recent PC's during execution
-  MVT_S m_acc = 0;
-  MVT m_addr = 0;
-  MVT m_pc = 0;
-  MVT m_entryPoint;
-  int m_textSize;
-  int m_instructionsExecuted = 0;
-  bool m_isELF = false;
-  ELFIO::elfio m_reader;
-
-  LerosOptions m_options;
-};
-
-void setupOptions(cxxopts::Options &options) {
-  // clang-format off
-  options.add_options()
-          ("f,file", "File name - Required", cxxopts::value<std::string>())
-          ("ps", "Print simulator state after simulation", cxxopts::value<bool>()->default_value("false"))
-          ("d", "Dump accumulator after each instruction", cxxopts::value<bool>()->default_value("false"))
-          ("osmr", "Only show modified registers in printout (implicitely enables --ps)", cxxopts::value<bool>()->default_value("false"))
-          ("rs", "Initial register staet, commaseparated list of format '0:2,4:10,...", cxxopts::value<std::string>()->default_value(""))
-          ("argv", "Input argument(s) for C programs with a main(argc, argv) function, specified as a string \"1 2 foo bar\"", cxxopts::value<std::string>()->default_value(""))
-          ;
-  // clang-format on
+  }
+  return status;
 }
 
-std::map<unsigned, MVT_S> parseInitRegState(const std::string &string) {
-  if (string.empty())
-    return std::map<unsigned, MVT_S>();
-
-  std::map<unsigned, MVT_S> state;
-  std::vector<std::string> pairs;
-  std::string tmp;
-  std::istringstream f(string);
-  while (std::getline(f, tmp, ',')) {
-    pairs.push_back(tmp);
+// Fuzz the input arguments of the loaded program against 'host' starting from
+// 'inputs', and return the exit status like main(): 1 if failures were found
+int runFuzzer(LerosSim &sim, const std::string &host,
+              const std::vector<std::vector<int64_t>> &inputs,
+              const FuzzOptions &options) {
+  if (access(host.c_str(), X_OK) != 0) {
+    std::cerr << "Could not run host harness '" << host << "'" << std::endl;
+    return 1;
+  }
+  HostHarness harness(host);
+  Fuzzer fuzzer(sim, harness, options);
+  for (const auto &input : inputs) {
+    fuzzer.addInput(input);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  fuzzer.run();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  ControlFlowGraph cfg;
+  cfg.build(sim.image());
+  CoverageTotals totals;
+  countCoverage(fuzzer.coverage(), cfg, sim.execStart(), totals);
+  std::cout << "Fuzzed " << fuzzer.runs() << " runs in " << elapsed.count()
+            << " s (" << fuzzer.runs() / elapsed.count()
+            << " runs/s), corpus of " << fuzzer.corpus().size() << " inputs"
+            << std::endl;
+  std::cout << "Covered " << totals.linesHit << " of " << totals.lines
+            << " instructions and " << totals.branchesHit << " of "
+            << totals.branches << " branch directions" << std::endl;
+  if (fuzzer.overBudget() != 0 || fuzzer.hostErrors() != 0) {
+    std::cout << fuzzer.overBudget() << " runs exceeded the budget, "
+              << fuzzer.hostErrors() << " failed in the host build"
+              << std::endl;
   }
 
-  // parse pairs
-  for (auto &p : pairs) {
-    size_t pos = p.find(':');
-    unsigned reg = std::stoul(p.substr(0, pos));
-    p.erase(0, pos + 1);
-    int value = std::stoi(p);
-    state[reg] = value;
+  const auto argvString = [](const std::vector<int64_t> &argv) {
+    std::string s;
+    for (int64_t arg : argv) {
+      s += (s.empty() ? "" : " ") + std::to_string(arg);
+    }
+    return s;
+  };
+  for (const auto &failure : fuzzer.failures()) {
+    std::cout << "FAIL (ARG: " << argvString(failure.argv) << "): ";
+    if (failure.stop == SimRetval::SCALL ||
+        failure.stop == SimRetval::JAL_RA_EXIT) {
+      std::cout << "Expected: " << failure.expected
+                << "    Actual: " << failure.actual;
+    } else {
+      std::cout << "Stopped with status " << failure.stop;
+    }
+    if (failure.argv != failure.original) {
+      std::cout << " (minimized from ARG: " << argvString(failure.original)
+                << ")";
+    }
+    std::cout << std::endl;
   }
-  return state;
+  return fuzzer.failures().empty() ? 0 : 1;
 }
 
 int main(int argc, char *argv[]) {
@@ -472,6 +439,15 @@ int main(int argc, char *argv[]) {
   }
 
   std::string filename;
+  std::string dumpCfg;
+  std::string coveragePath;
+  std::string fuzzHost;
+  std::vector<std::vector<int64_t>> fuzzInputs;
+  FuzzOptions fuzzOptions;
+  uint64_t maxInstructions;
+  double timeout;
+  unsigned cores;
+  uint64_t quantum;
   try {
     auto result = options.parse(argc, argv);
     opt.filename = result["f"].as<std::string>();
@@ -483,22 +459,186 @@ int main(int argc, char *argv[]) {
     }
     opt.initRegState = parseInitRegState(result["rs"].as<std::string>());
     opt.argv = result["argv"].as<std::string>();
+    opt.gdb = result["gdb"].as<std::string>();
+    opt.watches = parseWatchRanges(result["watch"].as<std::string>());
+    opt.accessLogSize = result["watch-log"].as<unsigned>();
+    opt.sanitize = result["sanitize"].as<bool>();
+    opt.stats = result["stats"].as<bool>();
+    const std::string engine = result["engine"].as<std::string>();
+    if (engine == "switch") {
+      opt.engine = LerosEngine::Switch;
+    } else if (engine == "predecoded") {
+      opt.engine = LerosEngine::Predecoded;
+    } else if (engine != "block") {
+      throw cxxopts::OptionException("Invalid engine '" + engine + "'");
+    }
+    opt.uartInput = result["uart-in"].as<std::string>();
+    std::istringstream ioFiles(result["io-file"].as<std::string>());
+    for (std::string file; std::getline(ioFiles, file, ',');) {
+      if (!file.empty()) {
+        opt.ioFiles.push_back(file);
+      }
+    }
+    opt.fuse = !result["no-fuse"].as<bool>();
+    opt.profilePairs = result["profile-pairs"].as<bool>();
+    opt.timing = result["timing"].as<bool>();
+    opt.callStats = result["call-stats"].as<bool>();
+    opt.timingConfig.stages = std::max(1u, result["pipeline-stages"].as<unsigned>());
+    opt.timingConfig.branchPenalty = result["branch-penalty"].as<unsigned>();
+    opt.timingConfig.loadWaitStates = result["load-wait"].as<unsigned>();
+    opt.timingConfig.storeWaitStates = result["store-wait"].as<unsigned>();
+    opt.caches = parseCacheConfigs(result["cache"].as<std::string>(),
+                                   result["cache-miss-penalty"].as<unsigned>());
+    dumpCfg = result["dump-cfg"].as<std::string>();
+    coveragePath = result["coverage"].as<std::string>();
+    opt.coverage = !coveragePath.empty();
+    maxInstructions = result["max-instr"].as<uint64_t>();
+    timeout = result["timeout"].as<double>();
+    fuzzHost = result["fuzz"].as<std::string>();
+    if (!fuzzHost.empty()) {
+      // Coverage guides the fuzzer
+      opt.coverage = true;
+      const auto parseInput = [](const std::string &input) {
+        std::istringstream args(input);
+        std::vector<int64_t> argv;
+        for (std::string arg; args >> arg;) {
+          argv.push_back(atoll(arg.c_str()));
+        }
+        return argv;
+      };
+      std::istringstream inputs(result["fuzz-inputs"].as<std::string>());
+      for (std::string input; std::getline(inputs, input, ';');) {
+        fuzzInputs.push_back(parseInput(input));
+      }
+      if (fuzzInputs.empty()) {
+        fuzzInputs.push_back(parseInput(opt.argv));
+      }
+      fuzzOptions.runs = result["fuzz-runs"].as<uint64_t>();
+      fuzzOptions.seed = result["fuzz-seed"].as<uint64_t>();
+      if (maxInstructions != 0) {
+        fuzzOptions.maxInstructions = maxInstructions;
+      }
+      fuzzOptions.timeout = timeout;
+    }
+    cores = result["cores"].as<unsigned>();
+    quantum = result["quantum"].as<uint64_t>();
+    if (cores > 1 && (!opt.gdb.empty() || !opt.watches.empty() ||
+                      opt.sanitize || opt.dumpAccu || opt.profilePairs)) {
+      throw cxxopts::OptionException(
+          "--cores does not support debugging, watches, --sanitize, -d or "
+          "--profile-pairs");
+    }
   } catch (cxxopts::OptionException e) {
     std::cout << e.what() << std::endl;
     return 1;
   }
 
   LerosSim sim(opt);
+  if (!sim.loaded()) {
+    std::cerr << "Could not open input file '" << opt.filename << "'"
+              << std::endl;
+    return 1;
+  }
+
+  if (!dumpCfg.empty()) {
+    ControlFlowGraph cfg;
+    cfg.build(sim.image());
+    std::ofstream out(dumpCfg);
+    cfg.dumpDot(out);
+    return out ? 0 : 1;
+  }
+
+  if (!fuzzHost.empty()) {
+    return runFuzzer(sim, fuzzHost, fuzzInputs, fuzzOptions);
+  }
+
+  if (cores > 1) {
+    return runMultiCore(opt, cores, quantum, maxInstructions, timeout,
+                        coveragePath);
+  }
+
+  if (!opt.gdb.empty()) {
+    GdbServer server(sim);
+    if (!server.listen(opt.gdb))
+      return 1;
+    if (!server.serve())
+      return 0;
+  }
 
-  while (sim.clock() == SimRetval::ALL_OK) {
-    // Clock until return != ALL_OK
-    if (opt.dumpAccu)
+  const auto start = std::chrono::steady_clock::now();
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (timeout > 0) {
+    deadline = start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::duration<double>(timeout));
+  }
+  int retval;
+  if (opt.dumpAccu) {
+    while ((retval = sim.run(1, deadline)) == SimRetval::INSTRUCTION_LIMIT) {
+      // Step until the program stops
       sim.printAccu();
+      if (maxInstructions != 0 && sim.instructionsExecuted() >= maxInstructions)
+        break;
+    }
+  } else {
+    retval = sim.run(maxInstructions, deadline);
+  }
+
+  if (opt.stats) {
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Executed " << sim.instructionsExecuted() << " instructions in "
+              << elapsed.count() << " s ("
+              << sim.instructionsExecuted() / elapsed.count() / 1e6
+              << " MIPS)" << std::endl;
+  }
+
+  if (opt.profilePairs)
+    sim.printPairProfile(std::cerr);
+
+  if (opt.timing)
+    printTimingProfile(sim, std::cerr);
+
+  if (!opt.caches.empty())
+    printCacheProfile(sim, std::cerr);
+
+  if (opt.callStats)
+    printCallProfile(std::cerr, sim.calls(), sim.instructionsExecuted());
+
+  if (opt.coverage && !reportCoverage({&sim}, opt.filename, coveragePath,
+                                      std::cerr))
+    return 1;
+
+  sim.printAccessLog(std::cerr);
+  if (retval == SimRetval::WATCHPOINT) {
+    sim.printWatchHit(std::cerr);
+    return 1;
+  }
+
+  // Runs stopped by a budget are distinguishable by their exit status
+  int status = 0;
+  if (retval == SimRetval::INSTRUCTION_LIMIT) {
+    std::cerr << "Stopped at instruction limit of " << maxInstructions
+              << " (PC 0x" << std::hex << sim.getPC() << std::dec << ")"
+              << std::endl;
+    status = 125;
+  } else if (retval == SimRetval::TIMEOUT) {
+    std::cerr << "Stopped at timeout of " << timeout << " s after "
+              << sim.instructionsExecuted() << " instructions (PC 0x"
+              << std::hex << sim.getPC() << std::dec << ")" << std::endl;
+    status = 124;
   }
 
   // Show the state of the processor
   if (opt.printState)
     sim.printState();
 
-  return 0;
+  if (status != 0)
+    return status;
+
+  // Like other sanitizers, fail the run if any invalid accesses were reported
+  if (sim.sanitizerReports() != 0)
+    return 1;
+
+  // Programs stopped by the exit system call exit with their exit code
+  return sim.exited() ? static_cast<int>(sim.exitCode() & 0xff) : 0;
 }
@@ -0,0 +1,2245 @@
+#ifndef LEROS_SIM_H
+#define LEROS_SIM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <assert.h>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "cache.h"
+#include "callprofile.h"
+#include "coverage.h"
+#include "elfio/elf_types.hpp"
+#include "iobus.h"
+#include "pagedmemory.h"
+#include "programimage.h"
+
+#ifdef LEROS64
+#define MVT uint64_t
+#define MVT_S int64_t
+#define XLen 64
+#else
+#define MVT uint32_t
+#define MVT_S int32_t
+#define XLen 32
+#endif
+
+#define ILEN 2 // instruction length in bytes
+
+// Size of a word in bytes, and the shift applied to word sized ldind/stind
+// offsets
+#define WORDSIZE (XLen / 8)
+#define WORDSHIFT (XLen == 64 ? 3 : 2)
+
+// Position in memory where we place input arguments, used for running main()
+// programs with integer arguments
+#define ARGV_START 0x8ffffff0
+
+// Initial stack pointer, and the size of the stack region assumed by the memory
+// sanitizer
+#define STACK_START 0x7FFFFFF0
+#define STACK_SIZE 0x100000
+
+enum class LerosInstr {
+  nop,
+  add,
+  addi,
+  sub,
+  subi,
+  sra,
+  load,
+  loadi,
+  And,
+  Andi,
+  Or,
+  Ori,
+  Xor,
+  Xori,
+  loadhi,
+  loadh2i,
+  loadh3i,
+#ifdef LEROS64
+  loadh4i,
+  loadh5i,
+  loadh6i,
+  loadh7i,
+#endif
+  store,
+  out,
+  in,
+  jal,
+  br,
+  brz,
+  brnz,
+  brp,
+  brn,
+  ldaddr,
+  ldind,
+  ldindb,
+  ldindh,
+  stind,
+  stindb,
+  stindh,
+  scall,
+  unknown,
+
+  // Superinstructions, only produced by the predecoder for common sequences of
+  // the instructions above
+  fused_loadconst,      // loadi, loadhi[, loadh2i...]
+  fused_loadi_br,       // loadi, brz/brnz (resolved when decoding)
+  fused_load_brz,       // load, brz
+  fused_load_brnz,      // load, brnz
+  fused_load_add_store, // load, add, store
+  fused_load_sub_store, // load, sub, store
+  fused_load_addi_store, // load, addi/subi, store
+  fused_ldaddr_ldind,   // ldaddr, ldind
+  fused_ldaddr_stind,   // ldaddr, stind
+  NumLerosInstrs
+};
+
+// Number of architectural instructions (excluding superinstructions)
+#define NUM_BASE_INSTRS (static_cast<unsigned>(LerosInstr::unknown) + 1)
+
+// Maximum number of instructions combined into a superinstruction
+#define MAX_FUSED_LEN (XLen / 8)
+
+inline const char *instrName(LerosInstr instr) {
+  // clang-format off
+  switch (instr) {
+  case LerosInstr::nop: return "nop";
+  case LerosInstr::add: return "add";
+  case LerosInstr::addi: return "addi";
+  case LerosInstr::sub: return "sub";
+  case LerosInstr::subi: return "subi";
+  case LerosInstr::sra: return "sra";
+  case LerosInstr::load: return "load";
+  case LerosInstr::loadi: return "loadi";
+  case LerosInstr::And: return "and";
+  case LerosInstr::Andi: return "andi";
+  case LerosInstr::Or: return "or";
+  case LerosInstr::Ori: return "ori";
+  case LerosInstr::Xor: return "xor";
+  case LerosInstr::Xori: return "xori";
+  case LerosInstr::loadhi: return "loadhi";
+  case LerosInstr::loadh2i: return "loadh2i";
+  case LerosInstr::loadh3i: return "loadh3i";
+#ifdef LEROS64
+  case LerosInstr::loadh4i: return "loadh4i";
+  case LerosInstr::loadh5i: return "loadh5i";
+  case LerosInstr::loadh6i: return "loadh6i";
+  case LerosInstr::loadh7i: return "loadh7i";
+#endif
+  case LerosInstr::store: return "store";
+  case LerosInstr::out: return "out";
+  case LerosInstr::in: return "in";
+  case LerosInstr::jal: return "jal";
+  case LerosInstr::br: return "br";
+  case LerosInstr::brz: return "brz";
+  case LerosInstr::brnz: return "brnz";
+  case LerosInstr::brp: return "brp";
+  case LerosInstr::brn: return "brn";
+  case LerosInstr::ldaddr: return "ldaddr";
+  case LerosInstr::ldind: return "ldind";
+  case LerosInstr::ldindb: return "ldindb";
+  case LerosInstr::ldindh: return "ldindh";
+  case LerosInstr::stind: return "stind";
+  case LerosInstr::stindb: return "stindb";
+  case LerosInstr::stindh: return "stindh";
+  case LerosInstr::scall: return "scall";
+  case LerosInstr::fused_loadconst: return "loadi+loadhi";
+  case LerosInstr::fused_loadi_br: return "loadi+br";
+  case LerosInstr::fused_load_brz: return "load+brz";
+  case LerosInstr::fused_load_brnz: return "load+brnz";
+  case LerosInstr::fused_load_add_store: return "load+add+store";
+  case LerosInstr::fused_load_sub_store: return "load+sub+store";
+  case LerosInstr::fused_load_addi_store: return "load+addi+store";
+  case LerosInstr::fused_ldaddr_ldind: return "ldaddr+ldind";
+  case LerosInstr::fused_ldaddr_stind: return "ldaddr+stind";
+  default: return "unknown";
+  }
+  // clang-format on
+}
+
+// An instruction (or superinstruction) with its operands extracted. Immediates
+// are stored ready to use: shifted into place for loadh*i, scaled for
+// ldind/stind, and as absolute targets for branches.
+struct DecodedInstr {
+  LerosInstr op;
+  uint8_t len; // in instructions; 0 if not decoded yet
+  uint8_t reg;
+  uint8_t reg2;
+  uint8_t reg3;
+  MVT_S imm;
+  MVT target;
+};
+
+// Execution engines. The switch engine decodes every instruction as it is
+// executed, the predecoded engine caches decoded instructions per slot of the
+// executable segments and optionally fuses common sequences. The block engine
+// additionally executes whole basic blocks of predecoded instructions per
+// dispatch in run(), chaining directly to cached successor blocks.
+enum class LerosEngine { Switch, Predecoded, Block };
+
+// Parameters of the timing model. Every instruction issues in one cycle, and
+// taken branches and jal's, whose target is known in the last stage, flush the
+// instructions fetched behind them. Loads and stores additionally wait for the
+// on-chip memory.
+struct TimingConfig {
+  unsigned stages = 3; // fetch, decode, execute
+  unsigned branchPenalty = 2;
+  unsigned loadWaitStates = 0;
+  unsigned storeWaitStates = 0;
+};
+
+// Timing policies of the execution engines, which call instr() before each
+// instruction with a function returning its opcode, which the predecoded
+// engines compute only on demand, taken() for taken branches and jal's, notTaken() for branches
+// falling through, jal() with the target and link of jal's, load() and store()
+// with the address of memory accesses and scall() with the number of system
+// calls. NoTiming compiles to nothing, so
+// functional simulation does not pay for the timing model.
+struct NoTiming {
+  template <typename OpFn> void instr(MVT, const OpFn &) {}
+  void taken() {}
+  void notTaken() {}
+  void jal(MVT, MVT, uint64_t) {}
+  void load(MVT) {}
+  void store(MVT) {}
+  void scall(unsigned) {}
+};
+
+// Counts cycles according to a TimingConfig, in total and per instruction
+// slot of the executable segments, along with the instructions executed per
+// slot. Accesses are passed to the cache models as well; their misses do not
+// stall the pipeline here, so that any number of cache configurations can be
+// evaluated on the same execution (see Cache::stallCycles()). Coverage and
+// calls, if given, are recorded as well.
+class PipelineTiming {
+public:
+  PipelineTiming(const TimingConfig &config, uint64_t &cycles,
+                 uint64_t *slotCycles, uint64_t *slotInstrs, MVT execStart,
+                 std::vector<Cache> &caches, Coverage *coverage,
+                 CallProfile *calls)
+      : m_config(config), m_cycles(cycles), m_slotCycles(slotCycles),
+        m_slotInstrs(slotInstrs), m_execStart(execStart), m_caches(caches),
+        m_coverage(coverage), m_calls(calls) {}
+
+  template <typename OpFn> void instr(MVT pc, const OpFn &op) {
+    m_slot = (pc - m_execStart) / ILEN;
+    m_slotInstrs[m_slot]++;
+    add(1);
+    for (auto &cache : m_caches) {
+      if (cache.config().instructions) {
+        cache.access(pc, false, m_slot);
+      }
+    }
+    if (m_coverage) {
+      m_coverage->setExecuted(m_slot);
+      m_coverage->setOpcode(static_cast<unsigned>(op()));
+    }
+  }
+  void taken() {
+    add(m_config.branchPenalty);
+    if (m_coverage) {
+      m_coverage->setTaken(m_slot);
+    }
+  }
+  void notTaken() {
+    if (m_coverage) {
+      m_coverage->setNotTaken(m_slot);
+    }
+  }
+  // After taken(), with 'instructions' executed including the jal
+  void jal(MVT target, MVT link, uint64_t instructions) {
+    if (m_calls) {
+      m_calls->jal(target, link, instructions, m_cycles);
+    }
+  }
+  void scall(unsigned n) {
+    if (m_coverage) {
+      m_coverage->setScall(n);
+    }
+  }
+  void load(MVT addr) {
+    add(m_config.loadWaitStates);
+    accessData(addr, false);
+  }
+  void store(MVT addr) {
+    add(m_config.storeWaitStates);
+    accessData(addr, true);
+  }
+
+private:
+  void add(unsigned cycles) {
+    m_cycles += cycles;
+    m_slotCycles[m_slot] += cycles;
+  }
+
+  void accessData(MVT addr, bool write) {
+    for (auto &cache : m_caches) {
+      if (cache.config().data) {
+        cache.access(addr, write, m_slot);
+      }
+    }
+  }
+
+  const TimingConfig &m_config;
+  uint64_t &m_cycles;
+  uint64_t *m_slotCycles;
+  uint64_t *m_slotInstrs;
+  const MVT m_execStart;
+  std::vector<Cache> &m_caches;
+  Coverage *m_coverage;
+  CallProfile *m_calls;
+  MVT m_slot = 0;
+};
+
+static_assert(NUM_BASE_INSTRS <= Coverage::kOpcodes,
+              "Coverage must hold a bit per opcode");
+
+enum SimRetval {
+  ALL_OK,
+  JAL_RA_EXIT,
+  SCALL,
+  ERROR,
+  BREAKPOINT,
+  WATCHPOINT,
+  INSTRUCTION_LIMIT, // run() executed its instruction budget
+  TIMEOUT            // run() passed its deadline
+};
+
+// System calls, selected by the immediate of 'scall'. Arguments are passed in
+// r4-r7 and results returned in r4, like the arguments and the return value of
+// a function, and failing calls return -errno. The calls of the newlib system
+// call stubs use the numbers of RISC-V Linux, and the flags of newlib.
+enum Syscall : unsigned {
+  SCALL_STOP = 0,            // stop the program
+  SCALL_INSTRUCTIONS = 1,    // r4 = instructions executed
+  SCALL_PUTCHAR = 2,         // print the accumulator as a character
+  SCALL_CORE = 3,            // r4 = number of this core, r5 = number of cores
+  SCALL_SWAP = 4,            // atomically swap acc with the word at addr
+  SCALL_FETCH_ADD = 5,       // atomically add acc to the word at addr
+  SCALL_OPENAT = 56,         // openat(dirfd, path, flags, mode)
+  SCALL_CLOSE = 57,          // close(fd)
+  SCALL_LSEEK = 62,          // lseek(fd, offset, whence)
+  SCALL_READ = 63,           // read(fd, buf, len)
+  SCALL_WRITE = 64,          // write(fd, buf, len)
+  SCALL_EXIT = 93,           // exit(code)
+  SCALL_CLOCK_GETTIME = 113, // clock_gettime(clock, timespec)
+  SCALL_BRK = 214,           // brk(addr), returns the new program break
+};
+
+// dirfd of openat() for paths relative to the working directory
+#define SCALL_AT_FDCWD -100
+
+// Register numbering used by the debugger interface. r0-r255 map 1:1, followed
+// by the special registers.
+enum DebugReg { REG_ACC = 256, REG_ADDR, REG_PC, NUM_DEBUG_REGS };
+
+enum class WatchKind { Write = 2, Read = 3, Access = 4 };
+
+template <typename T, unsigned B> inline T signextend(const T x) {
+  struct {
+    T x : B;
+  } s;
+  return s.x = x;
+}
+
+inline void itoa(unsigned v, char *buf) {
+  switch (v) {
+  case 0: {
+    *buf = '0';
+    return;
+  }
+  case 1: {
+    *buf = '1';
+    return;
+  }
+  default: { assert("unknown value"); }
+  }
+  return;
+}
+
+// A memory range to watch, given either by address or by ELF section name
+struct WatchRange {
+  std::string section;
+  MVT start;
+  MVT len;
+  WatchKind kind;
+};
+
+// An access to a traced watch range, by the instruction at 'pc' which was the
+// 'instruction'th executed
+struct WatchAccess {
+  MVT pc;
+  MVT addr;
+  uint64_t instruction;
+  RW rw;
+};
+
+struct LerosOptions {
+  std::map<unsigned, MVT_S> initRegState;
+  std::string argv;
+  std::string filename;
+  bool onlyShowModifiedRegs;
+  bool printState;
+  bool dumpAccu;
+  std::string gdb;
+  std::vector<WatchRange> watches;
+  unsigned accessLogSize = 0;
+  bool sanitize = false;
+  bool stats = false;
+  LerosEngine engine = LerosEngine::Block;
+  bool fuse = true;
+  bool profilePairs = false;
+  // Count cycles with the timing model
+  bool timing = false;
+  TimingConfig timingConfig;
+  // Cache models evaluated side by side on the execution. Enables the timing
+  // policy, whose cycles are the base of the caches' estimates.
+  std::vector<CacheConfig> caches;
+  // Record coverage of the executed opcodes, scall numbers, instructions and
+  // branch directions since loading
+  bool coverage = false;
+  // Count the calls of the function symbols, and the instructions and cycles
+  // spent in them
+  bool callStats = false;
+  // Input of the UART, or stdin if empty, and files streamed by file devices
+  std::string uartInput;
+  std::vector<std::string> ioFiles;
+  // Position of the simulator within a multi-core system (see multicore.h)
+  unsigned coreId = 0;
+  unsigned numCores = 1;
+};
+
+class LerosSim : public MemoryObserver<MVT> {
+public:
+  // With 'sharedMemory', the simulator accesses the given memory, which must
+  // hold the program, instead of memory of its own (see multicore.h)
+  LerosSim(const LerosOptions &opt, PagedMemory<MVT> *sharedMemory = nullptr)
+      : m_options(opt) {
+    installSyscalls();
+
+    // Pairs are profiled on the architectural instructions. Superinstructions
+    // hide the intermediate accumulator values and PCs.
+    if (opt.profilePairs) {
+      m_options.engine = LerosEngine::Switch;
+      m_pairCounts.assign(NUM_BASE_INSTRS * NUM_BASE_INSTRS, 0);
+    }
+    // The timing model sees the architectural instructions
+    m_timed = opt.timing || !opt.caches.empty() || opt.coverage ||
+              opt.callStats;
+    m_fuse = opt.fuse && !opt.dumpAccu && !m_timed;
+    for (const auto &config : opt.caches) {
+      assert(config.valid());
+      m_caches.emplace_back(config);
+    }
+
+    m_mem.setObserver(this);
+    if (sharedMemory) {
+      m_mem.share(*sharedMemory);
+    }
+    if (opt.sanitize) {
+      m_mem.enableShadow();
+      addRegion("stack", STACK_START - STACK_SIZE, MVT(STACK_START) + 0x10);
+    }
+
+    // Map the program file. The PC entry position will be 0 for flat binary
+    // files, and set accordingly for ELF files, where relocations have been
+    // specified relative to the entry point
+    m_loaded = m_image.load(opt.filename);
+    if (!m_loaded) {
+      return;
+    }
+    m_isELF = m_image.isELF();
+    m_entryPoint = m_image.entry();
+
+    assert((m_isELF || m_image.segments()[0].filesz % 2 == 0) &&
+           "File must be 16-bit aligned");
+
+    // Memory is set up from the PT_LOAD segments. File contents are not copied;
+    // their pages are faulted in from the file mapping when first touched. The
+    // zero filled remainder of a segment (p_filesz to p_memsz, ie. .bss) is not
+    // backed at all, and is allocated as zero pages on the first store.
+    for (const auto &segment : m_image.segments()) {
+      if (!sharedMemory) {
+        m_mem.addBacking(segment.vaddr, segment.data, segment.filesz,
+                         !segment.overlapsOther);
+      }
+      m_segments.push_back({static_cast<MVT>(segment.vaddr),
+                            static_cast<MVT>(segment.vaddr + segment.memsz),
+                            segment.flags});
+      m_brkStart = std::max(m_brkStart, m_segments.back().end);
+      if (m_options.sanitize) {
+        m_mem.addMappedRange(segment.vaddr, segment.vaddr + segment.memsz);
+        m_mem.setInitialized(segment.vaddr, segment.vaddr + segment.memsz);
+      }
+    }
+    // The heap starts after the last segment
+    m_brkStart = (m_brkStart + 15) & ~MVT(15);
+    buildExecutableBitmap();
+    if (m_options.engine != LerosEngine::Switch) {
+      // Stores into code must invalidate the predecoded instructions
+      for (const auto &seg : m_segments) {
+        if (seg.flags & PF_X) {
+          m_mem.setFlags(seg.start, seg.end, CodeWrite);
+        }
+      }
+    }
+
+    // Sections only serve to name addresses in diagnostics
+    for (const auto &section : m_image.sections()) {
+      if (section.flags & SHF_ALLOC) {
+        addRegion(section.name, section.addr, section.addr + section.size);
+      }
+    }
+    // The argument area is sized by reset(), which returns the mapped ranges
+    // to those of the loaded program
+    if (m_options.sanitize) {
+      m_loadedRanges = m_mem.mappedRanges();
+      m_argvRegion = m_regions.size();
+      m_regions.push_back({"argv", ARGV_START, ARGV_START});
+    }
+
+    // Install watches given on the command line. Accesses are logged rather than
+    // stopping the simulation if an access log was requested.
+    m_accessLog.resize(opt.accessLogSize);
+    for (const auto &w : opt.watches) {
+      MVT start = w.start;
+      MVT len = w.len;
+      if (!w.section.empty()) {
+        const ProgramImage::Section *section = m_image.section(w.section);
+        if (!section) {
+          std::cerr << "Unknown section '" << w.section << "' in watch"
+                    << std::endl;
+          continue;
+        }
+        start = section->addr;
+        len = section->size;
+      }
+      insertWatchpoint(start, len, w.kind, !m_accessLog.empty());
+    }
+
+    attachDevices();
+
+    // Input arguments for main(argc, argv)
+    std::istringstream f(m_options.argv);
+    std::string buf;
+    while (getline(f, buf, ' ')) {
+      m_args.push_back(static_cast<MVT>(atoll(buf.c_str())));
+    }
+
+    reset();
+
+    // Load register state
+    for (const auto &p : opt.initRegState) {
+      m_reg[p.first] = p.second;
+    }
+  }
+
+  ~LerosSim() { closeFiles(); }
+
+  bool isModified(unsigned reg) {
+    return m_modifiedRegs[reg];
+  }
+
+  void setModified(unsigned reg) { m_modifiedRegs[reg] = true; }
+
+  // Print registers
+  void printState() {
+    // Always display R4 state
+    setModified(4);
+    for (unsigned i = 0; i < 256; i++) {
+      if (m_options.onlyShowModifiedRegs) {
+        if (!isModified(i))
+          continue;
+      }
+      std::cout << i << ":" << m_reg[i] << " ";
+    }
+    std::cout << std::endl;
+    std::cout << "ACC: " << m_acc << std::endl;
+    std::cout << "ADDR: " << m_addr << std::endl;
+    std::cout << "PC: " << m_pc << std::endl;
+    std::cout << "INSTRUCTIONS EXECUTED: " << m_instructionsExecuted
+              << std::endl;
+  }
+
+  // Print accu
+  void printAccu() {
+    printf(XLen == 64 ? "%016llx\n" : "%08llx\n",
+           static_cast<unsigned long long>(static_cast<MVT>(m_acc)));
+  }
+
+  void reset() {
+    for (auto &r : m_reg) {
+      r = 0;
+    }
+    m_acc = 0;
+    m_addr = 0;
+    m_pc = m_entryPoint;
+    m_io.reset();
+    resetTiming();
+    closeFiles();
+    m_brk = m_brkStart;
+    if (m_sharedBrk) {
+      m_sharedBrk->store(m_brkStart);
+    }
+    m_exited = false;
+    m_exitCode = 0;
+
+    // The heap and the arguments of earlier runs are no longer mapped
+    if (m_options.sanitize && m_loaded) {
+      const MVT argvEnd = ARGV_START + (m_isELF ? m_args.size() : 0) * WORDSIZE;
+      auto ranges = m_loadedRanges;
+      if (argvEnd > ARGV_START) {
+        ranges.push_back({ARGV_START, argvEnd});
+      }
+      m_mem.setMappedRanges(ranges);
+      m_regions[m_argvRegion].end = argvEnd;
+    }
+
+    if (m_isELF) {
+      // Insert the input arguments into memory. Each argument occupies an XLen
+      // sized slot.
+      const int i = m_args.size();
+      for (int j = 0; j < i; j++) {
+        m_mem.write(ARGV_START + j * WORDSIZE, m_args[j], WORDSIZE);
+      }
+
+      // Set argc/argv
+      m_reg[4] = i;
+      m_reg[5] = ARGV_START;
+    }
+
+    // Set the stack pointer to a default value. The cores of a multi-core
+    // system have their stacks below each other.
+    m_reg[1] = STACK_START - m_options.coreId * STACK_SIZE;
+  }
+
+  // Move the program break in 'brk', which is shared with the other cores of
+  // a multi-core system, so that their heaps do not overlap
+  void shareBreak(std::atomic<MVT> *brk) {
+    m_sharedBrk = brk;
+    m_sharedBrk->store(m_brk);
+  }
+
+  // Set the input arguments placed in memory by the next reset()
+  void setArguments(const std::vector<MVT> &args) { m_args = args; }
+
+  // Architectural state and memory contents, for restarting execution from a
+  // known point
+  struct Snapshot {
+    std::array<MVT_S, 256> reg;
+    std::bitset<256> modifiedRegs;
+    MVT_S acc;
+    MVT addr;
+    MVT pc;
+    uint64_t instructionsExecuted;
+    uint64_t cycles;
+    MVT brk;
+    // Version of the code held by 'mem'
+    uint64_t codeVersion;
+    PagedMemory<MVT>::Snapshot mem;
+  };
+
+  void snapshot(Snapshot &snap) {
+    snap.reg = m_reg;
+    snap.modifiedRegs = m_modifiedRegs;
+    snap.acc = m_acc;
+    snap.addr = m_addr;
+    snap.pc = m_pc;
+    snap.instructionsExecuted = m_instructionsExecuted;
+    snap.cycles = m_cycles;
+    snap.brk = m_brk;
+    snap.codeVersion = m_codeVersion;
+    m_mem.snapshot(snap.mem);
+  }
+
+  // Watches installed since the snapshot are kept. Predecoded instructions are
+  // discarded only if the snapshot holds different code, ie. if code was
+  // written since it was taken or it was taken of another simulator.
+  void restore(const Snapshot &snap) {
+    m_reg = snap.reg;
+    m_modifiedRegs = snap.modifiedRegs;
+    m_acc = snap.acc;
+    m_addr = snap.addr;
+    m_pc = snap.pc;
+    m_instructionsExecuted = snap.instructionsExecuted;
+    m_cycles = snap.cycles;
+    m_brk = snap.brk;
+    m_exited = false;
+    m_tracePos = 0;
+    m_mem.restore(snap.mem);
+    m_mem.clearFlags(WatchRead | WatchWrite);
+    for (const auto &wp : m_watchpoints) {
+      m_mem.setFlags(wp.addr, wp.addr + wp.len, watchFlags(wp.kind));
+    }
+    if (snap.codeVersion != m_codeVersion) {
+      invalidateDecoded();
+      m_codeVersion = snap.codeVersion;
+    }
+  }
+
+  int clock() {
+    // Breakpoints are checked against a per-instruction bitmap, and only when
+    // at least one is set, so plain runs don't pay for the debugger.
+    if (m_numBreakpoints != 0 && isBreakpoint(m_pc)) {
+      return BREAKPOINT;
+    }
+    return step();
+  }
+
+  // Execute a single instruction, ignoring any breakpoint at the current PC.
+  // With fusion enabled, a superinstruction counts as all of the instructions
+  // it replaces, unless 'single' is set.
+  int step(bool single = false) {
+    if (m_timed) {
+      PipelineTiming timing = pipelineTiming();
+      return step(timing, single);
+    }
+    NoTiming timing;
+    return step(timing, single);
+  }
+
+  template <typename Timing> int step(Timing &timing, bool single) {
+    // Constrain simulator to only run instructions in executable segments
+    if (!isExecutable(m_pc)) {
+      m_instructionsExecuted++;
+      return 1;
+    }
+
+    int retval;
+    if (m_options.engine != LerosEngine::Switch && !single &&
+        (m_pc & (ILEN - 1)) == 0) {
+      DecodedInstr &slot = m_decoded[(m_pc - m_execStart) / ILEN];
+      if (slot.len == 0) {
+        predecode(m_pc, slot);
+      }
+      // Executed from a copy, as a store may invalidate the slot
+      const DecodedInstr d = slot;
+      m_instructionsExecuted += d.len;
+      for (unsigned i = 0; i < d.len; i++) {
+        m_trace[m_tracePos++ % m_trace.size()] = m_pc + i * ILEN;
+      }
+      retval = execDecoded(d, timing);
+    } else {
+      m_instructionsExecuted++;
+      const uint16_t instr = m_mem.fetch(m_pc);
+      m_trace[m_tracePos++ % m_trace.size()] = m_pc;
+      if (!m_pairCounts.empty()) {
+        const unsigned op = static_cast<unsigned>(decodeOpcode(instr >> 8));
+        if (m_prevOp < NUM_BASE_INSTRS) {
+          m_pairCounts[m_prevOp * NUM_BASE_INSTRS + op]++;
+        }
+        m_prevOp = op;
+      }
+      retval = execInstr(instr, timing);
+    }
+    if (retval == ALL_OK && m_watchHit) {
+      return WATCHPOINT;
+    }
+    return retval;
+  }
+
+  // Run until the program stops, 'maxInstructions' more instructions have been
+  // executed (0 for no limit) or 'deadline' has passed, and return the reason
+  // like clock(). Instructions are executed in batches, and the budget and the
+  // clock are only checked between batches. Batches end early enough that no
+  // block or superinstruction crosses the budget, which is then approached one
+  // instruction at a time, such that exactly 'maxInstructions' are executed.
+  int run(uint64_t maxInstructions = 0,
+          std::chrono::steady_clock::time_point deadline =
+              std::chrono::steady_clock::time_point::max()) {
+    const uint64_t limit =
+        maxInstructions != 0 ? m_instructionsExecuted + maxInstructions
+                             : std::numeric_limits<uint64_t>::max();
+    const bool timed = deadline != std::chrono::steady_clock::time_point::max();
+    while (true) {
+      const uint64_t remaining = limit - m_instructionsExecuted;
+      int retval;
+      if (remaining == 0) {
+        return INSTRUCTION_LIMIT;
+      } else if (remaining <= kRunSlack) {
+        if (m_numBreakpoints != 0 && isBreakpoint(m_pc)) {
+          return BREAKPOINT;
+        }
+        retval = step(true);
+      } else {
+        retval = runBatch(m_instructionsExecuted +
+                          std::min<uint64_t>(kRunBatch, remaining - kRunSlack));
+      }
+      if (retval != ALL_OK) {
+        return retval;
+      }
+      if (timed && std::chrono::steady_clock::now() >= deadline) {
+        return TIMEOUT;
+      }
+    }
+  }
+
+  // Handler of a system call, returning ALL_OK to continue the program or the
+  // reason for stopping it
+  typedef std::function<int(LerosSim &)> SyscallHandler;
+
+  // Handle 'scall n' with 'handler', replacing any built in system call
+  void setSyscall(unsigned n, SyscallHandler handler) {
+    m_syscalls[n & 0xff] = std::move(handler);
+  }
+
+  // Cycles counted by the timing model, including the cycles to fill the
+  // pipeline
+  uint64_t cycles() const { return m_cycles; }
+  // Cycles and instructions per instruction slot of the executable segments,
+  // starting at execStart()
+  const std::vector<uint64_t> &slotCycles() const { return m_slotCycles; }
+  const std::vector<uint64_t> &slotInstructions() const {
+    return m_slotInstrs;
+  }
+  MVT execStart() const { return m_execStart; }
+  // Cache models given in the options, reset with the simulator
+  const std::vector<Cache> &caches() const { return m_caches; }
+  // Coverage recorded with the coverage option, of execSlots() instruction
+  // slots starting at execStart()
+  const Coverage &coverage() const { return m_coverage; }
+  // Forget the coverage of earlier runs, which is kept by reset() and restore()
+  void clearCoverage() { m_coverage.reset(m_coverage.slots()); }
+  // Calls counted with the callStats option since the last reset()
+  const CallProfile &calls() const { return m_calls; }
+  size_t execSlots() const { return m_execSlots; }
+
+  // Whether the program stopped through the exit system call, and the code it
+  // passed
+  bool exited() const { return m_exited; }
+  MVT_S exitCode() const { return m_exitCode; }
+
+  // Enable or disable superinstructions for the predecoded engine. Debuggers
+  // disable them, so that stepping and breakpoints see every instruction.
+  void setFusion(bool fuse) {
+    m_fuse = fuse && !m_timed;
+    invalidateDecoded();
+  }
+
+  // Number of executions of each pair of consecutive instructions, indexed by
+  // first * NUM_BASE_INSTRS + second, as recorded with the profilePairs option
+  // since the simulator was created
+  const std::vector<uint64_t> &pairCounts() const { return m_pairCounts; }
+
+  // Print the most frequently executed pairs of consecutive instructions, as
+  // recorded with the profilePairs option
+  void printPairProfile(std::ostream &os, unsigned n = 20) const {
+    std::vector<std::pair<uint64_t, unsigned>> pairs;
+    uint64_t total = 0;
+    for (unsigned i = 0; i < m_pairCounts.size(); i++) {
+      total += m_pairCounts[i];
+      if (m_pairCounts[i] != 0) {
+        pairs.push_back({m_pairCounts[i], i});
+      }
+    }
+    std::sort(pairs.rbegin(), pairs.rend());
+    if (pairs.size() > n) {
+      pairs.resize(n);
+    }
+    os << "Most frequent instruction pairs (" << total << " total):" << std::endl;
+    for (const auto &p : pairs) {
+      const auto first = static_cast<LerosInstr>(p.second / NUM_BASE_INSTRS);
+      const auto second = static_cast<LerosInstr>(p.second % NUM_BASE_INSTRS);
+      os << "  " << instrName(first) << " " << instrName(second) << ": "
+         << p.first << " (" << 100.0 * p.first / total << "%)" << std::endl;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+  // Debugger interface
+
+  MVT readRegister(unsigned idx) const {
+    switch (idx) {
+    case REG_ACC:
+      return m_acc;
+    case REG_ADDR:
+      return m_addr;
+    case REG_PC:
+      return m_pc;
+    default:
+      return m_reg[idx];
+    }
+  }
+
+  void writeRegister(unsigned idx, MVT value) {
+    switch (idx) {
+    case REG_ACC:
+      m_acc = value;
+      break;
+    case REG_ADDR:
+      m_addr = value;
+      break;
+    case REG_PC:
+      m_pc = value;
+      break;
+    default:
+      m_reg[idx] = value;
+      setModified(idx);
+      break;
+    }
+  }
+
+  uint8_t readByte(MVT addr) { return m_mem.peek(addr); }
+  // Writes to data leave the decoded code alone
+  void writeByte(MVT addr, uint8_t value) {
+    m_mem.poke(addr, value);
+    if (isExecutable(addr)) {
+      codeWritten(addr, 1);
+    }
+  }
+
+  // Returns false if pc does not refer to an instruction in the text segment
+  bool insertBreakpoint(MVT pc) {
+    if (!isExecutable(pc)) {
+      return false;
+    }
+    if (m_breakpoints.empty()) {
+      m_breakpoints.resize(m_executable.size(), 0);
+    }
+    const MVT slot = (pc - m_execStart) / ILEN;
+    uint64_t &word = m_breakpoints[slot / 64];
+    const uint64_t bit = uint64_t(1) << (slot % 64);
+    if (!(word & bit)) {
+      word |= bit;
+      m_numBreakpoints++;
+    }
+    return true;
+  }
+
+  bool removeBreakpoint(MVT pc) {
+    if (!isExecutable(pc) || m_breakpoints.empty()) {
+      return false;
+    }
+    const MVT slot = (pc - m_execStart) / ILEN;
+    uint64_t &word = m_breakpoints[slot / 64];
+    const uint64_t bit = uint64_t(1) << (slot % 64);
+    if (word & bit) {
+      word &= ~bit;
+      m_numBreakpoints--;
+    }
+    return true;
+  }
+
+  // Watch a memory range. Traced watchpoints record accesses in the access log
+  // instead of stopping execution.
+  void insertWatchpoint(MVT addr, MVT len, WatchKind kind, bool trace = false) {
+    m_watchpoints.push_back({addr, len, kind, trace});
+    m_mem.setFlags(addr, addr + len, watchFlags(kind));
+  }
+
+  bool removeWatchpoint(MVT addr, MVT len, WatchKind kind) {
+    for (auto it = m_watchpoints.begin(); it != m_watchpoints.end(); ++it) {
+      if (it->addr == addr && it->len == len && it->kind == kind &&
+          !it->trace) {
+        m_watchpoints.erase(it);
+        m_mem.clearFlags(WatchRead | WatchWrite);
+        for (const auto &wp : m_watchpoints) {
+          m_mem.setFlags(wp.addr, wp.addr + wp.len, watchFlags(wp.kind));
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Called by the memory for accesses to pages containing a watchpoint
+  void watchedAccess(MVT addr, unsigned size, RW rw) override {
+    for (const auto &wp : m_watchpoints) {
+      if (!(addr < wp.addr + wp.len && wp.addr < addr + size)) {
+        continue;
+      }
+      if (wp.kind != WatchKind::Access &&
+          (wp.kind == WatchKind::Write) != (rw == RW::Write)) {
+        continue;
+      }
+
+      if (wp.trace) {
+        m_accessLog[m_accessLogCount % m_accessLog.size()] = {
+            m_pc, addr, m_instructionsExecuted, rw};
+        m_accessLogCount++;
+      } else if (!m_watchHit) {
+        m_watchHit = true;
+        m_watchHitAddr = addr;
+        m_watchHitKind = wp.kind;
+        m_watchHitRW = rw;
+        m_watchHitPC = m_pc;
+      }
+      return;
+    }
+  }
+
+  // Called by the memory sanitizer for invalid accesses. Each PC is only
+  // reported once per kind of fault.
+  void shadowFault(MVT addr, unsigned size, RW rw, ShadowFault fault) override {
+    if (!m_sanitizerReports.insert({m_pc, static_cast<int>(fault)}).second) {
+      return;
+    }
+    std::cerr << "Sanitizer: " << (rw == RW::Write ? "write" : "read");
+    if (fault == ShadowFault::Uninitialized) {
+      std::cerr << " of uninitialized memory";
+    } else {
+      std::cerr << " outside of mapped memory";
+    }
+    std::cerr << " at 0x" << std::hex << addr << std::dec << " (" << size
+              << " bytes";
+    for (const auto &r : m_regions) {
+      if (addr >= r.start && addr < r.end) {
+        std::cerr << ", " << r.name;
+        break;
+      }
+    }
+    std::cerr << ") by PC 0x" << std::hex << m_pc << std::dec << std::endl;
+    printTrace(std::cerr);
+  }
+
+  // Called by the memory for stores to pages holding executable segments.
+  // Invalidates every predecoded slot whose instructions overlap the store.
+  void codeWritten(MVT addr, unsigned size) override {
+    m_codeWrites++;
+    m_codeVersion = newCodeVersion();
+    if (m_decoded.empty()) {
+      return;
+    }
+    m_flushBlocks = true;
+    const MVT first = addr - (MAX_FUSED_LEN - 1) * ILEN;
+    for (MVT pc = first & ~MVT(ILEN - 1); pc != ((addr + size + ILEN - 1) &
+                                                 ~MVT(ILEN - 1));
+         pc += ILEN) {
+      const MVT slot = (pc - m_execStart) / ILEN;
+      if (slot < m_execSlots) {
+        m_decoded[slot].len = 0;
+      }
+    }
+  }
+
+  // Versions of the code in memory are unique across all simulators, so that
+  // snapshots tell whether they hold the code that was decoded
+  static uint64_t newCodeVersion() {
+    static std::atomic<uint64_t> next(0);
+    return ++next;
+  }
+
+  // Discard all predecoded instructions and blocks
+  void invalidateDecoded() {
+    for (auto &d : m_decoded) {
+      d.len = 0;
+    }
+    m_flushBlocks = true;
+  }
+
+  // Number of stores into code, which invalidate predecoded instructions
+  uint64_t codeWrites() const { return m_codeWrites; }
+
+  unsigned sanitizerReports() const { return m_sanitizerReports.size(); }
+
+  void printWatchHit(std::ostream &os) const {
+    os << "Watchpoint hit: " << (m_watchHitRW == RW::Write ? "write" : "read")
+       << " of 0x" << std::hex << m_watchHitAddr << " at PC 0x" << m_watchHitPC
+       << std::dec << " (instruction " << m_instructionsExecuted << ")"
+       << std::endl;
+    printTrace(os);
+  }
+
+  // Print the most recently executed PCs, most recent first
+  void printTrace(std::ostream &os) const {
+    os << "Trace:" << std::hex;
+    const uint64_t n = std::min<uint64_t>(m_tracePos, m_trace.size());
+    for (uint64_t i = 1; i <= n; i++) {
+      os << " 0x" << m_trace[(m_tracePos - i) % m_trace.size()];
+    }
+    os << std::dec << std::endl;
+  }
+
+  // Print the recorded accesses to traced watchpoints, oldest first
+  void printAccessLog(std::ostream &os) const {
+    if (m_accessLog.empty()) {
+      return;
+    }
+    const uint64_t n = std::min<uint64_t>(m_accessLogCount, m_accessLog.size());
+    os << "Access log (" << m_accessLogCount << " accesses, showing last " << n
+       << "):" << std::endl;
+    for (uint64_t i = m_accessLogCount - n; i < m_accessLogCount; i++) {
+      const WatchAccess &a = m_accessLog[i % m_accessLog.size()];
+      os << "  instruction " << a.instruction << ": PC 0x" << std::hex << a.pc << " "
+         << (a.rw == RW::Write ? "write" : "read ") << " 0x" << a.addr
+         << std::dec << std::endl;
+    }
+  }
+
+  // Address and kind of the watchpoint hit by the most recent step()
+  MVT watchHitAddress() const { return m_watchHitAddr; }
+  WatchKind watchHitKind() const { return m_watchHitKind; }
+
+  MVT getPC() const { return m_pc; }
+  uint64_t instructionsExecuted() const { return m_instructionsExecuted; }
+  bool isELF() const { return m_isELF; }
+  // Whether the program file could be opened
+  bool loaded() const { return m_loaded; }
+  const ProgramImage &image() const { return m_image; }
+  // Devices accessed by in/out, for attaching further devices
+  IOBus &io() { return m_io; }
+
+  // ---------------------------------------------------------------------------
+  // Instruction decoding
+
+  // Returns LerosInstr::unknown for invalid opcodes
+  static LerosInstr decodeOpcode(uint8_t opcode) {
+    const uint8_t bOpcode = opcode >> 4;
+
+    // clang-format off
+    switch (bOpcode) {
+    default: break;
+    case 0b1000: return LerosInstr::br;
+    case 0b1001: return LerosInstr::brz;
+    case 0b1010: return LerosInstr::brnz;
+    case 0b1011: return LerosInstr::brp;
+    case 0b1100: return LerosInstr::brn;
+    }
+
+    switch(opcode){
+    default: break;
+    case 0x0: return LerosInstr::nop;
+    case 0x08: return LerosInstr::add;
+    case 0x09: return LerosInstr::addi;
+    case 0x0c: return LerosInstr::sub;
+    case 0x0d: return LerosInstr::subi;
+    case 0x10: return LerosInstr::sra;
+    case 0x20: return LerosInstr::load;
+    case 0x21: return LerosInstr::loadi;
+    case 0x22: return LerosInstr::And;
+    case 0x23: return LerosInstr::Andi;
+    case 0x24: return LerosInstr::Or;
+    case 0x25: return LerosInstr::Ori;
+    case 0x26: return LerosInstr::Xor;
+    case 0x27: return LerosInstr::Xori;
+    case 0x29: return LerosInstr::loadhi;
+    case 0x2a: return LerosInstr::loadh2i;
+    case 0x2b: return LerosInstr::loadh3i;
+#ifdef LEROS64
+    case 0x2c: return LerosInstr::loadh4i;
+    case 0x2d: return LerosInstr::loadh5i;
+    case 0x2e: return LerosInstr::loadh6i;
+    case 0x2f: return LerosInstr::loadh7i;
+#endif
+    case 0x30: return LerosInstr::store;
+    case 0x39: return LerosInstr::out;
+    case 0x05: return LerosInstr::in;
+    case 0x40: return LerosInstr::jal;
+    case 0x50: return LerosInstr::ldaddr;
+    case 0x60: return LerosInstr::ldind;
+    case 0x61: return LerosInstr::ldindb;
+    case 0x62: return LerosInstr::ldindh;
+    case 0x70: return LerosInstr::stind;
+    case 0x71: return LerosInstr::stindb;
+    case 0x72: return LerosInstr::stindh;
+    case 0xff: return LerosInstr::scall;
+    }
+    // clang-format on
+
+    return LerosInstr::unknown;
+  }
+
+  static LerosInstr decodeInstr(uint8_t opcode) {
+    const LerosInstr inst = decodeOpcode(opcode);
+    assert(inst != LerosInstr::unknown && "Could not match opcode");
+    return inst;
+  }
+
+  // Decode the instruction at 'pc'
+  static DecodedInstr decode(uint16_t instr, MVT pc) {
+    const uint8_t uimm8 = instr & 0xFF;
+    const int simm8 = signextend<int, 8>(instr);
+    const int simm13lsb0 = signextend<int, 13>(instr << 1);
+
+    DecodedInstr d{decodeInstr((instr >> 8) & 0xFF), 1, uimm8, 0, 0, simm8, 0};
+    // clang-format off
+    switch (d.op) {
+    default: break;
+    case LerosInstr::subi: d.op = LerosInstr::addi; d.imm = -simm8; break;
+    case LerosInstr::Andi:
+    case LerosInstr::Ori:
+    case LerosInstr::Xori: d.imm = uimm8; break;
+    case LerosInstr::loadhi:  d.imm = simm8 << 8; break;
+    case LerosInstr::loadh2i: d.imm = simm8 << 16; break;
+    case LerosInstr::loadh3i: d.imm = simm8 << 24; break;
+#ifdef LEROS64
+    case LerosInstr::loadh4i: d.imm = static_cast<MVT_S>(simm8) << 32; break;
+    case LerosInstr::loadh5i: d.imm = static_cast<MVT_S>(simm8) << 40; break;
+    case LerosInstr::loadh6i: d.imm = static_cast<MVT_S>(simm8) << 48; break;
+    case LerosInstr::loadh7i: d.imm = static_cast<MVT_S>(simm8) << 56; break;
+#endif
+    case LerosInstr::br:
+    case LerosInstr::brz:
+    case LerosInstr::brnz:
+    case LerosInstr::brp:
+    case LerosInstr::brn: d.target = pc + simm13lsb0; break;
+    case LerosInstr::ldind:
+    case LerosInstr::stind: d.imm = simm8 << WORDSHIFT; break;
+    case LerosInstr::ldindh:
+    case LerosInstr::stindh: d.imm = simm8 << 1; break;
+    }
+    // clang-format on
+    return d;
+  }
+
+private:
+  // Build the bitmap of executable instruction slots from the PF_X segments
+  void buildExecutableBitmap() {
+    MVT start = ~MVT(0);
+    MVT end = 0;
+    for (const auto &seg : m_segments) {
+      if (seg.flags & PF_X) {
+        start = std::min(start, seg.start & ~MVT(ILEN - 1));
+        end = std::max(end, seg.end);
+      }
+    }
+    if (start >= end) {
+      return;
+    }
+
+    m_execStart = start;
+    m_execSlots = (end - start + ILEN - 1) / ILEN;
+    m_executable.assign(m_execSlots / 64 + 1, 0);
+    m_coverage.reset(m_options.coverage ? m_execSlots : 0);
+    if (m_options.callStats) {
+      m_calls.reset(m_image, m_execStart, m_execSlots);
+    }
+    if (m_options.engine != LerosEngine::Switch) {
+      m_decoded.assign(m_execSlots, DecodedInstr());
+    }
+    if (m_options.engine == LerosEngine::Block) {
+      m_blocks.resize(m_execSlots);
+    }
+    for (const auto &seg : m_segments) {
+      if (!(seg.flags & PF_X)) {
+        continue;
+      }
+      for (MVT pc = seg.start & ~MVT(ILEN - 1); pc < seg.end; pc += ILEN) {
+        const MVT slot = (pc - m_execStart) / ILEN;
+        m_executable[slot / 64] |= uint64_t(1) << (slot % 64);
+      }
+    }
+  }
+
+  bool isExecutable(MVT pc) const {
+    const MVT slot = (pc - m_execStart) / ILEN;
+    return slot < m_execSlots && ((m_executable[slot / 64] >> (slot % 64)) & 1);
+  }
+
+  bool isBreakpoint(MVT pc) const {
+    if (!isExecutable(pc)) {
+      return false;
+    }
+    const MVT slot = (pc - m_execStart) / ILEN;
+    return (m_breakpoints[slot / 64] >> (slot % 64)) & 1;
+  }
+
+  // Basic blocks of the block engine. Blocks end
+  // after a control transfer, and cache the blocks last reached through their
+  // taken and fall-through edges. Any store into code discards all blocks.
+  struct ExecBlock {
+    MVT start;
+    MVT end;
+    std::vector<DecodedInstr> instrs;
+    ExecBlock *taken = nullptr;
+    ExecBlock *next = nullptr;
+  };
+  static constexpr unsigned kMaxBlockLength = 256;
+
+  // Number of instructions executed by run() between checks of the budget and
+  // the clock, and the most instructions a block may execute
+  static constexpr unsigned kRunBatch = 1 << 16;
+  static constexpr unsigned kRunSlack = kMaxBlockLength * MAX_FUSED_LEN;
+
+  static bool endsBlock(LerosInstr op) {
+    switch (op) {
+    case LerosInstr::br:
+    case LerosInstr::brz:
+    case LerosInstr::brnz:
+    case LerosInstr::brp:
+    case LerosInstr::brn:
+    case LerosInstr::jal:
+    case LerosInstr::scall:
+    case LerosInstr::fused_loadi_br:
+    case LerosInstr::fused_load_brz:
+    case LerosInstr::fused_load_brnz:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Returns the block starting at 'pc', building it from the predecoded
+  // instructions if needed, or nullptr if 'pc' is not an aligned executable
+  // address
+  ExecBlock *lookupBlock(MVT pc) {
+    if ((pc & (ILEN - 1)) != 0 || !isExecutable(pc)) {
+      return nullptr;
+    }
+    std::unique_ptr<ExecBlock> &block = m_blocks[(pc - m_execStart) / ILEN];
+    if (block) {
+      return block.get();
+    }
+
+    block.reset(new ExecBlock);
+    block->start = pc;
+    while (block->instrs.size() < kMaxBlockLength && isExecutable(pc)) {
+      DecodedInstr &slot = m_decoded[(pc - m_execStart) / ILEN];
+      if (slot.len == 0) {
+        predecode(pc, slot);
+      }
+      block->instrs.push_back(slot);
+      pc += slot.len * ILEN;
+      if (endsBlock(slot.op)) {
+        break;
+      }
+    }
+    block->end = pc;
+    return block.get();
+  }
+
+  // Execute instructions until at least instruction count 'end' is reached or
+  // the program stops. With the block engine and no breakpoints set, whole
+  // basic blocks are executed per dispatch, so up to kRunSlack instructions
+  // past 'end' may be executed.
+  int runBatch(uint64_t end) {
+    if (m_timed) {
+      PipelineTiming timing = pipelineTiming();
+      return runBatch(end, timing);
+    }
+    NoTiming timing;
+    return runBatch(end, timing);
+  }
+
+  template <typename Timing> int runBatch(uint64_t end, Timing &timing) {
+    if (m_options.engine != LerosEngine::Block || m_numBreakpoints != 0) {
+      while (m_instructionsExecuted < end) {
+        if (m_numBreakpoints != 0 && isBreakpoint(m_pc)) {
+          return BREAKPOINT;
+        }
+        const int retval = step(timing, false);
+        if (retval != ALL_OK) {
+          return retval;
+        }
+      }
+      return ALL_OK;
+    }
+
+    ExecBlock *block = nullptr;
+    while (m_instructionsExecuted < end) {
+      if (m_flushBlocks) {
+        for (auto &b : m_blocks) {
+          b.reset();
+        }
+        m_flushBlocks = false;
+        block = nullptr;
+      }
+      if (!block && !(block = lookupBlock(m_pc))) {
+        // Not executable, or not aligned
+        const int retval = step(timing, false);
+        if (retval != ALL_OK) {
+          return retval;
+        }
+        continue;
+      }
+
+      m_watchHit = false;
+      for (const DecodedInstr &d : block->instrs) {
+        m_instructionsExecuted += d.len;
+        for (unsigned i = 0; i < d.len; i++) {
+          m_trace[m_tracePos++ % m_trace.size()] = m_pc + i * ILEN;
+        }
+        const int retval = execDecoded(d, timing);
+        if (retval != ALL_OK) {
+          return retval;
+        }
+        if (m_watchHit || m_flushBlocks) {
+          // Stop within the block; a store into code may have replaced the
+          // rest of it
+          break;
+        }
+      }
+      if (m_watchHit) {
+        return WATCHPOINT;
+      }
+      if (m_flushBlocks) {
+        continue;
+      }
+
+      // Follow the cached successors. The taken edge of a block ending in jal
+      // caches the most recent call or return target.
+      ExecBlock *&next = m_pc == block->end ? block->next : block->taken;
+      if (!next || next->start != m_pc) {
+        next = lookupBlock(m_pc);
+      }
+      block = next;
+    }
+    return ALL_OK;
+  }
+
+  PipelineTiming pipelineTiming() {
+    return PipelineTiming(m_options.timingConfig, m_cycles,
+                          m_slotCycles.data(), m_slotInstrs.data(),
+                          m_execStart, m_caches,
+                          m_options.coverage ? &m_coverage : nullptr,
+                          m_options.callStats ? &m_calls : nullptr);
+  }
+
+  void resetTiming() {
+    if (!m_timed) {
+      return;
+    }
+    m_cycles = m_options.timingConfig.stages - 1;
+    m_slotCycles.assign(m_execSlots, 0);
+    m_slotInstrs.assign(m_execSlots, 0);
+    m_calls.clear();
+    for (auto &cache : m_caches) {
+      cache.reset(m_execSlots);
+    }
+  }
+
+  // Attach the UART, the timer, the cycle counter and the file devices
+  // given in the options to the I/O bus
+  void attachDevices() {
+    std::istream *uartInput = &std::cin;
+    if (!m_options.uartInput.empty()) {
+      m_uartInput.reset(
+          new std::ifstream(m_options.uartInput, std::ios::binary));
+      if (!*m_uartInput) {
+        std::cerr << "Could not open UART input '" << m_options.uartInput
+                  << "'" << std::endl;
+      }
+      uartInput = m_uartInput.get();
+    }
+    m_io.attach(UART_PORT, UartDevice::NUM_REGS,
+                std::make_shared<UartDevice>(*uartInput, std::cout));
+    m_io.attach(TIMER_PORT, TimerDevice::NUM_REGS,
+                std::make_shared<TimerDevice>());
+    m_io.attach(CYCLE_PORT, CycleCounterDevice::NUM_REGS,
+                std::make_shared<CycleCounterDevice>(
+                    [this]() { return m_instructionsExecuted; }));
+    for (unsigned i = 0; i < m_options.ioFiles.size(); i++) {
+      auto file = std::make_shared<FileDevice>(
+          [this](uint64_t address, const uint8_t *data, size_t len) {
+            m_mem.writeBlock(address, data, len);
+          });
+      if (!file->open(m_options.ioFiles[i]) ||
+          !m_io.attach(FILE_PORT + i * FILE_PORTS, FileDevice::NUM_REGS,
+                       file)) {
+        std::cerr << "Could not attach file device for '"
+                  << m_options.ioFiles[i] << "'" << std::endl;
+      }
+    }
+  }
+
+  // Register a named memory region as valid for loads and stores
+  void addRegion(const std::string &name, MVT start, MVT end) {
+    if (!m_options.sanitize) {
+      return;
+    }
+    m_regions.push_back({name, start, end});
+    m_mem.addMappedRange(start, end);
+  }
+
+  static uint8_t watchFlags(WatchKind kind) {
+    switch (kind) {
+    case WatchKind::Write:
+      return WatchWrite;
+    case WatchKind::Read:
+      return WatchRead;
+    default:
+      return WatchRead | WatchWrite;
+    }
+  }
+
+  MVT memRead(MVT addr, unsigned size) { return m_mem.read(addr, size); }
+
+  void memWrite(MVT addr, MVT value, unsigned size) {
+    m_mem.write(addr, value, size);
+  }
+
+  // Decode the instruction at 'pc' into its predecoded slot, fusing it with
+  // the following instructions into a superinstruction where possible
+  void predecode(MVT pc, DecodedInstr &d) {
+    d = decode(m_mem.fetch(pc), pc);
+    if (!m_fuse) {
+      return;
+    }
+
+    // Decodes the following instructions as long as they are executable
+    DecodedInstr next[MAX_FUSED_LEN];
+    unsigned n = 0;
+    for (MVT p = pc + ILEN; n < MAX_FUSED_LEN - 1 && isExecutable(p);
+         p += ILEN) {
+      const uint16_t instr = m_mem.fetch(p);
+      if (decodeOpcode(instr >> 8) == LerosInstr::unknown) {
+        break;
+      }
+      next[n++] = decode(instr, p);
+    }
+    const auto op = [&](unsigned i) {
+      return i < n ? next[i].op : LerosInstr::unknown;
+    };
+
+    switch (d.op) {
+    default:
+      break;
+    case LerosInstr::loadi: {
+      // Constants built by loadi and a chain of loadh*i
+      static const LerosInstr chain[] = {
+          LerosInstr::loadhi,  LerosInstr::loadh2i, LerosInstr::loadh3i,
+#ifdef LEROS64
+          LerosInstr::loadh4i, LerosInstr::loadh5i, LerosInstr::loadh6i,
+          LerosInstr::loadh7i,
+#endif
+      };
+      MVT_S value = d.imm;
+      unsigned len = 1;
+      while (len - 1 < n && op(len - 1) == chain[len - 1]) {
+        value = (value & ((MVT_S(1) << (8 * len)) - 1)) | next[len - 1].imm;
+        len++;
+      }
+      if (len > 1) {
+        d.op = LerosInstr::fused_loadconst;
+        d.len = len;
+        d.imm = value;
+      } else if (op(0) == LerosInstr::brz || op(0) == LerosInstr::brnz) {
+        // The outcome of the branch is known
+        const bool taken = (d.imm == 0) == (op(0) == LerosInstr::brz);
+        d.op = LerosInstr::fused_loadi_br;
+        d.len = 2;
+        d.target = taken ? next[0].target : pc + 2 * ILEN;
+      }
+      break;
+    }
+    case LerosInstr::load: {
+      if (op(0) == LerosInstr::brz || op(0) == LerosInstr::brnz) {
+        d.op = op(0) == LerosInstr::brz ? LerosInstr::fused_load_brz
+                                        : LerosInstr::fused_load_brnz;
+        d.len = 2;
+        d.target = next[0].target;
+      } else if (op(1) == LerosInstr::store) {
+        d.reg3 = next[1].reg;
+        d.len = 3;
+        if (op(0) == LerosInstr::add) {
+          d.op = LerosInstr::fused_load_add_store;
+          d.reg2 = next[0].reg;
+        } else if (op(0) == LerosInstr::sub) {
+          d.op = LerosInstr::fused_load_sub_store;
+          d.reg2 = next[0].reg;
+        } else if (op(0) == LerosInstr::addi) {
+          d.op = LerosInstr::fused_load_addi_store;
+          d.imm = next[0].imm;
+        } else {
+          d.len = 1;
+        }
+      }
+      break;
+    }
+    case LerosInstr::ldaddr: {
+      if (op(0) == LerosInstr::ldind || op(0) == LerosInstr::stind) {
+        d.op = op(0) == LerosInstr::ldind ? LerosInstr::fused_ldaddr_ldind
+                                          : LerosInstr::fused_ldaddr_stind;
+        d.len = 2;
+        d.imm = next[0].imm;
+      }
+      break;
+    }
+    }
+  }
+
+  template <typename Timing> int execInstr(uint16_t instr, Timing &timing) {
+    const uint8_t uimm8 = instr & 0xFF;
+    const int simm8 = signextend<int, 8>(instr);
+    const int simm13lsb0 = signextend<int, 13>(instr << 1);
+    const LerosInstr inst = decodeInstr((instr >> 8) & 0xFF);
+    m_watchHit = false;
+    timing.instr(m_pc, [inst] { return inst; });
+
+    // clang-format off
+    switch (inst) {
+    default:
+    case LerosInstr::unknown: assert("Unknown instruction"); break;
+    case LerosInstr::nop: break;
+    case LerosInstr::addi: m_acc += simm8; break;
+    case LerosInstr::add:  m_acc += m_reg[uimm8]; break;
+    case LerosInstr::subi: m_acc -= simm8; break;
+    case LerosInstr::sub:  m_acc -= m_reg[uimm8]; break;
+    case LerosInstr::sra: {
+      m_acc >>= 1;
+      break;
+    }
+    case LerosInstr::loadi:  m_acc = simm8; break;
+    case LerosInstr::load:   m_acc = m_reg[uimm8]; break;
+    case LerosInstr::Andi:   m_acc &= uimm8; break;
+    case LerosInstr::And:    m_acc &= m_reg[uimm8]; break;
+    case LerosInstr::Ori:    m_acc |= uimm8; break;
+    case LerosInstr::Or:     m_acc |= m_reg[uimm8]; break;
+    case LerosInstr::Xori:   m_acc ^= uimm8; break;
+    case LerosInstr::Xor:    m_acc ^= m_reg[uimm8]; break;
+    case LerosInstr::loadhi:  m_acc = (m_acc & 0xff) | simm8 << 8;  break;
+    case LerosInstr::loadh2i: m_acc = (m_acc & 0xffff) | simm8 << 16; break;
+    case LerosInstr::loadh3i: m_acc = (m_acc & 0xffffff) | simm8 << 24; break;
+#ifdef LEROS64
+    case LerosInstr::loadh4i: m_acc = (m_acc & 0xffffffff) | static_cast<MVT_S>(simm8) << 32; break;
+    case LerosInstr::loadh5i: m_acc = (m_acc & 0xffffffffff) | static_cast<MVT_S>(simm8) << 40; break;
+    case LerosInstr::loadh6i: m_acc = (m_acc & 0xffffffffffff) | static_cast<MVT_S>(simm8) << 48; break;
+    case LerosInstr::loadh7i: m_acc = (m_acc & 0xffffffffffffff) | static_cast<MVT_S>(simm8) << 56; break;
+#endif
+    case LerosInstr::store: {
+        m_reg[uimm8] = m_acc;
+        setModified(uimm8);
+      break;
+    }
+    case LerosInstr::out: m_io.out(uimm8, static_cast<MVT>(m_acc)); break;
+    case LerosInstr::in: m_acc = static_cast<MVT>(m_io.in(uimm8)); break;
+    case LerosInstr::jal: {
+      m_reg[uimm8] = m_pc + ILEN; // Store PC + 2 bytes
+      setModified(uimm8);
+      m_pc = static_cast<MVT>(m_acc);
+      timing.taken();
+      timing.jal(m_pc, m_reg[uimm8], m_instructionsExecuted);
+      return ALL_OK;
+    }
+    case LerosInstr::br: m_pc += simm13lsb0; timing.taken(); return ALL_OK;
+    case LerosInstr::brz: {
+      if (m_acc == 0) {
+        m_pc += simm13lsb0;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::brnz: {
+      if (m_acc != 0) {
+        m_pc += simm13lsb0;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::brp: {
+      if (m_acc >= 0) {
+        m_pc += simm13lsb0;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::brn: {
+      if (m_acc < 0) {
+        m_pc += simm13lsb0;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::ldaddr: m_addr = m_reg[uimm8]; break;
+    case LerosInstr::ldind: {
+      const auto addr = (m_addr + (simm8 << WORDSHIFT));
+      const auto value = static_cast<MVT_S>(memRead(addr, WORDSIZE));
+      m_acc = value;
+      timing.load(addr);
+      break;
+    }
+    case LerosInstr::ldindb: m_acc = signextend<MVT_S,8>(memRead(m_addr + simm8, 1)); timing.load(m_addr + simm8); break;
+    case LerosInstr::ldindh: m_acc = signextend<MVT_S,16>(memRead(m_addr + (simm8 << 1), 2)); timing.load(m_addr + (simm8 << 1)); break;
+
+    case LerosInstr::stind:{
+        const auto addr = (m_addr + (simm8 << WORDSHIFT));
+        memWrite(addr, m_acc, WORDSIZE);
+        timing.store(addr);
+        break;
+    }
+    case LerosInstr::stindb: memWrite((m_addr + simm8), m_acc & 0xFF, 1); timing.store(m_addr + simm8); break;
+    case LerosInstr::stindh: memWrite((m_addr + (simm8 << 1)), m_acc & 0xFFFF, 2); timing.store(m_addr + (simm8 << 1)); break;
+    case LerosInstr::scall: {
+      timing.scall(uimm8);
+      const int retval = syscall(uimm8);
+      if (retval != ALL_OK) {
+        return retval;
+      }
+      break;
+    }
+    }
+    // clang-format on
+
+    m_pc += ILEN;
+    return ALL_OK;
+  }
+
+  // Execute 'scall n'. Returns SCALL for the calls which stop the program.
+  int syscall(unsigned n) { return m_syscalls[n](*this); }
+
+  // Fill the system call table with the built in calls. Unknown calls stop
+  // the program.
+  void installSyscalls() {
+    m_syscalls.fill(&LerosSim::sysStop);
+    m_syscalls[SCALL_INSTRUCTIONS] = &LerosSim::sysInstructions;
+    m_syscalls[SCALL_PUTCHAR] = &LerosSim::sysPutchar;
+    m_syscalls[SCALL_CORE] = &LerosSim::sysCore;
+    m_syscalls[SCALL_SWAP] = &LerosSim::sysSwap;
+    m_syscalls[SCALL_FETCH_ADD] = &LerosSim::sysFetchAdd;
+    m_syscalls[SCALL_OPENAT] = &LerosSim::sysOpenat;
+    m_syscalls[SCALL_CLOSE] = &LerosSim::sysClose;
+    m_syscalls[SCALL_LSEEK] = &LerosSim::sysLseek;
+    m_syscalls[SCALL_READ] = &LerosSim::sysRead;
+    m_syscalls[SCALL_WRITE] = &LerosSim::sysWrite;
+    m_syscalls[SCALL_EXIT] = &LerosSim::sysExit;
+    m_syscalls[SCALL_CLOCK_GETTIME] = &LerosSim::sysClockGettime;
+    m_syscalls[SCALL_BRK] = &LerosSim::sysBrk;
+  }
+
+  // Return 'value' from a system call
+  int sysReturn(int64_t value) {
+    m_reg[4] = static_cast<MVT_S>(value);
+    return ALL_OK;
+  }
+
+  int sysStop() { return SCALL; }
+
+  int sysInstructions() { return sysReturn(m_instructionsExecuted); }
+
+  int sysPutchar() {
+    std::cout << static_cast<char>(m_acc);
+    std::cout.flush();
+    return ALL_OK;
+  }
+
+  int sysCore() {
+    m_reg[5] = m_options.numCores;
+    return sysReturn(m_options.coreId);
+  }
+
+  int sysSwap() {
+    const MVT value = m_acc;
+    m_acc = m_mem.update(m_addr, [value](MVT) { return value; });
+    return ALL_OK;
+  }
+
+  // Returns the previous value in the accumulator
+  int sysFetchAdd() {
+    const MVT value = m_acc;
+    m_acc = m_mem.update(m_addr, [value](MVT old) { return old + value; });
+    return ALL_OK;
+  }
+
+  int sysExit() {
+    m_exited = true;
+    m_exitCode = m_reg[4];
+    return SCALL;
+  }
+
+  // Host descriptor of guest descriptor 'fd', or -1
+  int hostFd(MVT fd) const {
+    return fd < m_fds.size() ? m_fds[fd] : -1;
+  }
+
+  // Close the files opened by the program, and restore the standard streams
+  void closeFiles() {
+    for (size_t fd = 3; fd < m_fds.size(); fd++) {
+      if (m_fds[fd] >= 0) {
+        ::close(m_fds[fd]);
+      }
+    }
+    m_fds = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  }
+
+  // Host open() flags of newlib's
+  static int hostOpenFlags(MVT flags) {
+    int host = flags & 3; // O_RDONLY, O_WRONLY, O_RDWR
+    if (flags & 0x0008)
+      host |= O_APPEND;
+    if (flags & 0x0200)
+      host |= O_CREAT;
+    if (flags & 0x0400)
+      host |= O_TRUNC;
+    if (flags & 0x0800)
+      host |= O_EXCL;
+    return host;
+  }
+
+  int sysOpenat() {
+    std::string path;
+    for (MVT a = m_reg[5];; a++) {
+      const char c = memRead(a, 1);
+      if (c == 0) {
+        break;
+      }
+      if (path.size() == 4096) {
+        return sysReturn(-ENAMETOOLONG);
+      }
+      path += c;
+    }
+    int dirfd = AT_FDCWD;
+    if (m_reg[4] != SCALL_AT_FDCWD && (dirfd = hostFd(m_reg[4])) < 0) {
+      return sysReturn(-EBADF);
+    }
+    const int fd = ::openat(dirfd, path.c_str(), hostOpenFlags(m_reg[6]),
+                            m_reg[7] & 07777);
+    if (fd < 0) {
+      return sysReturn(-errno);
+    }
+    // Like the host, use the lowest free descriptor
+    const auto it = std::find(m_fds.begin(), m_fds.end(), -1);
+    if (it != m_fds.end()) {
+      *it = fd;
+      return sysReturn(it - m_fds.begin());
+    }
+    m_fds.push_back(fd);
+    return sysReturn(m_fds.size() - 1);
+  }
+
+  // The standard streams are only closed for the program
+  int sysClose() {
+    const int fd = hostFd(m_reg[4]);
+    if (fd < 0) {
+      return sysReturn(-EBADF);
+    }
+    if (m_reg[4] > STDERR_FILENO && ::close(fd) < 0) {
+      return sysReturn(-errno);
+    }
+    m_fds[m_reg[4]] = -1;
+    return sysReturn(0);
+  }
+
+  int sysLseek() {
+    const int fd = hostFd(m_reg[4]);
+    if (fd < 0) {
+      return sysReturn(-EBADF);
+    }
+    const off_t offset = ::lseek(fd, static_cast<MVT_S>(m_reg[5]), m_reg[6]);
+    return sysReturn(offset < 0 ? -errno : offset);
+  }
+
+  // read() and write() transfer up to this many bytes per host call
+  static constexpr size_t kIOChunk = 1 << 20;
+
+  // Whether [buf, buf + len) lies within a loaded segment, the heap, the
+  // input arguments or the stacks, for the buffers of read() and write()
+  bool validBuffer(MVT buf, MVT len) const {
+    const MVT end = buf + len;
+    if (len == 0) {
+      return true;
+    }
+    if (end < buf) {
+      return false;
+    }
+    const auto within = [&](MVT start, MVT limit) {
+      return buf >= start && end <= limit;
+    };
+    for (const auto &seg : m_segments) {
+      if (within(seg.start, seg.end)) {
+        return true;
+      }
+    }
+    const MVT brk = m_sharedBrk ? m_sharedBrk->load() : m_brk;
+    return within(m_brkStart, brk) ||
+           within(ARGV_START, ARGV_START + m_args.size() * WORDSIZE) ||
+           within(STACK_START - m_options.numCores * STACK_SIZE,
+                  MVT(STACK_START) + 0x10);
+  }
+
+  // Read into the buffer through the host buffer, returning when the host
+  // returns less than requested, ie. at the end of a line of terminal input
+  int sysRead() {
+    const int fd = hostFd(m_reg[4]);
+    if (fd < 0) {
+      return sysReturn(-EBADF);
+    }
+    if (fd == STDIN_FILENO) {
+      std::cout.flush();
+    }
+    MVT buf = m_reg[5];
+    MVT len = m_reg[6];
+    if (!validBuffer(buf, len)) {
+      return sysReturn(-EFAULT);
+    }
+    int64_t total = 0;
+    while (len != 0) {
+      const size_t n = len < kIOChunk ? len : kIOChunk;
+      m_ioBuffer.resize(std::max(m_ioBuffer.size(), n));
+      const ssize_t r = ::read(fd, m_ioBuffer.data(), n);
+      if (r < 0) {
+        return sysReturn(total != 0 ? total : -errno);
+      }
+      m_mem.writeBlock(buf, m_ioBuffer.data(), r);
+      buf += r;
+      len -= r;
+      total += r;
+      if (size_t(r) < n) {
+        break;
+      }
+    }
+    return sysReturn(total);
+  }
+
+  // Copy the buffer out of guest memory in one block, and write it with as few
+  // host calls as possible. Output of the UART and putchar is flushed first.
+  int sysWrite() {
+    const int fd = hostFd(m_reg[4]);
+    if (fd < 0) {
+      return sysReturn(-EBADF);
+    }
+    if (fd == STDOUT_FILENO || fd == STDERR_FILENO) {
+      std::cout.flush();
+    }
+    MVT buf = m_reg[5];
+    MVT len = m_reg[6];
+    if (!validBuffer(buf, len)) {
+      return sysReturn(-EFAULT);
+    }
+    int64_t total = 0;
+    while (len != 0) {
+      const size_t n = len < kIOChunk ? len : kIOChunk;
+      m_ioBuffer.resize(std::max(m_ioBuffer.size(), n));
+      m_mem.readBlock(buf, m_ioBuffer.data(), n);
+      for (size_t done = 0; done < n;) {
+        const ssize_t w = ::write(fd, m_ioBuffer.data() + done, n - done);
+        if (w < 0) {
+          return sysReturn(total != 0 ? total : -errno);
+        }
+        done += w;
+        total += w;
+      }
+      buf += n;
+      len -= n;
+    }
+    return sysReturn(total);
+  }
+
+  // The timespec holds a 64 bit tv_sec followed by a word sized tv_nsec.
+  // Clocks are numbered like on Linux: 0 is CLOCK_REALTIME and 1
+  // CLOCK_MONOTONIC.
+  int sysClockGettime() {
+    if (m_reg[4] != 0 && m_reg[4] != 1) {
+      return sysReturn(-EINVAL);
+    }
+    struct timespec ts;
+    ::clock_gettime(m_reg[4] == 0 ? CLOCK_REALTIME : CLOCK_MONOTONIC, &ts);
+    const MVT tp = m_reg[5];
+    const uint64_t sec = ts.tv_sec;
+    memWrite(tp, static_cast<MVT>(sec), WORDSIZE);
+    if (WORDSIZE == 4) {
+      memWrite(tp + 4, static_cast<MVT>(sec >> 16 >> 16), 4);
+    }
+    memWrite(tp + 8, ts.tv_nsec, WORDSIZE);
+    return sysReturn(0);
+  }
+
+  // Like Linux brk(), the break is left unchanged if the requested one is out
+  // of range, ie. 0. The heap may grow up to the stacks.
+  int sysBrk() {
+    const MVT brk = m_reg[4];
+    const MVT limit = STACK_START - m_options.numCores * STACK_SIZE;
+    const bool inRange = brk >= m_brkStart && brk <= limit;
+    if (m_sharedBrk) {
+      // brk() sets the break rather than growing it, so concurrent calls are
+      // serialized by the allocator of the guest (see MultiCoreSim)
+      if (inRange) {
+        m_sharedBrk->store(brk);
+        return sysReturn(brk);
+      }
+      return sysReturn(m_sharedBrk->load());
+    }
+    if (inRange) {
+      if (m_options.sanitize && brk > m_brk) {
+        m_mem.addMappedRange(m_brk, brk);
+      }
+      m_brk = brk;
+    }
+    return sysReturn(m_brk);
+  }
+
+  // Execute a predecoded instruction or superinstruction
+  template <typename Timing>
+  int execDecoded(const DecodedInstr &d, Timing &timing) {
+    m_watchHit = false;
+    // Predecoding turns subi into addi, so the opcode is fetched again
+    timing.instr(m_pc, [this] { return decodeOpcode(m_mem.fetch(m_pc) >> 8); });
+
+    // clang-format off
+    switch (d.op) {
+    default:
+    case LerosInstr::unknown: assert("Unknown instruction"); break;
+    case LerosInstr::nop: break;
+    case LerosInstr::addi: m_acc += d.imm; break;
+    case LerosInstr::add:  m_acc += m_reg[d.reg]; break;
+    case LerosInstr::sub:  m_acc -= m_reg[d.reg]; break;
+    case LerosInstr::sra: {
+      m_acc >>= 1;
+      break;
+    }
+    case LerosInstr::loadi:  m_acc = d.imm; break;
+    case LerosInstr::load:   m_acc = m_reg[d.reg]; break;
+    case LerosInstr::Andi:   m_acc &= d.imm; break;
+    case LerosInstr::And:    m_acc &= m_reg[d.reg]; break;
+    case LerosInstr::Ori:    m_acc |= d.imm; break;
+    case LerosInstr::Or:     m_acc |= m_reg[d.reg]; break;
+    case LerosInstr::Xori:   m_acc ^= d.imm; break;
+    case LerosInstr::Xor:    m_acc ^= m_reg[d.reg]; break;
+    case LerosInstr::loadhi:  m_acc = (m_acc & 0xff) | d.imm;  break;
+    case LerosInstr::loadh2i: m_acc = (m_acc & 0xffff) | d.imm; break;
+    case LerosInstr::loadh3i: m_acc = (m_acc & 0xffffff) | d.imm; break;
+#ifdef LEROS64
+    case LerosInstr::loadh4i: m_acc = (m_acc & 0xffffffff) | d.imm; break;
+    case LerosInstr::loadh5i: m_acc = (m_acc & 0xffffffffff) | d.imm; break;
+    case LerosInstr::loadh6i: m_acc = (m_acc & 0xffffffffffff) | d.imm; break;
+    case LerosInstr::loadh7i: m_acc = (m_acc & 0xffffffffffffff) | d.imm; break;
+#endif
+    case LerosInstr::store: {
+        m_reg[d.reg] = m_acc;
+        setModified(d.reg);
+      break;
+    }
+    case LerosInstr::out: m_io.out(d.reg, static_cast<MVT>(m_acc)); break;
+    case LerosInstr::in: m_acc = static_cast<MVT>(m_io.in(d.reg)); break;
+    case LerosInstr::jal: {
+      m_reg[d.reg] = m_pc + ILEN; // Store PC + 2 bytes
+      setModified(d.reg);
+      m_pc = static_cast<MVT>(m_acc);
+      timing.taken();
+      timing.jal(m_pc, m_reg[d.reg], m_instructionsExecuted);
+      return ALL_OK;
+    }
+    case LerosInstr::br: m_pc = d.target; timing.taken(); return ALL_OK;
+    case LerosInstr::brz: {
+      if (m_acc == 0) {
+        m_pc = d.target;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::brnz: {
+      if (m_acc != 0) {
+        m_pc = d.target;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::brp: {
+      if (m_acc >= 0) {
+        m_pc = d.target;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::brn: {
+      if (m_acc < 0) {
+        m_pc = d.target;
+        timing.taken();
+        return ALL_OK;
+      }
+      timing.notTaken();
+      break;
+    }
+    case LerosInstr::ldaddr: m_addr = m_reg[d.reg]; break;
+    case LerosInstr::ldind: {
+      const auto addr = (m_addr + d.imm);
+      const auto value = static_cast<MVT_S>(memRead(addr, WORDSIZE));
+      m_acc = value;
+      timing.load(addr);
+      break;
+    }
+    case LerosInstr::ldindb: m_acc = signextend<MVT_S,8>(memRead(m_addr + d.imm, 1)); timing.load(m_addr + d.imm); break;
+    case LerosInstr::ldindh: m_acc = signextend<MVT_S,16>(memRead(m_addr + d.imm, 2)); timing.load(m_addr + d.imm); break;
+
+    case LerosInstr::stind:{
+        const auto addr = (m_addr + d.imm);
+        memWrite(addr, m_acc, WORDSIZE);
+        timing.store(addr);
+        break;
+    }
+    case LerosInstr::stindb: memWrite((m_addr + d.imm), m_acc & 0xFF, 1); timing.store(m_addr + d.imm); break;
+    case LerosInstr::stindh: memWrite((m_addr + d.imm), m_acc & 0xFFFF, 2); timing.store(m_addr + d.imm); break;
+    case LerosInstr::scall: {
+      timing.scall(d.reg);
+      const int retval = syscall(d.reg);
+      if (retval != ALL_OK) {
+        return retval;
+      }
+      break;
+    }
+
+    // Superinstructions. Those accessing memory move the PC to the memory
+    // instruction first, such that diagnostics refer to it.
+    case LerosInstr::fused_loadconst: m_acc = d.imm; break;
+    case LerosInstr::fused_loadi_br: m_acc = d.imm; m_pc = d.target; return ALL_OK;
+    case LerosInstr::fused_load_brz: {
+      m_acc = m_reg[d.reg];
+      m_pc = m_acc == 0 ? d.target : m_pc + 2 * ILEN;
+      return ALL_OK;
+    }
+    case LerosInstr::fused_load_brnz: {
+      m_acc = m_reg[d.reg];
+      m_pc = m_acc != 0 ? d.target : m_pc + 2 * ILEN;
+      return ALL_OK;
+    }
+    case LerosInstr::fused_load_add_store: {
+      m_acc = m_reg[d.reg] + m_reg[d.reg2];
+      m_reg[d.reg3] = m_acc;
+      setModified(d.reg3);
+      break;
+    }
+    case LerosInstr::fused_load_sub_store: {
+      m_acc = m_reg[d.reg] - m_reg[d.reg2];
+      m_reg[d.reg3] = m_acc;
+      setModified(d.reg3);
+      break;
+    }
+    case LerosInstr::fused_load_addi_store: {
+      m_acc = m_reg[d.reg] + d.imm;
+      m_reg[d.reg3] = m_acc;
+      setModified(d.reg3);
+      break;
+    }
+    case LerosInstr::fused_ldaddr_ldind: {
+      m_addr = m_reg[d.reg];
+      m_pc += ILEN;
+      m_acc = static_cast<MVT_S>(memRead(m_addr + d.imm, WORDSIZE));
+      m_pc += ILEN;
+      return ALL_OK;
+    }
+    case LerosInstr::fused_ldaddr_stind: {
+      m_addr = m_reg[d.reg];
+      m_pc += ILEN;
+      memWrite(m_addr + d.imm, m_acc, WORDSIZE);
+      m_pc += ILEN;
+      return ALL_OK;
+    }
+    }
+    // clang-format on
+
+    m_pc += d.len * ILEN;
+    return ALL_OK;
+  }
+
+  std::bitset<256> m_modifiedRegs;
+  PagedMemory<MVT> m_mem;
+  std::array<MVT_S, 256> m_reg = {};
+  // Ring buffer recording the 128 most recent PC's during execution
+  std::array<MVT, 128> m_trace;
+  uint64_t m_tracePos = 0;
+  MVT_S m_acc = 0;
+  MVT m_addr = 0;
+  MVT m_pc = 0;
+  MVT m_entryPoint = 0;
+
+  // Loaded segments and their permissions (PF_R, PF_W, PF_X)
+  struct Segment {
+    MVT start;
+    MVT end;
+    uint32_t flags;
+  };
+  std::vector<Segment> m_segments;
+
+  // Executable instruction slots, one bit per ILEN bytes from m_execStart
+  MVT m_execStart = 0;
+  MVT m_execSlots = 0;
+  std::vector<uint64_t> m_executable;
+  // Predecoded instructions, indexed like m_executable
+  std::vector<DecodedInstr> m_decoded;
+  bool m_fuse = true;
+
+  // Blocks of the block engine, indexed by their first slot
+  std::vector<std::unique_ptr<ExecBlock>> m_blocks;
+  bool m_flushBlocks = false;
+  uint64_t m_instructionsExecuted = 0;
+  // Timing model state, indexed like m_executable
+  bool m_timed = false;
+  uint64_t m_cycles = 0;
+  std::vector<uint64_t> m_slotCycles;
+  std::vector<uint64_t> m_slotInstrs;
+  std::vector<Cache> m_caches;
+  Coverage m_coverage;
+  CallProfile m_calls;
+  uint64_t m_codeWrites = 0;
+  uint64_t m_codeVersion = newCodeVersion();
+  bool m_isELF = false;
+  bool m_loaded = false;
+  ProgramImage m_image;
+  std::vector<MVT> m_args;
+
+  // Debugger state
+  struct Watchpoint {
+    MVT addr;
+    MVT len;
+    WatchKind kind;
+    bool trace;
+  };
+  std::vector<uint64_t> m_breakpoints; // indexed like m_executable
+  unsigned m_numBreakpoints = 0;
+  std::vector<Watchpoint> m_watchpoints;
+  bool m_watchHit = false;
+  MVT m_watchHitAddr = 0;
+  WatchKind m_watchHitKind = WatchKind::Write;
+  RW m_watchHitRW = RW::Read;
+  MVT m_watchHitPC = 0;
+  std::vector<WatchAccess> m_accessLog; // ring buffer of traced accesses
+  uint64_t m_accessLogCount = 0;
+
+  // Memory sanitizer state
+  struct Region {
+    std::string name;
+    MVT start;
+    MVT end;
+  };
+  std::vector<Region> m_regions;
+  // Mapped ranges of the loaded program, without the heap and arguments
+  PagedMemory<MVT>::MappedRanges m_loadedRanges;
+  size_t m_argvRegion = 0;
+  std::set<std::pair<MVT, int>> m_sanitizerReports;
+
+  IOBus m_io;
+  std::unique_ptr<std::ifstream> m_uartInput;
+
+  // System call state. Guest file descriptors index m_fds, which holds the
+  // host descriptors, or -1 for closed ones.
+  std::array<SyscallHandler, 256> m_syscalls;
+  std::vector<int> m_fds = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  std::vector<uint8_t> m_ioBuffer;
+  MVT m_brkStart = 0;
+  MVT m_brk = 0;
+  // Break shared by the cores of a multi-core system, used instead of m_brk
+  std::atomic<MVT> *m_sharedBrk = nullptr;
+  bool m_exited = false;
+  MVT_S m_exitCode = 0;
+
+  // Counts of consecutive instruction pairs, indexed by
+  // first * NUM_BASE_INSTRS + second
+  std::vector<uint64_t> m_pairCounts;
+  unsigned m_prevOp = NUM_BASE_INSTRS; // none yet
+
+  LerosOptions m_options;
+};
+
+#endif // LEROS_SIM_H
@@ -0,0 +1,550 @@
+#include "lockstep.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The engine is compiled for several instruction sets, one of which is
+// selected when the program is loaded
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LOCKSTEP_CLONES                                                        \
+  __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LOCKSTEP_CLONES
+#endif
+
+namespace {
+
+template <typename V> bool any(const V &v) {
+  bool r = false;
+  for (unsigned l = 0; l < LockstepSim::kLanes; l++) {
+    r |= v[l] != 0;
+  }
+  return r;
+}
+
+// Replace the elements of 'v' with those of 'a' where 'mask' is all-ones
+template <typename V, typename T>
+void blend(V &v, const V &mask, const T &a) {
+  v = (a & mask) | (v & ~mask);
+}
+
+} // namespace
+
+LockstepSim::LockstepSim() : m_lanes(nullptr, free) {
+  void *p = aligned_alloc(alignof(Lanes), sizeof(Lanes));
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  memset(p, 0, sizeof(Lanes));
+  m_lanes.reset(static_cast<Lanes *>(p));
+}
+
+LockstepSim::~LockstepSim() = default;
+
+const char *LockstepSim::isa() {
+#if defined(__GNUC__) && defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return "avx512f";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return "avx2";
+  }
+#endif
+  return "generic";
+}
+
+std::shared_ptr<const LockstepSim::Program>
+LockstepSim::loadProgram(const std::string &filename) {
+  auto program = std::make_shared<Program>();
+  if (!program->image.load(filename)) {
+    return nullptr;
+  }
+
+  // The heap starts after the last segment, like in LerosSim
+  for (const auto &seg : program->image.segments()) {
+    program->brk = std::max(program->brk, MVT(seg.vaddr + seg.memsz));
+  }
+  program->brk = (program->brk + 15) & ~MVT(15);
+
+  // Decode the executable segments, with the zero filled remainder of a
+  // segment decoding as nop's
+  MVT start = ~MVT(0);
+  MVT end = 0;
+  for (const auto &seg : program->image.segments()) {
+    if (seg.flags & PF_X) {
+      program->code.push_back({static_cast<MVT>(seg.vaddr & ~MVT(ILEN - 1)),
+                               static_cast<MVT>(seg.vaddr + seg.memsz)});
+      start = std::min(start, program->code.back().first);
+      end = std::max(end, program->code.back().second);
+    }
+  }
+  if (start >= end) {
+    return program;
+  }
+  program->execStart = start;
+  program->decoded.assign((end - start + ILEN - 1) / ILEN,
+                          DecodedInstr{LerosInstr::unknown, 0, 0, 0, 0, 0, 0});
+  for (const auto &seg : program->image.segments()) {
+    if (!(seg.flags & PF_X)) {
+      continue;
+    }
+    const auto byteAt = [&](MVT addr) -> uint8_t {
+      return addr >= seg.vaddr && addr < seg.vaddr + seg.filesz
+                 ? seg.data[addr - seg.vaddr]
+                 : 0;
+    };
+    for (MVT pc = seg.vaddr & ~MVT(ILEN - 1); pc < seg.vaddr + seg.memsz;
+         pc += ILEN) {
+      const uint16_t instr = byteAt(pc) | (byteAt(pc + 1) << 8);
+      DecodedInstr &d = program->decoded[(pc - start) / ILEN];
+      if (LerosSim::decodeOpcode(instr >> 8) == LerosInstr::unknown) {
+        d = DecodedInstr{LerosInstr::unknown, 1, 0, 0, 0, 0, 0};
+      } else {
+        d = LerosSim::decode(instr, pc);
+      }
+    }
+  }
+  return program;
+}
+
+bool LockstepSim::load(const std::string &filename) {
+  auto program = loadProgram(filename);
+  if (!program) {
+    m_program.reset();
+    return false;
+  }
+  setProgram(std::move(program));
+  return true;
+}
+
+void LockstepSim::setProgram(std::shared_ptr<const Program> program) {
+  m_program = std::move(program);
+  memset(static_cast<void *>(m_lanes.get()), 0, sizeof(Lanes));
+
+  // Each lane copies the pages it touches from the file mapping, which is
+  // shared by all lanes and therefore never aliased
+  for (unsigned l = 0; l < kLanes; l++) {
+    m_mem[l].reset(new PagedMemory<MVT>());
+    m_mem[l]->setObserver(&m_codeObservers[l]);
+    for (const auto &seg : m_program->image.segments()) {
+      m_mem[l]->addBacking(seg.vaddr, seg.data, seg.filesz, false);
+    }
+  }
+}
+
+void LockstepSim::reset(unsigned lane, const std::vector<MVT> &args) {
+  Lanes &s = *m_lanes;
+  PagedMemory<MVT> &mem = *m_mem[lane];
+  mem.clear();
+  for (const auto &code : m_program->code) {
+    mem.setFlags(code.first, code.second, CodeWrite);
+  }
+  m_codeObservers[lane].written = false;
+
+  for (auto &r : s.reg) {
+    r[lane] = 0;
+  }
+  s.acc[lane] = 0;
+  s.addr[lane] = 0;
+  s.pc[lane] = m_program->image.entry();
+  if (m_program->image.isELF()) {
+    for (size_t j = 0; j < args.size(); j++) {
+      mem.write(ARGV_START + j * WORDSIZE, args[j], WORDSIZE);
+    }
+    s.reg[4][lane] = args.size();
+    s.reg[5][lane] = ARGV_START;
+  }
+  s.reg[1][lane] = STACK_START;
+
+  s.brk[lane] = m_program->brk;
+  s.argc[lane] = args.size();
+
+  s.active[lane] = ~MVT(0);
+  s.count[lane] = 0;
+  s.status[lane] = ALL_OK;
+}
+
+void LockstepSim::run(uint64_t maxInstructions,
+                      std::chrono::steady_clock::time_point deadline) {
+  Lanes &s = *m_lanes;
+  if (!m_program) {
+    return;
+  }
+  for (unsigned l = 0; l < kLanes; l++) {
+    s.limit[l] = maxInstructions != 0 ? s.count[l] + maxInstructions
+                                      : std::numeric_limits<uint64_t>::max();
+  }
+  s.split = true;
+
+  const bool timed = deadline != std::chrono::steady_clock::time_point::max();
+  while (any(s.active)) {
+    // A lane executes at most one instruction per step, so a batch never
+    // exceeds the remaining budget of any lane
+    uint64_t batch = kRunBatch;
+    for (unsigned l = 0; l < kLanes; l++) {
+      if (s.active[l]) {
+        batch = std::min(batch, s.limit[l] - s.count[l]);
+      }
+    }
+    s.steps = LaneVec{};
+    execute(batch);
+    for (unsigned l = 0; l < kLanes; l++) {
+      s.count[l] += s.steps[l];
+    }
+
+    LaneVec stop = LaneVec{};
+    for (unsigned l = 0; l < kLanes; l++) {
+      stop[l] = s.active[l] && s.count[l] >= s.limit[l] ? ~MVT(0) : 0;
+    }
+    if (any(stop)) {
+      stopLanes(stop, INSTRUCTION_LIMIT);
+    }
+    if (timed && any(s.active) &&
+        std::chrono::steady_clock::now() >= deadline) {
+      stopLanes(s.active, TIMEOUT);
+    }
+  }
+}
+
+MVT LockstepSim::readRegister(unsigned lane, unsigned idx) const {
+  const Lanes &s = *m_lanes;
+  switch (idx) {
+  case REG_ACC:
+    return s.acc[lane];
+  case REG_ADDR:
+    return s.addr[lane];
+  case REG_PC:
+    return s.pc[lane];
+  default:
+    return idx < 256 ? s.reg[idx][lane] : 0;
+  }
+}
+
+void LockstepSim::split() {
+  Lanes &s = *m_lanes;
+  if (!s.split) {
+    blend(s.pc, s.active, s.groupPC);
+    s.split = true;
+  }
+}
+
+void LockstepSim::regroup() {
+  Lanes &s = *m_lanes;
+  MVT pc = ~MVT(0);
+  for (unsigned l = 0; l < kLanes; l++) {
+    if (s.active[l] && s.pc[l] < pc) {
+      pc = s.pc[l];
+    }
+  }
+  s.groupPC = pc;
+  s.exec = s.active & (LaneVec)(s.pc == pc);
+  s.split = any(s.exec ^ s.active);
+}
+
+void LockstepSim::stopLanes(const LaneVec &stop, int status) {
+  Lanes &s = *m_lanes;
+  // 'stop' may refer to the lane state
+  const LaneVec lanes = stop;
+  split();
+  for (unsigned l = 0; l < kLanes; l++) {
+    if (lanes[l]) {
+      s.status[l] = status;
+    }
+  }
+  s.active &= ~lanes;
+  s.exec &= ~lanes;
+}
+
+bool LockstepSim::validBuffer(unsigned lane, MVT buf, MVT len) const {
+  const Lanes &s = *m_lanes;
+  const MVT end = buf + len;
+  if (len == 0) {
+    return true;
+  }
+  if (end < buf) {
+    return false;
+  }
+  const auto within = [&](MVT start, MVT limit) {
+    return buf >= start && end <= limit;
+  };
+  for (const auto &seg : m_program->image.segments()) {
+    if (within(seg.vaddr, seg.vaddr + seg.memsz)) {
+      return true;
+    }
+  }
+  return within(m_program->brk, s.brk[lane]) ||
+         within(ARGV_START, ARGV_START + s.argc[lane] * WORDSIZE) ||
+         within(STACK_START - STACK_SIZE, MVT(STACK_START) + 0x10);
+}
+
+LOCKSTEP_CLONES void LockstepSim::execute(unsigned steps) {
+  Lanes &s = *m_lanes;
+  LaneVec &acc = s.acc;
+  const DecodedInstr *const decoded = m_program->decoded.data();
+  const MVT execStart = m_program->execStart;
+  const size_t numDecoded = m_program->decoded.size();
+
+  for (unsigned i = 0; i < steps; i++) {
+    if (s.split) {
+      if (!any(s.active)) {
+        return;
+      }
+      regroup();
+    }
+    const MVT pc = s.groupPC;
+    const LaneVec exec = s.exec;
+    s.steps += exec & 1;
+
+    // Lanes leaving the executable segments exit, like LerosSim::step()
+    const MVT slot = (pc - execStart) / ILEN;
+    if (slot >= numDecoded || decoded[slot].len == 0) {
+      stopLanes(exec, JAL_RA_EXIT);
+      continue;
+    }
+    if (pc & (ILEN - 1)) {
+      stopLanes(exec, ERROR);
+      continue;
+    }
+    const DecodedInstr &d = decoded[slot];
+
+    // The next PC of the executing lanes, unless they diverge
+    MVT next = pc + ILEN;
+    bool diverged = false;
+
+    // Branch to 'target' in the executing lanes where 'cond' is set
+    const auto branch = [&](const LaneVec &cond, MVT target) {
+      const LaneVec taken = cond & exec;
+      if (!any(taken)) {
+        return;
+      }
+      if (!any(taken ^ exec)) {
+        next = target;
+        return;
+      }
+      split();
+      blend(s.pc, exec, next);
+      blend(s.pc, taken, target);
+      diverged = true;
+    };
+
+    // Store the lanes' results of a memory access
+    const auto stored = [&]() {
+      LaneVec written = LaneVec{};
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (m_codeObservers[l].written) {
+          written[l] = ~MVT(0);
+          m_codeObservers[l].written = false;
+        }
+      }
+      if (any(written)) {
+        split();
+        blend(s.pc, exec, next);
+        diverged = true;
+        stopLanes(written, ERROR);
+      }
+    };
+
+    // clang-format off
+    switch (d.op) {
+    default:
+    case LerosInstr::unknown:
+    case LerosInstr::nop: break;
+    case LerosInstr::out:
+      if (d.reg == UART_PORT + UartDevice::DATA) {
+        for (unsigned l = 0; l < kLanes; l++) {
+          if (exec[l]) std::cout.put(static_cast<char>(acc[l]));
+        }
+      }
+      break;
+    case LerosInstr::in:
+      // Lanes have the cycle counter, but no input devices
+      if (d.reg == CYCLE_PORT + CycleCounterDevice::COUNT ||
+          d.reg == CYCLE_PORT + CycleCounterDevice::COUNT_HI) {
+        for (unsigned l = 0; l < kLanes; l++) {
+          const uint64_t count = s.count[l] + s.steps[l];
+          if (exec[l]) acc[l] = d.reg == CYCLE_PORT ? count : count >> 32;
+        }
+      } else if (d.reg < UART_PORT + UartDevice::NUM_REGS ||
+                 (d.reg >= TIMER_PORT &&
+                  d.reg < TIMER_PORT + TimerDevice::NUM_REGS)) {
+        stopLanes(exec, ERROR);
+        diverged = true;
+      } else {
+        blend(acc, exec, MVT(0));
+      }
+      break;
+    case LerosInstr::addi: acc += exec & MVT(d.imm); break;
+    case LerosInstr::add:  acc += exec & s.reg[d.reg]; break;
+    case LerosInstr::sub:  acc -= exec & s.reg[d.reg]; break;
+    case LerosInstr::sra:  blend(acc, exec, (LaneVec)((LaneVecS)acc >> 1)); break;
+    case LerosInstr::loadi: blend(acc, exec, MVT(d.imm)); break;
+    case LerosInstr::load:  blend(acc, exec, s.reg[d.reg]); break;
+    case LerosInstr::Andi:  acc &= MVT(d.imm) | ~exec; break;
+    case LerosInstr::And:   acc &= s.reg[d.reg] | ~exec; break;
+    case LerosInstr::Ori:   acc |= exec & MVT(d.imm); break;
+    case LerosInstr::Or:    acc |= exec & s.reg[d.reg]; break;
+    case LerosInstr::Xori:  acc ^= exec & MVT(d.imm); break;
+    case LerosInstr::Xor:   acc ^= exec & s.reg[d.reg]; break;
+    case LerosInstr::loadhi:  blend(acc, exec, (acc & 0xff) | MVT(d.imm)); break;
+    case LerosInstr::loadh2i: blend(acc, exec, (acc & 0xffff) | MVT(d.imm)); break;
+    case LerosInstr::loadh3i: blend(acc, exec, (acc & 0xffffff) | MVT(d.imm)); break;
+#ifdef LEROS64
+    case LerosInstr::loadh4i: blend(acc, exec, (acc & 0xffffffff) | MVT(d.imm)); break;
+    case LerosInstr::loadh5i: blend(acc, exec, (acc & 0xffffffffff) | MVT(d.imm)); break;
+    case LerosInstr::loadh6i: blend(acc, exec, (acc & 0xffffffffffff) | MVT(d.imm)); break;
+    case LerosInstr::loadh7i: blend(acc, exec, (acc & 0xffffffffffffff) | MVT(d.imm)); break;
+#endif
+    case LerosInstr::store:  blend(s.reg[d.reg], exec, acc); break;
+    case LerosInstr::ldaddr: blend(s.addr, exec, s.reg[d.reg]); break;
+    case LerosInstr::jal: {
+      blend(s.reg[d.reg], exec, pc + ILEN);
+      // Returns from a function called from several sites diverge
+      MVT target = 0;
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) {
+          target = acc[l];
+          break;
+        }
+      }
+      next = target;
+      if (any(exec & (acc ^ target))) {
+        split();
+        blend(s.pc, exec, acc);
+        diverged = true;
+      }
+      break;
+    }
+    case LerosInstr::br:   next = d.target; break;
+    case LerosInstr::brz:  branch((LaneVec)(acc == 0), d.target); break;
+    case LerosInstr::brnz: branch((LaneVec)(acc != 0), d.target); break;
+    case LerosInstr::brp:  branch((LaneVec)((LaneVecS)acc >= 0), d.target); break;
+    case LerosInstr::brn:  branch((LaneVec)((LaneVecS)acc < 0), d.target); break;
+    case LerosInstr::ldind:
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) acc[l] = m_mem[l]->read(s.addr[l] + d.imm, WORDSIZE);
+      }
+      break;
+    case LerosInstr::ldindb:
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) acc[l] = signextend<MVT_S, 8>(m_mem[l]->read(s.addr[l] + d.imm, 1));
+      }
+      break;
+    case LerosInstr::ldindh:
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) acc[l] = signextend<MVT_S, 16>(m_mem[l]->read(s.addr[l] + d.imm, 2));
+      }
+      break;
+    case LerosInstr::stind:
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) m_mem[l]->write(s.addr[l] + d.imm, acc[l], WORDSIZE);
+      }
+      stored();
+      break;
+    case LerosInstr::stindb:
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) m_mem[l]->write(s.addr[l] + d.imm, acc[l] & 0xFF, 1);
+      }
+      stored();
+      break;
+    case LerosInstr::stindh:
+      for (unsigned l = 0; l < kLanes; l++) {
+        if (exec[l]) m_mem[l]->write(s.addr[l] + d.imm, acc[l] & 0xFFFF, 2);
+      }
+      stored();
+      break;
+    case LerosInstr::scall: {
+      switch (d.reg) {
+      default:
+      case SCALL_STOP:
+      case SCALL_EXIT:
+        stopLanes(exec, SCALL);
+        diverged = true;
+        break;
+      case SCALL_OPENAT:
+      case SCALL_CLOSE:
+      case SCALL_LSEEK:
+      case SCALL_READ:
+      case SCALL_CLOCK_GETTIME:
+        // Lanes have no files or clocks
+        stopLanes(exec, ERROR);
+        diverged = true;
+        break;
+      case SCALL_WRITE: {
+        std::vector<uint8_t> buf;
+        for (unsigned l = 0; l < kLanes; l++) {
+          if (!exec[l]) continue;
+          const MVT fd = s.reg[4][l];
+          if (fd != STDOUT_FILENO && fd != STDERR_FILENO) {
+            s.reg[4][l] = -EBADF;
+            continue;
+          }
+          const MVT len = s.reg[6][l];
+          if (!validBuffer(l, s.reg[5][l], len)) {
+            s.reg[4][l] = -EFAULT;
+            continue;
+          }
+          std::ostream &os = fd == STDOUT_FILENO ? std::cout : std::cerr;
+          for (MVT done = 0; done < len; done += buf.size()) {
+            buf.resize(std::min<MVT>(len - done, 1 << 20));
+            m_mem[l]->readBlock(s.reg[5][l] + done, buf.data(), buf.size());
+            os.write(reinterpret_cast<const char *>(buf.data()), buf.size());
+          }
+          s.reg[4][l] = len;
+        }
+        std::cout.flush();
+        break;
+      }
+      case SCALL_BRK: {
+        const MVT limit = STACK_START - STACK_SIZE;
+        for (unsigned l = 0; l < kLanes; l++) {
+          if (!exec[l]) continue;
+          const MVT brk = s.reg[4][l];
+          if (brk >= m_program->brk && brk <= limit) {
+            s.brk[l] = brk;
+          }
+          s.reg[4][l] = s.brk[l];
+        }
+        break;
+      }
+      case SCALL_INSTRUCTIONS:
+        for (unsigned l = 0; l < kLanes; l++) {
+          if (exec[l]) s.reg[4][l] = s.count[l] + s.steps[l];
+        }
+        break;
+      case SCALL_PUTCHAR:
+        for (unsigned l = 0; l < kLanes; l++) {
+          if (exec[l]) std::cout << static_cast<char>(acc[l]);
+        }
+        std::cout.flush();
+        break;
+      case SCALL_CORE:
+        blend(s.reg[4], exec, MVT(0));
+        blend(s.reg[5], exec, MVT(1));
+        break;
+      case SCALL_SWAP:
+      case SCALL_FETCH_ADD:
+        for (unsigned l = 0; l < kLanes; l++) {
+          if (!exec[l]) continue;
+          const MVT value = acc[l];
+          acc[l] = m_mem[l]->update(s.addr[l], [&](MVT old) {
+            return d.reg == SCALL_SWAP ? value : old + value;
+          });
+        }
+        stored();
+        break;
+      }
+      break;
+    }
+    }
+    // clang-format on
+
+    if (!diverged) {
+      if (s.split) {
+        blend(s.pc, exec, next);
+      } else {
+        s.groupPC = next;
+      }
+    }
+  }
+}
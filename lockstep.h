@@ -0,0 +1,148 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "leros-sim.h"
+
+// Executes up to kLanes instances of a program in lockstep, for sweeping a
+// program over many input arguments. The accumulators, address registers and
+// registers of the lanes are held as vectors with one element per lane, so
+// that each instruction is executed for all lanes at once with SIMD
+// instructions (AVX-512 or AVX2 where available, chosen at run time).
+//
+// Lanes taking different branches are split: the lanes at the lowest PC
+// execute while the others wait, until they reach the same PC and are joined
+// again. Loops and if/else constructs therefore reconverge at their exits.
+//
+// Lanes execute like the predecoded engine without superinstructions, and each
+// lane has its own memory. There is no support for debugging (breakpoints,
+// watches, sanitizer), and lanes which store into the executable segments or
+// jump to misaligned addresses stop with ERROR. Of the I/O devices, lanes
+// have the UART output and the cycle counter; lanes reading the UART or the
+// timer stop with ERROR. Of the system calls, lanes have write() to stdout
+// and stderr, brk() and exit(); those using files or clocks stop with ERROR.
+class LockstepSim {
+public:
+  static constexpr unsigned kLanes = 16;
+
+  // A loaded program and its decoded executable segments. Programs are
+  // immutable, and shared by any number of LockstepSim's on any threads.
+  struct Program {
+    ProgramImage image;
+    // Decoded instructions, one per ILEN bytes from execStart. len is 0 for
+    // slots which are not executable.
+    std::vector<DecodedInstr> decoded;
+    MVT execStart = 0;
+    // Executable address ranges
+    std::vector<std::pair<MVT, MVT>> code;
+    // Initial program break
+    MVT brk = 0;
+  };
+
+  // Returns nullptr if the program could not be loaded
+  static std::shared_ptr<const Program> loadProgram(const std::string &filename);
+
+  LockstepSim();
+  ~LockstepSim();
+  LockstepSim(const LockstepSim &) = delete;
+  LockstepSim &operator=(const LockstepSim &) = delete;
+
+  // Load a program; returns false if it could not be loaded
+  bool load(const std::string &filename);
+  void setProgram(std::shared_ptr<const Program> program);
+
+  // Prepare 'lane' to run the program from the start with the given input
+  // arguments, like LerosSim::reset()
+  void reset(unsigned lane, const std::vector<MVT> &args);
+
+  // Run all lanes reset since the last run() until they stop, each executing
+  // at most 'maxInstructions' instructions (0 for no limit), or until
+  // 'deadline' has passed
+  void run(uint64_t maxInstructions = 0,
+           std::chrono::steady_clock::time_point deadline =
+               std::chrono::steady_clock::time_point::max());
+
+  // Reason for 'lane' to stop, like LerosSim::run()
+  int status(unsigned lane) const { return m_lanes->status[lane]; }
+  uint64_t instructionsExecuted(unsigned lane) const {
+    return m_lanes->count[lane];
+  }
+  // Registers r0-r255 and the DebugReg registers of 'lane'
+  MVT readRegister(unsigned lane, unsigned idx) const;
+  uint8_t readByte(unsigned lane, MVT addr) const {
+    return m_mem[lane]->peek(addr);
+  }
+
+  // Vector instruction set used by this host: "avx512f", "avx2" or "generic"
+  static const char *isa();
+
+private:
+  // The alignment is given explicitly, as it would otherwise depend on the
+  // instruction set a function is compiled for
+  typedef MVT LaneVec
+      __attribute__((vector_size(kLanes * sizeof(MVT)), aligned(64)));
+  typedef MVT_S LaneVecS
+      __attribute__((vector_size(kLanes * sizeof(MVT)), aligned(64)));
+
+  // All state modified while running, in a single cache line aligned block
+  // such that LockstepSim's on different threads never share cache lines.
+  // The registers are stored as arrays of vectors with one element per lane.
+  struct Lanes {
+    LaneVec acc;
+    LaneVec addr;
+    LaneVec reg[256];
+    // PC of each lane. Only up to date for all lanes while they are split.
+    LaneVec pc;
+    // All-ones for the lanes which are running, and for those which execute
+    // the current instruction
+    LaneVec active;
+    LaneVec exec;
+    // Instructions executed by each lane within the current batch
+    LaneVec steps;
+
+    uint64_t count[kLanes];
+    uint64_t limit[kLanes];
+    // Program break and number of input arguments of each lane
+    MVT brk[kLanes];
+    MVT argc[kLanes];
+    int status[kLanes];
+
+    // PC of the executing group. While the lanes are joined, all active lanes
+    // are at this PC, and 'pc' is not kept up to date.
+    MVT groupPC;
+    bool split;
+  };
+
+  // Flags stores into code; stopping the lane is left to the engine
+  struct CodeObserver : public MemoryObserver<MVT> {
+    bool written = false;
+    void watchedAccess(MVT, unsigned, RW) override {}
+    void shadowFault(MVT, unsigned, RW, ShadowFault) override {}
+    void codeWritten(MVT, unsigned) override { written = true; }
+  };
+
+  // Execute up to 'steps' instructions of the lane groups
+  void execute(unsigned steps);
+  // Write back the PC of the joined lanes, before they diverge
+  void split();
+  // Select the group of lanes at the lowest PC to execute next
+  void regroup();
+  void stopLanes(const LaneVec &lanes, int status);
+  // Whether the write() buffer of 'lane' lies within memory the program may
+  // access, like LerosSim::validBuffer()
+  bool validBuffer(unsigned lane, MVT buf, MVT len) const;
+
+  static constexpr unsigned kRunBatch = 1 << 16;
+
+  std::unique_ptr<Lanes, void (*)(void *)> m_lanes;
+  std::unique_ptr<PagedMemory<MVT>> m_mem[kLanes];
+  CodeObserver m_codeObservers[kLanes];
+  std::shared_ptr<const Program> m_program;
+};
+
+#endif // LOCKSTEP_H
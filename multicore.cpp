@@ -0,0 +1,169 @@
+#include "multicore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+namespace {
+
+// Barrier for the core threads, which spins as quanta are usually short
+class SpinBarrier {
+public:
+  explicit SpinBarrier(unsigned count) : m_count(count) {}
+
+  void wait() {
+    const unsigned generation = m_generation.load(std::memory_order_acquire);
+    if (m_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_count) {
+      m_arrived.store(0, std::memory_order_relaxed);
+      m_generation.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    while (m_generation.load(std::memory_order_acquire) == generation) {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  const unsigned m_count;
+  std::atomic<unsigned> m_arrived{0};
+  std::atomic<unsigned> m_generation{0};
+};
+
+} // namespace
+
+MultiCoreSim::MultiCoreSim(const LerosOptions &opt, unsigned cores) {
+  m_loaded = m_image.load(opt.filename);
+  if (!m_loaded) {
+    return;
+  }
+  for (const auto &segment : m_image.segments()) {
+    m_mem.addBacking(segment.vaddr, segment.data, segment.filesz,
+                     !segment.overlapsOther);
+  }
+
+  LerosOptions coreOpt = opt;
+  coreOpt.numCores = std::max(cores, 1u);
+  coreOpt.sanitize = false;
+  coreOpt.watches.clear();
+  coreOpt.accessLogSize = 0;
+  coreOpt.profilePairs = false;
+  for (unsigned i = 0; i < coreOpt.numCores; i++) {
+    coreOpt.coreId = i;
+    m_cores.emplace_back(new LerosSim(coreOpt, &m_mem));
+    m_loaded &= m_cores.back()->loaded();
+    m_cores.back()->shareBreak(&m_brk);
+  }
+  m_status.assign(m_cores.size(), ALL_OK);
+}
+
+void MultiCoreSim::setArguments(const std::vector<MVT> &args) {
+  for (auto &core : m_cores) {
+    core->setArguments(args);
+  }
+}
+
+void MultiCoreSim::reset() {
+  for (auto &core : m_cores) {
+    core->reset();
+  }
+  m_status.assign(m_cores.size(), ALL_OK);
+}
+
+uint64_t MultiCoreSim::instructionsExecuted() const {
+  uint64_t count = 0;
+  for (const auto &core : m_cores) {
+    count += core->instructionsExecuted();
+  }
+  return count;
+}
+
+void MultiCoreSim::run(uint64_t quantum, uint64_t maxInstructions,
+                       std::chrono::steady_clock::time_point deadline) {
+  if (!m_loaded) {
+    return;
+  }
+  const unsigned n = m_cores.size();
+  quantum = std::max<uint64_t>(quantum, 1);
+
+  std::vector<bool> running(n);
+  std::vector<uint64_t> limit(n);
+  std::vector<int> result(n);
+  std::vector<uint64_t> codeWrites(n);
+  bool done = true;
+  for (unsigned i = 0; i < n; i++) {
+    running[i] = m_status[i] == ALL_OK || m_status[i] == INSTRUCTION_LIMIT ||
+                 m_status[i] == TIMEOUT;
+    limit[i] = maxInstructions != 0
+                   ? m_cores[i]->instructionsExecuted() + maxInstructions
+                   : std::numeric_limits<uint64_t>::max();
+    codeWrites[i] = m_cores[i]->codeWrites();
+    done &= !running[i];
+  }
+
+  // The cores run their quanta between two barriers, and are synchronized by
+  // this thread while the others wait for the next quantum. 'done' is only
+  // written while the other threads wait.
+  SpinBarrier barrier(n);
+  const auto runQuantum = [&](unsigned i) {
+    if (running[i]) {
+      LerosSim &core = *m_cores[i];
+      result[i] =
+          core.run(std::min(quantum, limit[i] - core.instructionsExecuted()));
+    }
+  };
+  const auto worker = [&](unsigned i) {
+    for (;;) {
+      barrier.wait();
+      if (done) {
+        return;
+      }
+      runQuantum(i);
+      barrier.wait();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < n; i++) {
+    threads.emplace_back(worker, i);
+  }
+  const bool timed = deadline != std::chrono::steady_clock::time_point::max();
+  for (;;) {
+    barrier.wait();
+    if (done) {
+      break;
+    }
+    runQuantum(0);
+    barrier.wait();
+
+    bool codeWritten = false;
+    for (unsigned i = 0; i < n; i++) {
+      codeWritten |= m_cores[i]->codeWrites() != codeWrites[i];
+      codeWrites[i] = m_cores[i]->codeWrites();
+      if (!running[i] || (result[i] == INSTRUCTION_LIMIT &&
+                          m_cores[i]->instructionsExecuted() < limit[i])) {
+        continue;
+      }
+      m_status[i] = result[i];
+      running[i] = false;
+    }
+    if (codeWritten) {
+      for (auto &core : m_cores) {
+        core->invalidateDecoded();
+      }
+    }
+
+    done = true;
+    for (unsigned i = 0; i < n; i++) {
+      if (running[i] && timed &&
+          std::chrono::steady_clock::now() >= deadline) {
+        m_status[i] = TIMEOUT;
+        running[i] = false;
+      }
+      done &= !running[i];
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
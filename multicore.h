@@ -0,0 +1,70 @@
+#ifndef MULTICORE_H
+#define MULTICORE_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "leros-sim.h"
+
+// A system of several Leros cores executing one program in a shared memory,
+// for studying the scaling of parallel Leros programs. Every core is a
+// LerosSim with its own registers and PC. 'scall 3' gives a core its number
+// in r4 and the number of cores in r5, and the stack of each core starts
+// STACK_SIZE below that of the previous core.
+//
+// Each core runs on its own host thread. The cores execute quanta of a given
+// number of instructions and wait for each other after every quantum, so no
+// core gets more than one quantum ahead of the others; a quantum of 1 makes
+// the cores alternate instruction by instruction. Within a quantum, memory
+// accesses of the cores interleave arbitrarily: naturally aligned loads and
+// stores are atomic, and 'scall 4' (swap) and 'scall 5' (fetch-and-add) of
+// the accumulator with the word at addr are atomic and sequentially
+// consistent, for building locks. The cores share one program break, so the
+// heap is grown by brk() like in a single process; the program's allocator
+// must serialize its calls, as newlib's malloc lock does. A store into code
+// invalidates the predecoded instructions of the other cores at the end of the
+// quantum.
+//
+// Debugging (breakpoints, watches, sanitizer) is not supported.
+class MultiCoreSim {
+public:
+  MultiCoreSim(const LerosOptions &opt, unsigned cores);
+
+  bool loaded() const { return m_loaded; }
+  unsigned numCores() const { return m_cores.size(); }
+  LerosSim &core(unsigned i) { return *m_cores[i]; }
+
+  // Set the input arguments of the program, and restart all cores from the
+  // program entry. Memory is not restored.
+  void setArguments(const std::vector<MVT> &args);
+  void reset();
+
+  // Run until all cores have stopped, each executing at most
+  // 'maxInstructions' more instructions (0 for no limit), or until 'deadline'
+  // has passed. The cores synchronize every 'quantum' instructions. Cores
+  // which stopped at the budget or the deadline are resumed by the next
+  // run().
+  void run(uint64_t quantum, uint64_t maxInstructions = 0,
+           std::chrono::steady_clock::time_point deadline =
+               std::chrono::steady_clock::time_point::max());
+
+  // Reason for core 'i' to stop, like LerosSim::run(), or ALL_OK if it has
+  // not run yet
+  int status(unsigned i) const { return m_status[i]; }
+  uint64_t instructionsExecuted() const;
+
+private:
+  bool m_loaded = false;
+  ProgramImage m_image;
+  // Memory of the system, accessed by the cores through their own
+  // PagedMemory's
+  PagedMemory<MVT> m_mem;
+  // Program break of the system, moved by the brk() calls of all cores
+  std::atomic<MVT> m_brk{0};
+  std::vector<std::unique_ptr<LerosSim>> m_cores;
+  std::vector<int> m_status;
+};
+
+#endif // MULTICORE_H
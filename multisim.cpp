@@ -0,0 +1,60 @@
+#include "multisim.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+MultiSim::MultiSim(size_t instances) : m_size(instances) {
+  const size_t groups =
+      (instances + LockstepSim::kLanes - 1) / LockstepSim::kLanes;
+  for (size_t g = 0; g < groups; g++) {
+    m_groups.emplace_back(new LockstepSim());
+  }
+}
+
+bool MultiSim::load(const std::string &filename) {
+  m_program = LockstepSim::loadProgram(filename);
+  if (!m_program) {
+    return false;
+  }
+  for (auto &group : m_groups) {
+    group->setProgram(m_program);
+  }
+  return true;
+}
+
+void MultiSim::reset(size_t i, const std::vector<MVT> &args) {
+  group(i).reset(lane(i), args);
+}
+
+void MultiSim::run(unsigned threads, uint64_t maxInstructions,
+                   std::chrono::nanoseconds timeout) {
+  if (!m_program) {
+    return;
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<size_t>(1, std::min<size_t>(threads, m_groups.size()));
+
+  // Groups are handed out one at a time, so long and short groups balance out
+  std::atomic<size_t> next(0);
+  const auto work = [&]() {
+    for (size_t g; (g = next++) < m_groups.size();) {
+      auto deadline = std::chrono::steady_clock::time_point::max();
+      if (timeout != std::chrono::nanoseconds::max()) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+      }
+      m_groups[g]->run(maxInstructions, deadline);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; t++) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+}
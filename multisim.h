@@ -0,0 +1,56 @@
+#ifndef MULTISIM_H
+#define MULTISIM_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lockstep.h"
+
+// Any number of instances of one program, executed by LockstepSim's on a pool
+// of threads. Instances are stored in groups of LockstepSim::kLanes, with the
+// registers of a group as one vector per register (see LockstepSim::Lanes),
+// and the state of each group in its own cache line aligned allocation so
+// that threads running different groups do not share cache lines. The program
+// text and its decoded instructions are loaded once and shared read-only by
+// all groups.
+class MultiSim {
+public:
+  explicit MultiSim(size_t instances);
+
+  // Load a program into all instances; returns false if it could not be
+  // loaded
+  bool load(const std::string &filename);
+  size_t size() const { return m_size; }
+
+  // Prepare instance 'i' to run from the start with the given input arguments
+  void reset(size_t i, const std::vector<MVT> &args);
+
+  // Run all instances reset since the last run() until they stop, on
+  // 'threads' threads (0 for one per CPU) including the calling thread. Each
+  // instance executes at most 'maxInstructions' instructions (0 for no
+  // limit), and each group of lanes runs for at most 'timeout' once started.
+  void run(unsigned threads, uint64_t maxInstructions = 0,
+           std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+
+  int status(size_t i) const { return group(i).status(lane(i)); }
+  uint64_t instructionsExecuted(size_t i) const {
+    return group(i).instructionsExecuted(lane(i));
+  }
+  MVT readRegister(size_t i, unsigned idx) const {
+    return group(i).readRegister(lane(i), idx);
+  }
+
+private:
+  LockstepSim &group(size_t i) const {
+    return *m_groups[i / LockstepSim::kLanes];
+  }
+  static unsigned lane(size_t i) { return i % LockstepSim::kLanes; }
+
+  size_t m_size;
+  std::vector<std::unique_ptr<LockstepSim>> m_groups;
+  std::shared_ptr<const LockstepSim::Program> m_program;
+};
+
+#endif // MULTISIM_H
@@ -0,0 +1,685 @@
+#ifndef PAGEDMEMORY_H
+#define PAGEDMEMORY_H
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ripes/mainmemory.h"
+
+// Per-page flags. Loads and stores to a page with any of ReadSlowFlags or
+// WriteSlowFlags set respectively are diverted to the slow path, everything else
+// is served directly from the page. Loads and stores within a page which is
+// only Shadowed check the shadow state and stay on the fast path.
+enum PageFlags : uint8_t {
+  WatchRead = 1 << 0,
+  WatchWrite = 1 << 1,
+  Shadowed = 1 << 2,
+  CodeWrite = 1 << 3 // page holds (predecoded) instructions
+};
+
+static constexpr uint8_t ReadSlowFlags = WatchRead | Shadowed;
+static constexpr uint8_t WriteSlowFlags = WatchWrite | Shadowed | CodeWrite;
+
+enum class ShadowFault { Uninitialized, Unmapped };
+
+// Notified about accesses to watched pages, shadow memory violations and
+// stores to code pages
+template <typename AddrT> class MemoryObserver {
+public:
+  virtual ~MemoryObserver() {}
+  virtual void watchedAccess(AddrT address, unsigned size, RW rw) = 0;
+  virtual void shadowFault(AddrT, unsigned, RW, ShadowFault) {}
+  virtual void codeWritten(AddrT, unsigned) {}
+};
+
+// Sparse, paged guest memory. Pages are allocated on first write; reads from
+// unallocated memory return 0. A small direct mapped TLB caches the most
+// recently used pages. Loads and stores are up to sizeof(AddrT) bytes wide.
+//
+// Address ranges may be backed by host memory (ie. a mapped program file).
+// Pages in such ranges are materialized when first touched: pages entirely
+// within a suitably aligned backing range alias the host memory directly,
+// others are copied into a private page.
+//
+// Several PagedMemory's, each used by one thread, may share the pages of
+// another (see share()). Naturally aligned loads and stores of up to a word
+// are then single-copy atomic, and update() is an atomic read-modify-write.
+template <typename AddrT> class PagedMemory {
+public:
+  static constexpr unsigned PageBits = 12;
+  static constexpr AddrT PageSize = AddrT(1) << PageBits;
+  static constexpr AddrT PageMask = PageSize - 1;
+
+  // Shadow state of a page; one bit per byte, such that a naturally aligned
+  // access is checked with a single mask of one word
+  struct Shadow {
+    uint64_t initialized[PageSize / 64] = {};
+    uint64_t mapped[PageSize / 64] = {};
+  };
+
+  struct Page {
+    uint8_t *data; // either storage, or aliased backing memory
+    std::unique_ptr<uint8_t[]> storage;
+    uint8_t flags = 0;
+    std::unique_ptr<Shadow> shadow;
+  };
+
+  PagedMemory() { flushTLB(); }
+  PagedMemory(const PagedMemory &) = delete;
+  PagedMemory &operator=(const PagedMemory &) = delete;
+
+  void setObserver(MemoryObserver<AddrT> *observer) { m_observer = observer; }
+
+  // Access the pages of 'memory', which must outlive this object, instead of
+  // pages of its own. Pages are looked up and allocated in 'memory' under its
+  // lock, while the TLB and the observer stay with this object. Backings,
+  // flags and shadow state are those of 'memory', which must not be cleared,
+  // snapshot or restored while shared.
+  void share(PagedMemory &memory) {
+    m_shared = &memory;
+    flushTLB();
+  }
+
+  // Reads $size bytes starting at address
+  AddrT read(AddrT address, unsigned size = sizeof(AddrT)) {
+    const AddrT offset = address & PageMask;
+    Page *page = lookup(address);
+    if (page && !(page->flags & WatchRead) && offset <= PageSize - size) {
+      if (page->flags & Shadowed) {
+        checkShadow(*page->shadow, address, size, RW::Read);
+      }
+      const uint8_t *p = &page->data[offset];
+      AddrT value = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      if ((offset & (size - 1)) == 0) {
+        switch (size) {
+        case 1: return atomicLoad<uint8_t>(p);
+        case 2: return atomicLoad<uint16_t>(p);
+        case 4: return atomicLoad<uint32_t>(p);
+        case 8: return atomicLoad<uint64_t>(p);
+        }
+      }
+      if (size == sizeof(AddrT)) {
+        memcpy(&value, p, sizeof(AddrT));
+        return value;
+      }
+#endif
+      for (unsigned i = 0; i < size; i++) {
+        value |= AddrT(p[i]) << (8 * i);
+      }
+      return value;
+    }
+    return readSlow(address, size);
+  }
+
+  // Writes the $size least significant bytes of value, starting at address
+  void write(AddrT address, AddrT value, int size) {
+    const AddrT offset = address & PageMask;
+    Page *page = lookupOrAllocate(address);
+    if (!(page->flags & (WatchWrite | CodeWrite)) &&
+        offset <= PageSize - size) {
+      if (page->flags & Shadowed) {
+        checkShadow(*page->shadow, address, size, RW::Write);
+      }
+      uint8_t *p = &page->data[offset];
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      if ((offset & (size - 1)) == 0) {
+        switch (size) {
+        case 1: return atomicStore<uint8_t>(p, value);
+        case 2: return atomicStore<uint16_t>(p, value);
+        case 4: return atomicStore<uint32_t>(p, value);
+        case 8: return atomicStore<uint64_t>(p, value);
+        }
+      }
+      if (size == sizeof(AddrT)) {
+        memcpy(p, &value, sizeof(AddrT));
+        return;
+      }
+#endif
+      for (int i = 0; i < size; i++) {
+        p[i] = value & 0xff;
+        value >>= 8;
+      }
+      return;
+    }
+    writeSlow(address, value, size);
+  }
+
+  // Replace the word at 'address' with f(old value), and return the old
+  // value. Naturally aligned words are updated atomically, and the update is
+  // sequentially consistent with other updates. Other words, and words in
+  // pages with watches, shadow memory or code, are read and written like by
+  // read() and write().
+  template <typename F> AddrT update(AddrT address, F f) {
+    const AddrT offset = address & PageMask;
+    Page *page = lookupOrAllocate(address);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (!(page->flags & (ReadSlowFlags | WriteSlowFlags)) &&
+        (offset & (sizeof(AddrT) - 1)) == 0) {
+      AddrT *p = reinterpret_cast<AddrT *>(&page->data[offset]);
+      AddrT old = __atomic_load_n(p, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(p, &old, f(old), false,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED)) {
+      }
+      return old;
+    }
+#endif
+    const AddrT old = read(address);
+    write(address, f(old), sizeof(AddrT));
+    return old;
+  }
+
+  // Copy 'len' bytes at 'address' to host memory. Pages without watches or
+  // shadow memory are copied from directly; others are read byte by byte
+  // like by read().
+  void readBlock(AddrT address, uint8_t *data, size_t len) {
+    while (len != 0) {
+      const AddrT offset = address & PageMask;
+      const size_t n = std::min<size_t>(len, PageSize - offset);
+      const Page *page = lookup(address);
+      if (page && !(page->flags & ReadSlowFlags)) {
+        memcpy(data, &page->data[offset], n);
+      } else if (!page && !m_shadowEnabled) {
+        memset(data, 0, n);
+      } else {
+        for (size_t i = 0; i < n; i++) {
+          data[i] = read(address + i, 1);
+        }
+      }
+      address += n;
+      data += n;
+      len -= n;
+    }
+  }
+
+  // Copy 'len' bytes of host memory to 'address'. Pages without watches,
+  // shadow memory or code are copied to directly; others are written byte by
+  // byte like by write().
+  void writeBlock(AddrT address, const uint8_t *data, size_t len) {
+    while (len != 0) {
+      const AddrT offset = address & PageMask;
+      const size_t n = std::min<size_t>(len, PageSize - offset);
+      Page *page = lookupOrAllocate(address);
+      if (!(page->flags & WriteSlowFlags)) {
+        memcpy(&page->data[offset], data, n);
+      } else {
+        for (size_t i = 0; i < n; i++) {
+          write(address + i, data[i], 1);
+        }
+      }
+      address += n;
+      data += n;
+      len -= n;
+    }
+  }
+
+  // Instruction fetch; not subject to watches
+  uint16_t fetch(AddrT address) {
+    return peek(address) | (peek(address + 1) << 8);
+  }
+
+  // Byte access which bypasses watches, for loaders and debuggers
+  uint8_t peek(AddrT address) {
+    const Page *page = lookup(address);
+    return page ? atomicLoad<uint8_t>(&page->data[address & PageMask]) : 0;
+  }
+  void poke(AddrT address, uint8_t value) {
+    atomicStore<uint8_t>(&lookupOrAllocate(address)->data[address & PageMask],
+                         value);
+  }
+
+  // Sets flags on all pages overlapping [start, end)
+  void setFlags(AddrT start, AddrT end, uint8_t flags) {
+    for (AddrT a = start & ~PageMask; a < end && a >= (start & ~PageMask);
+         a += PageSize) {
+      lookupOrAllocate(a)->flags |= flags;
+    }
+  }
+
+  void clearFlags(uint8_t flags) {
+    for (auto &p : m_pages) {
+      p.second->flags &= ~flags;
+    }
+  }
+
+  void clear() {
+    m_pages.clear();
+    flushTLB();
+  }
+
+  // Contents, flags and shadow state of all pages at some point in time
+  struct Snapshot {
+    struct SavedPage {
+      std::unique_ptr<uint8_t[]> data;
+      uint8_t flags;
+      std::unique_ptr<Shadow> shadow;
+    };
+    std::unordered_map<AddrT, SavedPage> pages;
+  };
+
+  // All backed pages are materialized first, such that pages aliasing the
+  // backing memory (which the guest may then modify) are restored as well.
+  void snapshot(Snapshot &snap) {
+    for (const auto &b : m_backings) {
+      for (AddrT a = b.address & ~PageMask;
+           a < b.address + b.len && a >= (b.address & ~PageMask);
+           a += PageSize) {
+        lookup(a);
+      }
+    }
+
+    snap.pages.clear();
+    for (const auto &p : m_pages) {
+      auto &saved = snap.pages[p.first];
+      saved.data.reset(new uint8_t[PageSize]);
+      memcpy(saved.data.get(), p.second->data, PageSize);
+      saved.flags = p.second->flags;
+      if (p.second->shadow) {
+        saved.shadow.reset(new Shadow(*p.second->shadow));
+      }
+    }
+  }
+
+  // Pages allocated after the snapshot are discarded
+  void restore(const Snapshot &snap) {
+    for (auto it = m_pages.begin(); it != m_pages.end();) {
+      if (snap.pages.count(it->first)) {
+        ++it;
+      } else {
+        it = m_pages.erase(it);
+      }
+    }
+    flushTLB();
+
+    for (const auto &p : snap.pages) {
+      auto it = m_pages.find(p.first);
+      if (it == m_pages.end()) {
+        it = m_pages.emplace(p.first, std::unique_ptr<Page>(new Page())).first;
+        it->second->storage.reset(new uint8_t[PageSize]);
+        it->second->data = it->second->storage.get();
+      }
+      Page &page = *it->second;
+      memcpy(page.data, p.second.data.get(), PageSize);
+      page.flags = p.second.flags;
+      if (p.second.shadow) {
+        page.shadow.reset(new Shadow(*p.second.shadow));
+      } else {
+        page.shadow.reset();
+      }
+    }
+  }
+
+  // Back [address, address + len) with host memory. If 'alias' is set, pages
+  // may refer directly to the host memory, which must then be private to this
+  // range (ie. a MAP_PRIVATE file mapping, which the kernel copies on write).
+  void addBacking(AddrT address, uint8_t *data, AddrT len, bool alias) {
+    if (len != 0) {
+      m_backings.push_back({address, len, data, alias});
+    }
+  }
+
+  // Enable shadow memory, which tracks whether each byte has been written and
+  // whether it lies within a mapped range. All accesses are then checked, and
+  // violations are reported to the observer.
+  void enableShadow() {
+    m_shadowEnabled = true;
+    for (auto &p : m_pages) {
+      initShadow(p.first, *p.second);
+    }
+  }
+
+  // Mark [start, end) as mapped, ie. a valid target for loads and stores
+  void addMappedRange(AddrT start, AddrT end) {
+    if (!m_shadowEnabled || start >= end) {
+      return;
+    }
+    // Growing a range, ie. the heap, extends it rather than adding another
+    if (!m_mappedRanges.empty() && m_mappedRanges.back().second == start) {
+      m_mappedRanges.back().second = end;
+    } else {
+      m_mappedRanges.push_back({start, end});
+    }
+    for (auto &p : m_pages) {
+      const AddrT base = p.first << PageBits;
+      if (base < end && start < base + PageSize) {
+        markMapped(base, *p.second->shadow, start, end);
+      }
+    }
+  }
+
+  // The mapped ranges, and replacing them, ie. to return to the ranges of a
+  // freshly loaded program
+  typedef std::vector<std::pair<AddrT, AddrT>> MappedRanges;
+  const MappedRanges &mappedRanges() const { return m_mappedRanges; }
+  void setMappedRanges(const MappedRanges &ranges) {
+    if (!m_shadowEnabled || ranges == m_mappedRanges) {
+      return;
+    }
+    m_mappedRanges = ranges;
+    for (auto &p : m_pages) {
+      Shadow &shadow = *p.second->shadow;
+      std::fill(std::begin(shadow.mapped), std::end(shadow.mapped), 0);
+      const AddrT base = p.first << PageBits;
+      for (const auto &r : m_mappedRanges) {
+        if (base < r.second && r.first < base + PageSize) {
+          markMapped(base, shadow, r.first, r.second);
+        }
+      }
+    }
+  }
+
+  // Mark [start, end) as initialized without writing it, ie. for zero
+  // initialized sections
+  void setInitialized(AddrT start, AddrT end) {
+    if (!m_shadowEnabled) {
+      return;
+    }
+    for (AddrT a = start; a < end && a >= start;
+         a = (a & ~PageMask) + PageSize) {
+      const AddrT base = a & ~PageMask;
+      const AddrT to = end - base < PageSize ? end - base : PageSize;
+      setBits(lookupOrAllocate(a)->shadow->initialized, a - base, to);
+    }
+  }
+
+private:
+  static constexpr unsigned TLBEntries = 64;
+
+  static AddrT pageNumber(AddrT address) { return address >> PageBits; }
+
+  // Accesses to page data which may be shared with other threads. Relaxed
+  // atomics compile to plain loads and stores.
+  template <typename T> static AddrT atomicLoad(const uint8_t *p) {
+    return static_cast<AddrT>(
+        __atomic_load_n(reinterpret_cast<const T *>(p), __ATOMIC_RELAXED));
+  }
+  template <typename T> static void atomicStore(uint8_t *p, AddrT value) {
+    __atomic_store_n(reinterpret_cast<T *>(p), static_cast<T>(value),
+                     __ATOMIC_RELAXED);
+  }
+
+  void flushTLB() {
+    for (unsigned i = 0; i < TLBEntries; i++) {
+      m_tlbTag[i] = ~AddrT(0);
+      m_tlbPage[i] = nullptr;
+    }
+  }
+
+  Page *lookup(AddrT address) {
+    const AddrT pn = pageNumber(address);
+    const unsigned idx = pn % TLBEntries;
+    if (m_tlbTag[idx] == pn) {
+      return m_tlbPage[idx];
+    }
+    Page *page = m_shared ? m_shared->findShared(pn, false) : findPage(pn);
+    if (page) {
+      m_tlbTag[idx] = pn;
+      m_tlbPage[idx] = page;
+    }
+    return page;
+  }
+
+  Page *lookupOrAllocate(AddrT address) {
+    Page *page = lookup(address);
+    if (page) {
+      return page;
+    }
+    if (m_shared) {
+      m_shared->findShared(pageNumber(address), true);
+    } else {
+      createPage(pageNumber(address));
+    }
+    return lookup(address);
+  }
+
+  // Page 'pn', materialized from the backings if needed, or nullptr
+  Page *findPage(AddrT pn) {
+    auto it = m_pages.find(pn);
+    if (it == m_pages.end()) {
+      if (m_backings.empty()) {
+        return nullptr;
+      }
+      it = materialize(pn);
+      if (it == m_pages.end()) {
+        return nullptr;
+      }
+    }
+    return it->second.get();
+  }
+
+  // findPage() for the PagedMemory's sharing this one, optionally allocating
+  // the page. Pages are never freed while shared, so the result stays valid.
+  Page *findShared(AddrT pn, bool allocate) {
+    std::lock_guard<std::mutex> lock(m_sharedLock);
+    Page *page = findPage(pn);
+    if (!page && allocate) {
+      page = createPage(pn)->second.get();
+    }
+    return page;
+  }
+
+  typename std::unordered_map<AddrT, std::unique_ptr<Page>>::iterator
+  createPage(AddrT pn, uint8_t *alias = nullptr) {
+    auto it = m_pages.emplace(pn, std::unique_ptr<Page>(new Page())).first;
+    Page &page = *it->second;
+    if (alias) {
+      page.data = alias;
+    } else {
+      page.storage.reset(new uint8_t[PageSize]());
+      page.data = page.storage.get();
+    }
+    if (m_shadowEnabled) {
+      initShadow(pn, page);
+    }
+    return it;
+  }
+
+  // Fault in page 'pn' from the backing ranges. Returns m_pages.end() if the
+  // page is not backed.
+  typename std::unordered_map<AddrT, std::unique_ptr<Page>>::iterator
+  materialize(AddrT pn) {
+    const AddrT base = pn << PageBits;
+    const Backing *backing = nullptr;
+    for (const auto &b : m_backings) {
+      if (base < b.address + b.len && b.address < base + PageSize) {
+        if (backing) {
+          backing = nullptr; // multiple ranges share the page; copy below
+          break;
+        }
+        backing = &b;
+      }
+    }
+
+    if (backing && backing->alias && base >= backing->address &&
+        base + PageSize <= backing->address + backing->len) {
+      uint8_t *host = backing->data + (base - backing->address);
+      if (reinterpret_cast<uintptr_t>(host) % PageSize == 0) {
+        return createPage(pn, host);
+      }
+    }
+
+    auto it = m_pages.end();
+    for (const auto &b : m_backings) {
+      if (!(base < b.address + b.len && b.address < base + PageSize)) {
+        continue;
+      }
+      if (it == m_pages.end()) {
+        it = createPage(pn);
+      }
+      const AddrT from = b.address > base ? b.address : base;
+      const AddrT to =
+          b.address + b.len < base + PageSize ? b.address + b.len
+                                              : base + PageSize;
+      memcpy(it->second->data + (from - base), b.data + (from - b.address),
+             to - from);
+    }
+    return it;
+  }
+
+  void initShadow(AddrT pn, Page &page) {
+    page.flags |= Shadowed;
+    page.shadow.reset(new Shadow());
+    const AddrT base = pn << PageBits;
+    for (const auto &r : m_mappedRanges) {
+      if (base < r.second && r.first < base + PageSize) {
+        markMapped(base, *page.shadow, r.first, r.second);
+      }
+    }
+  }
+
+  // Sets bits [from, to) of a shadow bitmap
+  static void setBits(uint64_t *bits, AddrT from, AddrT to) {
+    while (from < to) {
+      const unsigned bit = from & 63;
+      const AddrT n = std::min<AddrT>(to - from, 64 - bit);
+      bits[from >> 6] |= (~uint64_t(0) >> (64 - n)) << bit;
+      from += n;
+    }
+  }
+
+  static void markMapped(AddrT base, Shadow &shadow, AddrT start, AddrT end) {
+    const AddrT from = start > base ? start - base : 0;
+    const AddrT to = end - base < PageSize ? end - base : PageSize;
+    setBits(shadow.mapped, from, to);
+  }
+
+  bool inMappedRange(AddrT address) const {
+    for (const auto &r : m_mappedRanges) {
+      if (address >= r.first && address < r.second) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void reportShadowFault(AddrT address, unsigned size, RW rw, bool unmapped,
+                         bool uninitialized) {
+    if (m_observer && (unmapped || uninitialized)) {
+      m_observer->shadowFault(address, size, rw,
+                              unmapped ? ShadowFault::Unmapped
+                                       : ShadowFault::Uninitialized);
+    }
+  }
+
+  // Checks and updates the shadow state of an access within the page of
+  // 'shadow'. Accesses within a word of the bitmap, ie. all naturally aligned
+  // ones, test and set their bits with one mask.
+  void checkShadow(Shadow &shadow, AddrT address, unsigned size, RW rw) {
+    const AddrT offset = address & PageMask;
+    const unsigned bit = offset & 63;
+    if (bit + size > 64) {
+      checkShadowSlow(address, size, rw);
+      return;
+    }
+    const uint64_t mask = (~uint64_t(0) >> (64 - size)) << bit;
+    uint64_t &initialized = shadow.initialized[offset >> 6];
+    const bool unmapped = (shadow.mapped[offset >> 6] & mask) != mask;
+    bool uninitialized = false;
+    if (rw == RW::Write) {
+      // Atomic, as other cores may set the bits of neighbouring bytes
+      if ((initialized & mask) != mask) {
+        __atomic_fetch_or(&initialized, mask, __ATOMIC_RELAXED);
+      }
+    } else {
+      uninitialized = (initialized & mask) != mask;
+    }
+    if (unmapped || uninitialized) {
+      reportShadowFault(address, size, rw, unmapped, uninitialized);
+    }
+  }
+
+  // checkShadow() byte by byte, for accesses straddling words or pages. Bytes
+  // of pages which do not exist yet are uninitialized; reads do not allocate
+  // them.
+  void checkShadowSlow(AddrT address, unsigned size, RW rw) {
+    bool unmapped = false;
+    bool uninitialized = false;
+    for (unsigned i = 0; i < size; i++) {
+      const AddrT a = address + i;
+      Page *page = rw == RW::Write ? lookupOrAllocate(a) : lookup(a);
+      if (!page) {
+        unmapped |= !inMappedRange(a);
+        uninitialized = true;
+        continue;
+      }
+      Shadow &shadow = *page->shadow;
+      const AddrT offset = a & PageMask;
+      const uint64_t bit = uint64_t(1) << (offset & 63);
+      unmapped |= !(shadow.mapped[offset >> 6] & bit);
+      if (rw == RW::Write) {
+        shadow.initialized[offset >> 6] |= bit;
+      } else {
+        uninitialized |= !(shadow.initialized[offset >> 6] & bit);
+      }
+    }
+    reportShadowFault(address, size, rw, unmapped, uninitialized);
+  }
+
+  // Flags of the page(s) touched by an access, which may straddle two pages
+  uint8_t accessFlags(AddrT address, unsigned size) {
+    const Page *first = lookup(address);
+    const Page *last = lookup(address + size - 1);
+    return (first ? first->flags : 0) | (last ? last->flags : 0);
+  }
+
+  AddrT readSlow(AddrT address, unsigned size) {
+    if ((accessFlags(address, size) & WatchRead) && m_observer) {
+      m_observer->watchedAccess(address, size, RW::Read);
+    }
+    if (m_shadowEnabled) {
+      checkShadowSlow(address, size, RW::Read);
+    }
+    AddrT value = 0;
+    for (unsigned i = 0; i < size; i++) {
+      value |= AddrT(peek(address + i)) << (8 * i);
+    }
+    return value;
+  }
+
+  void writeSlow(AddrT address, AddrT value, int size) {
+    const uint8_t flags = accessFlags(address, size);
+    if ((flags & WatchWrite) && m_observer) {
+      m_observer->watchedAccess(address, size, RW::Write);
+    }
+    if (m_shadowEnabled) {
+      checkShadowSlow(address, size, RW::Write);
+    }
+    for (int i = 0; i < size; i++) {
+      poke(address + i, value & 0xff);
+      value >>= 8;
+    }
+    if ((flags & CodeWrite) && m_observer) {
+      m_observer->codeWritten(address, size);
+    }
+  }
+
+  struct Backing {
+    AddrT address;
+    AddrT len;
+    uint8_t *data;
+    bool alias;
+  };
+
+  std::unordered_map<AddrT, std::unique_ptr<Page>> m_pages;
+  std::vector<Backing> m_backings;
+  AddrT m_tlbTag[TLBEntries];
+  Page *m_tlbPage[TLBEntries];
+  MemoryObserver<AddrT> *m_observer = nullptr;
+
+  // Memory whose pages are used instead of m_pages, and the lock of m_pages
+  // while this memory is shared
+  PagedMemory *m_shared = nullptr;
+  std::mutex m_sharedLock;
+
+  bool m_shadowEnabled = false;
+  MappedRanges m_mappedRanges;
+};
+
+#endif // PAGEDMEMORY_H
@@ -0,0 +1,401 @@
+#include "progen.h"
+
+#include <map>
+#include <vector>
+
+#include "elfio/elfio.hpp"
+#include "leros-sim.h"
+
+namespace {
+
+constexpr uint64_t kTextStart = 0x1000;
+// Branch offsets have 12 bits, so programs stay below 2048 instructions
+constexpr size_t kMaxInstructions = 1800;
+
+// Registers with a fixed purpose. The general registers used by the random
+// instructions never include them.
+constexpr unsigned kArgvReg = 5;
+constexpr unsigned kReturnReg = 248; // written by the jal returning to a call
+constexpr unsigned kLinkReg = 249;   // return address of subroutines
+constexpr unsigned kDataReg = 250;   // middle of the data area
+constexpr unsigned kAddrReg = 251;   // computed addresses
+constexpr unsigned kCounterReg = 252; // loop counters, one per depth
+constexpr unsigned kMaxLoopDepth = 3;
+
+const unsigned kGeneralRegs[] = {0,  1,  2,  3,  4,  6,  7,  8,  9,   10,
+                                 11, 12, 13, 14, 15, 16, 17, 31, 32,  63,
+                                 64, 100, 127, 128, 129, 200, 247, 255};
+
+const LerosInstr kRegOps[] = {LerosInstr::add, LerosInstr::sub,
+                              LerosInstr::And, LerosInstr::Or,
+                              LerosInstr::Xor, LerosInstr::load};
+const LerosInstr kImmOps[] = {LerosInstr::addi, LerosInstr::subi,
+                              LerosInstr::Andi, LerosInstr::Ori,
+                              LerosInstr::Xori, LerosInstr::loadi};
+const LerosInstr kLoadHighOps[] = {
+    LerosInstr::loadhi,  LerosInstr::loadh2i, LerosInstr::loadh3i,
+#ifdef LEROS64
+    LerosInstr::loadh4i, LerosInstr::loadh5i, LerosInstr::loadh6i,
+    LerosInstr::loadh7i,
+#endif
+};
+const LerosInstr kMemoryOps[] = {LerosInstr::ldind,  LerosInstr::ldindb,
+                                 LerosInstr::ldindh, LerosInstr::stind,
+                                 LerosInstr::stindb, LerosInstr::stindh};
+const LerosInstr kConditionalBranches[] = {LerosInstr::brz, LerosInstr::brnz,
+                                           LerosInstr::brp, LerosInstr::brn};
+
+template <typename T, size_t N> size_t count(const T (&)[N]) { return N; }
+
+class ProgramGenerator {
+public:
+  ProgramGenerator(uint64_t seed, const ProgramGenOptions &options)
+      : m_options(options), m_random(seed * 0x9e3779b97f4a7c15ull + 1) {
+    m_options.maxLoopDepth = std::min(m_options.maxLoopDepth, kMaxLoopDepth);
+    m_options.maxLoopIterations = std::max(1u, m_options.maxLoopIterations);
+    for (unsigned op = 0; op < 256; op++) {
+      const LerosInstr instr = LerosSim::decodeOpcode(op);
+      if (instr != LerosInstr::unknown && m_opcodes[instr] == 0) {
+        m_opcodes[instr] = op;
+      }
+    }
+  }
+
+  void generate();
+
+  const std::vector<uint16_t> &code() const { return m_code; }
+
+private:
+  struct Fixup {
+    size_t at;
+    int label;
+    // Byte of the label's address for loadi/loadh*i, or -1 for branches
+    int byte;
+  };
+
+  uint64_t random() {
+    // xorshift64
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 7;
+    m_random ^= m_random << 17;
+    return m_random;
+  }
+  unsigned reg() { return kGeneralRegs[random() % count(kGeneralRegs)]; }
+  bool full() const { return m_code.size() >= kMaxInstructions - 64; }
+
+  void emit(LerosInstr op, uint8_t imm) {
+    m_code.push_back(m_opcodes[op] << 8 | imm);
+  }
+  void emitBranch(LerosInstr op, int label);
+  int newLabel() {
+    m_labels.push_back(-1);
+    return m_labels.size() - 1;
+  }
+  void bind(int label) { m_labels[label] = m_code.size(); }
+  void resolve();
+
+  void emitBlock(unsigned n);
+  void emitItem();
+  void emitRegOp(LerosInstr op) { emit(op, reg()); }
+  void emitImmOp(LerosInstr op) { emit(op, random()); }
+  void emitConstant(unsigned highBytes);
+  void emitMemory(LerosInstr op);
+  void emitIf(LerosInstr op);
+  void emitIfElse();
+  void emitLoop();
+  void emitCall();
+  void emitSubroutine(int label);
+  void emitFused();
+
+  ProgramGenOptions m_options;
+  uint64_t m_random;
+  std::map<LerosInstr, uint8_t> m_opcodes;
+  std::vector<uint16_t> m_code;
+  std::vector<size_t> m_labels;
+  std::vector<Fixup> m_fixups;
+  std::vector<int> m_subroutines;
+  unsigned m_depth = 0;
+  bool m_inSubroutine = false;
+};
+
+void ProgramGenerator::emitBranch(LerosInstr op, int label) {
+  m_fixups.push_back({m_code.size(), label, -1});
+  m_code.push_back(m_opcodes[op] << 8);
+}
+
+void ProgramGenerator::resolve() {
+  for (const Fixup &f : m_fixups) {
+    const size_t target = m_labels[f.label];
+    if (f.byte < 0) {
+      const int offset = static_cast<int>(target) - static_cast<int>(f.at);
+      m_code[f.at] = (m_code[f.at] & 0xf000) | (offset & 0xfff);
+    } else {
+      const uint64_t address = kTextStart + target * ILEN;
+      m_code[f.at] = (m_code[f.at] & 0xff00) | ((address >> (8 * f.byte)) & 0xff);
+    }
+  }
+}
+
+// loadi followed by 'highBytes' of the loadh*i, ie. a constant built for a
+// store
+void ProgramGenerator::emitConstant(unsigned highBytes) {
+  emit(LerosInstr::loadi, random());
+  for (unsigned i = 0; i < highBytes && i < count(kLoadHighOps); i++) {
+    emit(kLoadHighOps[i], random());
+  }
+  if (random() % 2) {
+    emit(LerosInstr::store, reg());
+  }
+}
+
+// An access within the data area, through the middle of the data area or an
+// address computed from a register
+void ProgramGenerator::emitMemory(LerosInstr op) {
+  const bool word = op == LerosInstr::ldind || op == LerosInstr::stind;
+  const bool half = op == LerosInstr::ldindh || op == LerosInstr::stindh;
+  const bool store = op == LerosInstr::stind || op == LerosInstr::stindb ||
+                     op == LerosInstr::stindh;
+  if (random() % 2) {
+    emit(LerosInstr::load, reg());
+    emit(LerosInstr::Andi, word ? 0x100 - WORDSIZE : half ? 0xfe : 0xff);
+    emit(LerosInstr::add, kDataReg);
+    emit(LerosInstr::store, kAddrReg);
+    emit(LerosInstr::ldaddr, kAddrReg);
+  } else {
+    emit(LerosInstr::ldaddr, kDataReg);
+  }
+  if (store) {
+    emit(LerosInstr::load, reg());
+  }
+  emit(op, static_cast<uint8_t>(static_cast<int>(random() % 32) - 16));
+  if (!store && random() % 2) {
+    emit(LerosInstr::store, reg());
+  }
+}
+
+void ProgramGenerator::emitIf(LerosInstr op) {
+  const int skip = newLabel();
+  emit(LerosInstr::load, reg());
+  emitBranch(op, skip);
+  emitBlock(1 + random() % 6);
+  bind(skip);
+}
+
+void ProgramGenerator::emitIfElse() {
+  const int otherwise = newLabel();
+  const int end = newLabel();
+  emit(LerosInstr::load, reg());
+  emitBranch(kConditionalBranches[random() % count(kConditionalBranches)],
+             otherwise);
+  emitBlock(1 + random() % 6);
+  emitBranch(LerosInstr::br, end);
+  bind(otherwise);
+  emitBlock(1 + random() % 6);
+  bind(end);
+}
+
+// A loop counting down from up to maxLoopIterations, with brnz or brp
+void ProgramGenerator::emitLoop() {
+  const unsigned counter = kCounterReg + m_depth;
+  const int top = newLabel();
+  emit(LerosInstr::loadi, 1 + random() % m_options.maxLoopIterations);
+  emit(LerosInstr::store, counter);
+  bind(top);
+  m_depth++;
+  emitBlock(2 + random() % 10);
+  m_depth--;
+  emit(LerosInstr::load, counter);
+  emit(LerosInstr::subi, 1);
+  emit(LerosInstr::store, counter);
+  emitBranch(random() % 2 ? LerosInstr::brnz : LerosInstr::brp, top);
+}
+
+// Call a subroutine through jal with its address built by loadi/loadh*i
+void ProgramGenerator::emitCall() {
+  const int label = m_subroutines[random() % m_subroutines.size()];
+  m_fixups.push_back({m_code.size(), label, 0});
+  emit(LerosInstr::loadi, 0);
+  for (unsigned i = 0; i < 3; i++) {
+    m_fixups.push_back({m_code.size(), label, int(i) + 1});
+    emit(kLoadHighOps[i], 0);
+  }
+  emit(LerosInstr::jal, kLinkReg);
+}
+
+// Leaf subroutines contain no loops or calls, which would overwrite the loop
+// counters or the return address of their callers
+void ProgramGenerator::emitSubroutine(int label) {
+  bind(label);
+  m_inSubroutine = true;
+  emitBlock(3 + random() % 12);
+  m_inSubroutine = false;
+  emit(LerosInstr::load, kLinkReg);
+  emit(LerosInstr::jal, kReturnReg);
+}
+
+// The sequences combined into superinstructions by the predecoder
+void ProgramGenerator::emitFused() {
+  switch (random() % 4) {
+  case 0: {
+    const unsigned r = reg();
+    emit(LerosInstr::load, r);
+    emit(random() % 2 ? LerosInstr::addi : LerosInstr::subi, random());
+    emit(LerosInstr::store, r);
+    break;
+  }
+  case 1:
+    emit(LerosInstr::load, reg());
+    emit(random() % 2 ? LerosInstr::add : LerosInstr::sub, reg());
+    emit(LerosInstr::store, reg());
+    break;
+  case 2: {
+    const int skip = newLabel();
+    emit(LerosInstr::loadi, random() % 2);
+    emitBranch(random() % 2 ? LerosInstr::brz : LerosInstr::brnz, skip);
+    emitBlock(1 + random() % 4);
+    bind(skip);
+    break;
+  }
+  default:
+    emitConstant(1 + random() % count(kLoadHighOps));
+    break;
+  }
+}
+
+void ProgramGenerator::emitItem() {
+  const unsigned choice = random() % 100;
+  if (choice < 25) {
+    emitRegOp(kRegOps[random() % count(kRegOps)]);
+  } else if (choice < 45) {
+    emitImmOp(kImmOps[random() % count(kImmOps)]);
+  } else if (choice < 48) {
+    emit(LerosInstr::sra, 0);
+  } else if (choice < 56) {
+    emit(LerosInstr::store, reg());
+  } else if (choice < 62) {
+    emitConstant(random() % (count(kLoadHighOps) + 1));
+  } else if (choice < 72) {
+    emitMemory(kMemoryOps[random() % count(kMemoryOps)]);
+  } else if (choice < 78) {
+    emitIf(kConditionalBranches[random() % count(kConditionalBranches)]);
+  } else if (choice < 81) {
+    emitIfElse();
+  } else if (choice < 85 && !m_inSubroutine &&
+             m_depth < m_options.maxLoopDepth) {
+    emitLoop();
+  } else if (choice < 88 && !m_inSubroutine) {
+    emitCall();
+  } else if (choice < 90) {
+    emit(LerosInstr::in, CYCLE_PORT + random() % CycleCounterDevice::NUM_REGS);
+    emit(LerosInstr::store, reg());
+  } else if (choice < 91) {
+    // Ports above the devices ignore writes
+    emit(LerosInstr::out, 0x80 + random() % 0x80);
+  } else if (choice < 92) {
+    emit(LerosInstr::nop, 0);
+  } else {
+    emitFused();
+  }
+}
+
+void ProgramGenerator::emitBlock(unsigned n) {
+  for (unsigned i = 0; i < n && !full(); i++) {
+    emitItem();
+  }
+}
+
+void ProgramGenerator::generate() {
+  for (unsigned i = 0; i < 2; i++) {
+    m_subroutines.push_back(newLabel());
+  }
+
+  // The arguments and the address of the data area go to registers, and
+  // every instruction is used once before the random body
+  for (unsigned i = 0; i < kGenArguments; i++) {
+    emit(LerosInstr::ldaddr, kArgvReg);
+    emit(LerosInstr::ldind, i);
+    emit(LerosInstr::store, kGeneralRegs[i * 3 % count(kGeneralRegs)]);
+  }
+  const uint64_t data = kGenDataStart + kGenDataSize / 2;
+  emit(LerosInstr::loadi, data & 0xff);
+  for (unsigned i = 0; i < 3; i++) {
+    emit(kLoadHighOps[i], (data >> (8 * (i + 1))) & 0xff);
+  }
+  emit(LerosInstr::store, kDataReg);
+  for (LerosInstr op : kRegOps) {
+    emitRegOp(op);
+  }
+  for (LerosInstr op : kImmOps) {
+    emitImmOp(op);
+  }
+  emit(LerosInstr::sra, 0);
+  emitConstant(count(kLoadHighOps));
+  for (LerosInstr op : kMemoryOps) {
+    emitMemory(op);
+  }
+  for (LerosInstr op : kConditionalBranches) {
+    emitIf(op);
+  }
+  emitIfElse();
+  emitLoop();
+  emitCall();
+  emit(LerosInstr::in, CYCLE_PORT);
+  emit(LerosInstr::out, 0x80);
+  emit(LerosInstr::nop, 0);
+
+  emitBlock(m_options.length / 3);
+  emit(LerosInstr::scall, 0);
+  for (int label : m_subroutines) {
+    emitSubroutine(label);
+  }
+  resolve();
+}
+
+} // namespace
+
+bool writeRandomProgram(const std::string &path, uint64_t seed,
+                        const ProgramGenOptions &options) {
+  ProgramGenerator generator(seed, options);
+  generator.generate();
+  std::string text;
+  for (uint16_t instr : generator.code()) {
+    text += static_cast<char>(instr & 0xff);
+    text += static_cast<char>(instr >> 8);
+  }
+  std::string data(kGenDataSize, 0);
+  uint64_t random = seed + 1;
+  for (auto &c : data) {
+    random = random * 6364136223846793005ull + 1442695040888963407ull;
+    c = static_cast<char>(random >> 56);
+  }
+
+  ELFIO::elfio writer;
+  writer.create(XLen == 64 ? ELFCLASS64 : ELFCLASS32, ELFDATA2LSB);
+  writer.set_os_abi(ELFOSABI_NONE);
+  writer.set_type(ET_EXEC);
+  writer.set_entry(kTextStart);
+  const struct {
+    const char *name;
+    uint64_t address;
+    const std::string &contents;
+    bool code;
+  } sections[] = {{".text", kTextStart, text, true},
+                  {".data", kGenDataStart, data, false}};
+  for (const auto &s : sections) {
+    ELFIO::section *section = writer.sections.add(s.name);
+    section->set_type(SHT_PROGBITS);
+    section->set_flags(SHF_ALLOC | (s.code ? SHF_EXECINSTR : SHF_WRITE));
+    section->set_addr_align(s.code ? ILEN : WORDSIZE);
+    section->set_address(s.address);
+    section->set_data(s.contents);
+    ELFIO::segment *segment = writer.segments.add();
+    segment->set_type(PT_LOAD);
+    segment->set_virtual_address(s.address);
+    segment->set_physical_address(s.address);
+    segment->set_flags(s.code ? PF_R | PF_X : PF_R | PF_W);
+    segment->set_align(0x1000);
+    segment->add_section_index(section->get_index(),
+                               section->get_addr_align());
+  }
+  return writer.save(path);
+}
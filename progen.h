@@ -0,0 +1,34 @@
+#ifndef PROGEN_H
+#define PROGEN_H
+
+#include <stdint.h>
+#include <string>
+
+// Random Leros programs for differential testing of the execution engines
+// (see leros-difftest.cpp). Programs terminate by construction: backward
+// branches only close loops with a bounded counter, calls go to leaf
+// subroutines which return, and every other branch is a forward branch. They
+// use every instruction of LerosInstr, with loadh*i chains, loads and stores
+// through computed addresses within a data area, and the patterns fused into
+// superinstructions by the predecoder. Branch conditions depend on the input
+// arguments, so runs with different arguments take different paths.
+struct ProgramGenOptions {
+  // Approximate number of instructions of the main body
+  unsigned length = 300;
+  unsigned maxLoopIterations = 8;
+  unsigned maxLoopDepth = 3;
+};
+
+// Address and size of the data area the programs load from and store to,
+// which is initialized with random contents
+constexpr uint64_t kGenDataStart = 0x20000;
+constexpr uint64_t kGenDataSize = 0x800;
+// Number of input arguments the programs read
+constexpr unsigned kGenArguments = 4;
+
+// Write the program generated from 'seed' as an ELF executable to 'path'.
+// Returns false if the file could not be written.
+bool writeRandomProgram(const std::string &path, uint64_t seed,
+                        const ProgramGenOptions &options);
+
+#endif // PROGEN_H
@@ -0,0 +1,123 @@
+#include "programimage.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "elfio/elfio.hpp"
+
+ProgramImage::~ProgramImage() {
+  if (m_map) {
+    munmap(m_map, m_mapSize);
+  }
+}
+
+bool ProgramImage::load(const std::string &filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // The mapping is private and writable, such that the kernel provides copy on
+  // write semantics for guest pages which alias it.
+  m_mapSize = st.st_size;
+  void *map =
+      mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    m_mapSize = 0;
+    return false;
+  }
+  m_map = static_cast<uint8_t *>(map);
+
+  if (loadELF(filename)) {
+    return true;
+  }
+
+  // Flat binary; a single executable segment at address 0
+  m_segments.push_back({0, m_mapSize, m_mapSize, PF_R | PF_X, m_map, false});
+  m_sections.push_back({".text", 0, m_mapSize, SHT_PROGBITS,
+                        SHF_ALLOC | SHF_EXECINSTR});
+  return true;
+}
+
+bool ProgramImage::loadELF(const std::string &filename) {
+  // The reader parses (and buffers) the entire file. It only lives for the
+  // duration of this function; everything needed afterwards is extracted here.
+  ELFIO::elfio reader;
+  if (!reader.load(filename)) {
+    return false;
+  }
+
+  m_isELF = true;
+  m_entry = reader.get_entry();
+
+  for (const ELFIO::segment *segment : reader.segments) {
+    if (segment->get_type() != PT_LOAD) {
+      continue;
+    }
+    const uint64_t offset = segment->get_offset();
+    uint64_t filesz = segment->get_file_size();
+    if (offset > m_mapSize) {
+      filesz = 0;
+    } else if (offset + filesz > m_mapSize) {
+      filesz = m_mapSize - offset;
+    }
+    m_segments.push_back({segment->get_virtual_address(), filesz,
+                          segment->get_memory_size(), segment->get_flags(),
+                          m_map + offset, false});
+  }
+
+  for (auto &a : m_segments) {
+    for (const auto &b : m_segments) {
+      if (&a != &b && a.data < b.data + b.filesz &&
+          b.data < a.data + a.filesz) {
+        a.overlapsOther = true;
+      }
+    }
+  }
+
+  for (ELFIO::section *section : reader.sections) {
+    m_sections.push_back({section->get_name(), section->get_address(),
+                          section->get_size(), section->get_type(),
+                          section->get_flags()});
+
+    if (section->get_type() == SHT_SYMTAB) {
+      const ELFIO::symbol_section_accessor symbols(reader, section);
+      for (ELFIO::Elf_Xword i = 0; i < symbols.get_symbols_num(); i++) {
+        Symbol sym;
+        ELFIO::Elf64_Addr value;
+        ELFIO::Elf_Xword size;
+        unsigned char bind, type, other;
+        ELFIO::Elf_Half sectionIndex;
+        if (symbols.get_symbol(i, sym.name, value, size, bind, type,
+                               sectionIndex, other) &&
+            !sym.name.empty()) {
+          sym.value = value;
+          sym.size = size;
+          sym.type = type;
+          m_symbols.push_back(sym);
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+const ProgramImage::Section *
+ProgramImage::section(const std::string &name) const {
+  for (const auto &s : m_sections) {
+    if (s.name == name) {
+      return &s;
+    }
+  }
+  return nullptr;
+}
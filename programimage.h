@@ -0,0 +1,70 @@
+#ifndef PROGRAMIMAGE_H
+#define PROGRAMIMAGE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A program file mapped into host memory. ELF executables are parsed into
+// their loadable segments, sections and symbols; the ELF reader is only used
+// during load() and segment contents are served straight from the mapping.
+// Any other file is treated as a flat binary, loaded at address 0.
+class ProgramImage {
+public:
+  struct Segment {
+    uint64_t vaddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint32_t flags; // PF_R, PF_W, PF_X
+    // Segment contents within the private, writable file mapping
+    uint8_t *data;
+    // Whether the file range of this segment is shared with another segment,
+    // in which case guest pages must not alias the mapping
+    bool overlapsOther;
+  };
+
+  struct Section {
+    std::string name;
+    uint64_t addr;
+    uint64_t size;
+    uint32_t type;
+    uint64_t flags;
+  };
+
+  struct Symbol {
+    std::string name;
+    uint64_t value;
+    uint64_t size;
+    unsigned char type; // STT_FUNC, STT_OBJECT, ...
+  };
+
+  ProgramImage() = default;
+  ProgramImage(const ProgramImage &) = delete;
+  ProgramImage &operator=(const ProgramImage &) = delete;
+  ~ProgramImage();
+
+  // Returns false if the file could not be opened or mapped
+  bool load(const std::string &filename);
+
+  bool isELF() const { return m_isELF; }
+  uint64_t entry() const { return m_entry; }
+  const std::vector<Segment> &segments() const { return m_segments; }
+  const std::vector<Section> &sections() const { return m_sections; }
+  const std::vector<Symbol> &symbols() const { return m_symbols; }
+
+  // Returns nullptr if no section with the given name exists
+  const Section *section(const std::string &name) const;
+
+private:
+  bool loadELF(const std::string &filename);
+
+  uint8_t *m_map = nullptr;
+  size_t m_mapSize = 0;
+  bool m_isELF = false;
+  uint64_t m_entry = 0;
+  std::vector<Segment> m_segments;
+  std::vector<Section> m_sections;
+  std::vector<Symbol> m_symbols;
+};
+
+#endif // PROGRAMIMAGE_H
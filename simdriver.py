@@ -2,20 +2,121 @@ import argparse
 import sys
 import subprocess
 import os
+import itertools
+import json
+from concurrent.futures import ThreadPoolExecutor
 from math import floor
 # --llp="~/Work/build-leros-llvm-Clang-Debug/bin" --sim="~/Work/build-leros-sim-Desktop_Qt_5_12_0_GCC_64bit-Debug/leros-sim" --test="~/Work/leros-sim/simdrivertests.txt"
 
 class DriverOptions:
     llvmPath = ""
-    simExecutable = ""
+    simPath = ""
     testPath = ""
+    timeout = 10
+    threads = 0
+    lockstep = True
+    indexPath = ""
+    coveragePath = ""
+    fuzzRuns = 0
 
 class testSpec:
     argumentRanges = []
     testFile = ""
     verbose=False
 
-SPECIAL_REGISTERS = ["ACC", "ADDR", "PC", "INSTRUCTIONS EXECUTED"]
+# The simulator extension module, imported from the simulator build directory
+lerossim = None
+
+def importSimulator(path):
+    global lerossim
+    # Accept the simulator executable as well as its build directory
+    if os.path.isfile(path):
+        path = os.path.dirname(path)
+    sys.path.insert(0, path)
+    import lerossim
+
+def argvToString(argv):
+    return " ".join(str(a) for a in argv)
+
+def stopReason(stop):
+    if stop == lerossim.STOP_TIMEOUT:
+        return "Stopped at timeout"
+    if stop == lerossim.STOP_INSTRUCTION_LIMIT:
+        return "Stopped at instruction limit"
+    return "Stopped with status %d" % stop
+
+
+def baseFeature(feature):
+    # Strip the code hash of function features
+    return feature.split("#")[0]
+
+class TestIndex:
+    """Features of the code of each test program and the features its runs
+    exercised (see features.h), kept in a JSON file between driver runs.
+    Programs whose features intersect the difference between the code of the
+    indexed and the current programs, ie. after a change of the compiler
+    lowering, are run first, so failures show up early."""
+
+    version = 1
+    # Argument sets profiled per program, spread over the swept ones
+    sampleSize = 32
+
+    def __init__(self, path, scriptPath):
+        self.path = path
+        self.scriptPath = scriptPath
+        self.entries = {}
+        if os.path.isfile(path):
+            with open(path) as f:
+                index = json.load(f)
+            if index.get("version") == self.version:
+                self.entries = index["programs"]
+
+    def key(self, executable):
+        return os.path.relpath(executable, self.scriptPath)
+
+    def prioritize(self, executables):
+        # Returns the executables affected by the change and the others, and
+        # remembers the current code features of all of them
+        self.current = {}
+        changed = set()
+        for executable in executables:
+            code = lerossim.features(executable)
+            self.current[executable] = code
+            entry = self.entries.get(self.key(executable))
+            if entry is not None:
+                changed |= set(map(baseFeature, code.symmetric_difference(entry["code"])))
+        first = []
+        rest = []
+        for executable in executables:
+            entry = self.entries.get(self.key(executable))
+            if entry is None or changed.intersection(entry["executed"]):
+                first.append(executable)
+            else:
+                rest.append(executable)
+        return first, rest
+
+    def update(self, jobs, timeout, threads):
+        # Record the executed features of programs which are new or changed,
+        # from a sample of their argument sets including the first and last
+        def profile(job):
+            executable, argvs = job
+            step = max(1, (len(argvs) - 1) // (self.sampleSize - 1))
+            sample = argvs[:-1:step][:self.sampleSize - 1] + argvs[-1:]
+            return lerossim.features(executable, sample, timeout=timeout)
+        stale = []
+        for executable, argvs in jobs:
+            entry = self.entries.get(self.key(executable))
+            if entry is None or set(entry["code"]) != self.current[executable]:
+                stale.append((executable, argvs))
+        # features() releases the GIL while it simulates
+        with ThreadPoolExecutor(max_workers=threads or os.cpu_count()) as pool:
+            for (executable, _), executed in zip(stale, pool.map(profile, stale)):
+                self.entries[self.key(executable)] = {"code": sorted(self.current[executable]),
+                                                      "executed": sorted(executed)}
+
+    def save(self):
+        with open(self.path, "w") as f:
+            json.dump({"version": self.version, "programs": self.entries}, f, indent=1, sort_keys=True)
 
 
 class Driver:
@@ -29,13 +130,24 @@ class Driver:
         self.success = True
         self.totalTestRuns = 0
 
+        # Compile the tests and compute the expected results first, then
+        # simulate all tests together so the simulator threads stay busy
+        # across tests of very different cost
+        tests = []
         for spec in self.testSpecs:
             self.currentTestSpec = spec
             self.iteration = 0
             self.totalIterations = 1
-            self.runTest(spec)
+            tests.append(self.prepareTest(spec))
             self.totalTestRuns += self.totalIterations
 
+        self.executeSimulator(tests)
+        if self.options.fuzzRuns:
+            self.fuzzTests(tests)
+
+        for test in tests:
+            self.cleanupTest(test)
+
         if self.success:
             print("All tests ran successfully. Executed %d tests" % self.totalTestRuns)
         else:
@@ -78,21 +190,9 @@ class Driver:
         nameMap["exec"] = filename
         nameMap["lerosExec_O0"] = filename + "lerosExec_O0"
         nameMap["lerosExec_O1"] = filename + "lerosExec_O1"
+        nameMap["harness"] = filename + "harness"
         return nameMap
 
-    def parseSimulatorOutput(self, outputString):
-        registerStates = {}
-        for line in outputString.splitlines():
-            # For now, dont parse special registers
-            line = line.decode("utf-8")
-            if any(reg in line for reg in SPECIAL_REGISTERS):
-                continue
-            pairs = filter(None, line.split(" "))
-            for p in pairs:
-                p = p.split(":")
-                registerStates[int(p[0])] = int(p[1])
-        return registerStates
-
     def compileTestPrograms(self, spec):
         # Get the names which will be generated
         testNames = self.getTestNames(spec.testFile)
@@ -103,51 +203,49 @@ class Driver:
 
         # Compile to host system with the -DLEROS_HOST_TEST flag using g++
         subprocess.call(["g++", "-DLEROS_HOST_TEST", "-std=c++11", testNames["c"], "-o", testNames["exec"]])
+        if self.options.fuzzRuns:
+            # Persistent host harness, answering the fuzzer of the simulator
+            subprocess.call(["g++", "-DLEROS_HOST_TEST", "-DLEROS_HOST_HARNESS", "-std=c++11", testNames["c"],
+                             os.path.join(self.scriptPath, "tests", "c", "harness.cpp"), "-o", testNames["harness"]])
 
     def runHost(self, executable, argv):
         output = subprocess.check_output("%s %s" % (executable, argv), shell=True)
         return int(output)
 
 
-    def recurseRunTest(self, ranges, argv):
-        if len(ranges) > 0:
-            # Expand range through recursion
-            for i in ranges[0]:
-                currentArgv =  argv + str(i) + " "
-                self.recurseRunTest(ranges[1:], currentArgv)
-        else:
-            # No more ranges to expand, do test
+    def expandArguments(self, ranges):
+        # All combinations of the argument ranges, the last range varying fastest
+        return [list(argv) for argv in itertools.product(*ranges)]
+
+    def runHostTests(self, argvs):
+        # Get verification parameters by executing the host executable
+        expected = []
+        for argv in argvs:
             if self.currentTestSpec.verbose:
-                s = "Test %d:%d     argv: %s" % (self.iteration, self.totalIterations, argv)
+                s = "Test %d:%d     argv: %s" % (self.iteration, self.totalIterations, argvToString(argv))
                 print(s)
             self.iteration += 1
-            outputRegState = {}
-	    # Get verification parameter by executing the host executable
-            outputRegState[4] = self.runHost(self.testNames["exec"], argv)
-            self.success &= not self.executeSimulator(self.testNames["c"], argv, outputRegState)
+            expected.append(self.runHost(self.testNames["exec"], argvToString(argv)))
+        return expected
 
-    def runTest(self, spec):
+    def prepareTest(self, spec):
         print("Testing: %s" % spec.testFile)
         self.testNames = self.getTestNames(spec.testFile)
         os.chdir(os.path.dirname(os.path.realpath(spec.testFile)))
 
         self.compileTestPrograms(spec)
 
-        # Calculate the number of iterations were going to be doing
-        for r in spec.argumentRanges:
-            iterRange = 0
-            for i in r:
-                iterRange += 1 # ewwww
-            self.totalIterations *= iterRange
-
-        # Expand input arguments. We expect that the initial argument is given from register r4
-        self.recurseRunTest(spec.argumentRanges, "")
-
+        # Expand input arguments. We expect that the result is returned in register r4
+        argvs = self.expandArguments(spec.argumentRanges)
+        self.totalIterations = len(argvs)
+        expected = self.runHostTests(argvs)
+        return (spec, self.testNames, argvs, expected)
 
-        # Cleanup
-        os.remove(self.testNames["exec"])
-        os.remove(self.testNames["lerosExec_O0"])
-        os.remove(self.testNames["lerosExec_O1"])
+    def cleanupTest(self, test):
+        _, testNames, _, _ = test
+        for name in ["exec", "lerosExec_O0", "lerosExec_O1", "harness"]:
+            if os.path.exists(testNames[name]):
+                os.remove(testNames[name])
 
     def regstateToString(self, regstate):
         s = ""
@@ -155,49 +253,114 @@ class Driver:
             s += str(reg) + ":" + str(regstate[reg]) + ","
         return s
 
-    def executeSimulator(self, testPath, argv, expectedRegState):
-        # Run the test with the given options:
-        rawOutputs = []
-        try:
-            rawOutputs.append((subprocess.check_output([self.options.simExecutable + " --osmr --argv=\"" +
-                                               argv + "\" -f " + self.testNames["lerosExec_O0"]], shell=True)))
-            rawOutputs.append((subprocess.check_output([self.options.simExecutable + " --osmr --argv=\"" +
-                                                     argv + "\" -f " + self.testNames["lerosExec_O1"]], shell=True)))
-        except subprocess.CalledProcessError as e:
-            print(e.output)
-            return True
-
-        # Parse simulator output
-        outputs = []
-        for rawOutput in rawOutputs:
-            outputs.append(self.parseSimulatorOutput(rawOutput))
-
-        # Verify output
-        discrepancy = False
-        for output in outputs:
-            for expectedReg in expectedRegState:
-                if output[expectedReg] != expectedRegState[expectedReg]:
-                    discrepancy = True
-                    print("FAIL (ARG: %s):      In R:%d;  Expected: %d    Actual: %d" % (argv, expectedReg, expectedRegState[expectedReg], output[expectedReg]))
+    def executeSimulator(self, tests):
+        # Run all argument sets of all tests in-process, in parallel. Tests
+        # which do not terminate are stopped by the timeout and fail.
+        jobs = []
+        checks = []
+        for spec, testNames, argvs, expected in tests:
+            for executable in [testNames["lerosExec_O0"], testNames["lerosExec_O1"]]:
+                if not os.path.isfile(executable):
+                    print("FAIL (%s):      could not load '%s'" % (spec.testFile, executable))
+                    self.success = False
+                    continue
+                jobs.append((executable, argvs))
+                checks.append((spec, argvs, expected))
 
-        return discrepancy
+        if self.options.indexPath:
+            self.runIndexed(jobs, checks)
+        else:
+            self.runJobs(jobs, checks)
+        if self.options.coveragePath:
+            self.reportCoverage(jobs)
+
+    def runIndexed(self, jobs, checks):
+        # With a test index, the programs affected by changes run first
+        index = TestIndex(self.options.indexPath, self.scriptPath)
+        first, _ = index.prioritize([executable for executable, _ in jobs])
+        first = set(first)
+        batches = [[i for i, job in enumerate(jobs) if job[0] in first],
+                   [i for i, job in enumerate(jobs) if job[0] not in first]]
+        print("Running %d of %d test programs affected by changes first" % (len(batches[0]), len(jobs)))
+        for batch in batches:
+            if batch:
+                self.runJobs([jobs[i] for i in batch], [checks[i] for i in batch])
+        index.update(jobs, self.options.timeout, self.options.threads)
+        index.save()
+
+    def fuzzTests(self, tests):
+        # Fuzz the arguments of both builds of each test against its host
+        # harness, starting from a sample of the swept arguments
+        simDir = self.options.simPath
+        if os.path.isfile(simDir):
+            simDir = os.path.dirname(simDir)
+        simulator = os.path.join(simDir, "leros-sim")
+        for spec, testNames, argvs, _ in tests:
+            if not argvs or not argvs[0] or not os.path.isfile(testNames["harness"]):
+                continue
+            inputs = ";".join(argvToString(argv) for argv in argvs[::max(1, len(argvs) // 8)])
+            for executable in [testNames["lerosExec_O0"], testNames["lerosExec_O1"]]:
+                if not os.path.isfile(executable):
+                    continue
+                print("Fuzzing: %s" % executable)
+                sys.stdout.flush()
+                status = subprocess.call([simulator, "-f", executable, "--fuzz", testNames["harness"],
+                                          "--fuzz-runs", str(self.options.fuzzRuns), "--fuzz-inputs", inputs,
+                                          "--timeout", str(self.options.timeout)])
+                if status != 0:
+                    print("FAIL (%s):      fuzzing found differences from the host build" % spec.testFile)
+                    self.success = False
+
+    def reportCoverage(self, jobs):
+        # Coverage is recorded by a separate pass with the scalar engines, as
+        # lockstep execution is not instrumented
+        print("Coverage of %d test programs:" % len(jobs))
+        print(lerossim.coverage(jobs, lcov=self.options.coveragePath, threads=self.options.threads,
+                                timeout=self.options.timeout), end="")
+
+    def runJobs(self, jobs, checks):
+        results = lerossim.sweep_many(jobs, registers=[4], threads=self.options.threads,
+                                      lockstep=self.options.lockstep, timeout=self.options.timeout)
 
+        # Verify output
+        for (spec, argvs, expected), (values, stops, _) in zip(checks, results):
+            for argv, value, stop, expectedValue in zip(argvs, values, stops, expected):
+                if stop not in (lerossim.STOP_SCALL, lerossim.STOP_EXIT):
+                    self.success = False
+                    print("FAIL %s (ARG: %s):      %s" % (spec.testFile, argvToString(argv), stopReason(stop)))
+                elif value != expectedValue:
+                    self.success = False
+                    print("FAIL %s (ARG: %s):      In R:%d;  Expected: %d    Actual: %d" % (spec.testFile, argvToString(argv), 4, expectedValue, value))
 
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
 
     parser.add_argument("--llp", help="Path to the LLVM tools which are to be used")
-    parser.add_argument("--sim", help="Path to the simulator executable")
+    parser.add_argument("--sim", help="Path to the simulator build directory, containing the lerossim module")
     parser.add_argument("--test", help="Path to the test file specification")
+    parser.add_argument("--timeout", type=float, default=10, help="Time limit in seconds for each simulator run")
+    parser.add_argument("--threads", type=int, default=0, help="Number of simulator threads (default: one per CPU)")
+    parser.add_argument("--no-lockstep", action="store_true", help="Simulate each argument set separately instead of in SIMD lanes")
+    parser.add_argument("--coverage", default="", help="Write an lcov tracefile of the opcodes, branch directions and functions the tests cover, and print a summary")
+    parser.add_argument("--fuzz", type=int, default=0, metavar="RUNS", help="After the sweeps, fuzz the arguments of each test for RUNS runs per build against a persistent host harness, guided by coverage, and report minimized failing inputs")
+    parser.add_argument("--index", default="", help="Test index file, recording the features each test exercises; tests affected by changes of the compiled code since the last run are run first")
 
     args = parser.parse_args()
 
     if len(sys.argv) > 3:
         opt = DriverOptions()
         opt.llvmPath = os.path.expanduser(args.llp)
-        opt.simExecutable = os.path.expanduser(args.sim)
+        opt.simPath = os.path.expanduser(args.sim)
         opt.testFilePath = os.path.expanduser(args.test)
+        opt.timeout = args.timeout
+        opt.threads = args.threads
+        opt.lockstep = not args.no_lockstep
+        opt.indexPath = os.path.abspath(os.path.expanduser(args.index)) if args.index else ""
+        opt.coveragePath = os.path.abspath(os.path.expanduser(args.coverage)) if args.coverage else ""
+        opt.fuzzRuns = args.fuzz
+
+        importSimulator(opt.simPath)
 
         driver = Driver(opt)
 
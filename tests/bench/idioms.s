@@ -0,0 +1,41 @@
+# Simulator throughput benchmark, assembled by hand into idioms.bin (flat
+# binary, loaded at address 0). Runs 2^20 iterations of a loop written in the
+# style of unoptimized compiler output: a local variable kept in a stack slot,
+# constants built with loadi/loadhi, and values moved through the accumulator
+# with load/op/store sequences. Identical semantics on Leros32 and Leros64.
+_start:
+    load    r1          # allocate a stack frame
+    subi    64
+    store   r1
+    loadi   0           # r7 = 0x100000 iterations
+    loadhi  0
+    loadh2i 16
+    store   r7
+    loadi   0           # r8 = 0
+    store   r8
+    ldaddr  r1          # local = 0
+    stind   0
+loop:
+    ldaddr  r1          # r9 = local
+    ldind   0
+    store   r9
+    load    r9          # r10 = local + r7
+    add     r7
+    store   r10
+    ldaddr  r1          # local = r10
+    stind   0
+    loadi   0x55        # r11 = r10 & 0x155
+    loadhi  1
+    and     r10
+    store   r11
+    load    r8          # r8 += r11
+    add     r11
+    store   r8
+    load    r7          # r7 -= 1
+    subi    1
+    store   r7
+    load    r7
+    brnz    loop
+    load    r8          # return the accumulated value in r4
+    store   r4
+    scall   0
@@ -0,0 +1,30 @@
+# Simulator throughput benchmark, assembled by hand into memloop.bin (flat
+# binary, loaded at address 0). Runs 2^20 iterations of a loop mixing ALU,
+# register, indirect load/store and branch instructions. The loop only uses
+# operations with identical semantics on Leros32 and Leros64, such that the
+# same binary exercises both simulator configurations.
+_start:
+    load    r1          # allocate a stack frame
+    subi    64
+    store   r1
+    ldaddr  r1
+    loadi   0           # r7 = 0x100000 iterations
+    loadhi  0
+    loadh2i 16
+    store   r7
+loop:
+    load    r7
+    stind   0
+    ldind   0
+    addi    3
+    stind   1
+    ldind   1
+    add     r8
+    store   r8
+    load    r7
+    subi    1
+    store   r7
+    brnz    loop
+    load    r8          # return the accumulated value in r4
+    store   r4
+    scall   0
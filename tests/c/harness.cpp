@@ -0,0 +1,54 @@
+// Persistent host harness of a test program for fuzzing the simulated builds
+// against it (leros-sim --fuzz, see fuzzer.h). Linked with the test compiled
+// with -DLEROS_HOST_TEST -DLEROS_HOST_HARNESS, it reads the input arguments of
+// each run as a line of integers from stdin and writes the result of the test
+// as a line to stdout. The test is called in-process for every input, which
+// relies on the tests keeping no state in global variables; a test crashing
+// ends the harness, and the simulator starts it again for the next input. A
+// test returning without TEST_RETURN() writes "error", which the simulator
+// counts as a host error.
+
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+int leros_test_main(int argc, char **argv);
+long long leros_harness_result;
+
+// Outside the range of the int results of the tests
+constexpr long long kNoResult = 1ll << 32;
+
+int main() {
+  // Output of the tests themselves is discarded
+  FILE *results = fdopen(dup(1), "w");
+  if (!results || !freopen("/dev/null", "w", stdout)) {
+    return 1;
+  }
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream in(line);
+    std::vector<std::string> args = {"harness"};
+    for (std::string arg; in >> arg;) {
+      args.push_back(arg);
+    }
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    leros_harness_result = kNoResult;
+    leros_test_main(argv.size() - 1, argv.data());
+    if (leros_harness_result == kNoResult) {
+      fprintf(results, "error\n");
+    } else {
+      fprintf(results, "%lld\n", leros_harness_result);
+    }
+    fflush(results);
+  }
+  return 0;
+}
@@ -3,9 +3,19 @@
 #include <iostream>
 #include <string>
 #define ARG(n) std::stoi(argv[n + 1])
+
+#ifdef LEROS_HOST_HARNESS
+// The test is called once per input by harness.cpp
+#define main leros_test_main
+extern long long leros_harness_result;
+#define TEST_RETURN(val)                                                       \
+  leros_harness_result = (val);                                                \
+  return 0;
+#else
 #define TEST_RETURN(val)                                                       \
   printf("%d", val);                                                           \
   return 0;
+#endif
 
 #else
 
@@ -13,4 +23,4 @@
 
 #define TEST_RETURN(val) return val;
 
-#endif
\ No newline at end of file
+#endif
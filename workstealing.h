@@ -0,0 +1,160 @@
+#ifndef WORKSTEALING_H
+#define WORKSTEALING_H
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Hands out the runs of several jobs (ie. the argument lists of several
+// programs) to a pool of workers. Each worker owns a deque of ranges of runs,
+// takes chunks from the back of its own deque and steals half of the range at
+// the front of another worker's deque when its own is empty, so workers keep
+// busy however unevenly the cost is spread over the jobs.
+//
+// Chunks are sized to take about 'chunkInstructions' instructions, based on
+// the mean instruction count of the runs of the job completed so far, or on
+// the cost given for the job beforehand. Jobs of unknown cost are handed out
+// 'granularity' runs at a time until their first runs complete.
+class WorkStealingScheduler {
+public:
+  struct Range {
+    size_t job;
+    size_t begin;
+    size_t end;
+    size_t size() const { return end - begin; }
+  };
+
+  // 'runs' is the number of runs of each job, and 'costs' the expected
+  // number of instructions per run of each job, or 0 if unknown
+  WorkStealingScheduler(unsigned workers, const std::vector<size_t> &runs,
+                        const std::vector<double> &costs,
+                        size_t granularity = 1,
+                        uint64_t chunkInstructions = 1 << 22)
+      : m_granularity(std::max<size_t>(granularity, 1)),
+        m_chunkInstructions(chunkInstructions), m_costs(costs),
+        m_stats(new Stats[runs.size()]) {
+    m_costs.resize(runs.size());
+    for (unsigned w = 0; w < std::max(workers, 1u); w++) {
+      m_workers.emplace_back(new Worker());
+    }
+
+    // Deal out each job in one range per worker, starting with the worker
+    // after the one which received the end of the previous job
+    unsigned w = 0;
+    for (size_t job = 0; job < runs.size(); job++) {
+      const size_t pieces = std::min<size_t>(
+          m_workers.size(), (runs[job] + m_granularity - 1) / m_granularity);
+      for (size_t p = 0; p < pieces; p++) {
+        Range range{job, runs[job] * p / pieces, runs[job] * (p + 1) / pieces};
+        if (p + 1 < pieces) {
+          range.end -= range.end % m_granularity;
+        }
+        if (p > 0) {
+          range.begin -= range.begin % m_granularity;
+        }
+        if (range.size() != 0) {
+          m_workers[w]->ranges.push_back(range);
+          w = (w + 1) % m_workers.size();
+        }
+      }
+    }
+  }
+
+  // Get the next chunk of runs for 'worker'. Returns false when no work is
+  // left.
+  bool next(unsigned worker, Range &chunk) {
+    Worker &own = *m_workers[worker];
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.ranges.empty()) {
+          Range &range = own.ranges.back();
+          const size_t n = std::min(chunkSize(range.job), range.size());
+          chunk = Range{range.job, range.begin, range.begin + n};
+          range.begin += n;
+          if (range.size() == 0) {
+            own.ranges.pop_back();
+          }
+          return true;
+        }
+      }
+
+      // A range stolen by another worker may not be in its deque yet, in
+      // which case the last runs are not shared; the thief runs them
+      Range stolen;
+      if (!steal(worker, stolen)) {
+        return false;
+      }
+      std::lock_guard<std::mutex> lock(own.mutex);
+      own.ranges.push_back(stolen);
+    }
+  }
+
+  // Record the instructions executed by a chunk
+  void completed(const Range &chunk, uint64_t instructions) {
+    Stats &stats = m_stats[chunk.job];
+    stats.instructions.fetch_add(instructions, std::memory_order_relaxed);
+    stats.runs.fetch_add(chunk.size(), std::memory_order_relaxed);
+  }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Range> ranges;
+  };
+  struct Stats {
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<uint64_t> runs{0};
+  };
+
+  // Runs per chunk of 'job'
+  size_t chunkSize(size_t job) const {
+    const Stats &stats = m_stats[job];
+    const uint64_t runs = stats.runs.load(std::memory_order_relaxed);
+    double cost = m_costs[job];
+    if (runs != 0) {
+      cost = double(stats.instructions.load(std::memory_order_relaxed)) / runs;
+    }
+    if (cost <= 0) {
+      return m_granularity;
+    }
+    const double n = std::max(1.0, m_chunkInstructions / cost);
+    const size_t chunks = std::min<double>(n / m_granularity + 0.5, 1 << 20);
+    return std::max<size_t>(chunks, 1) * m_granularity;
+  }
+
+  bool steal(unsigned thief, Range &stolen) {
+    for (size_t i = 1; i < m_workers.size(); i++) {
+      Worker &victim = *m_workers[(thief + i) % m_workers.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.ranges.empty()) {
+        continue;
+      }
+      Range &range = victim.ranges.front();
+      // Take the upper half of the range, or all of it if it is too small to
+      // be split
+      size_t split = range.begin + (range.size() + 1) / 2;
+      split -= split % m_granularity;
+      if (split <= range.begin || split >= range.end) {
+        stolen = range;
+        victim.ranges.pop_front();
+      } else {
+        stolen = Range{range.job, split, range.end};
+        range.end = split;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  const size_t m_granularity;
+  const uint64_t m_chunkInstructions;
+  std::vector<double> m_costs;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::unique_ptr<Stats[]> m_stats;
+};
+
+#endif // WORKSTEALING_H